@@ -0,0 +1,793 @@
+// SPDX-License-Identifier: MIT
+#include "../arena.h"
+#include "../registry.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Keys are split into bytes, most significant first, with the sign bit flipped so that the bytes sort the same way the keys do
+#define ART_KEY_BYTES 8
+
+enum art_type {
+  ART_NODE4,
+  ART_NODE16,
+  ART_NODE48,
+  ART_NODE256,
+};
+
+typedef struct art_db {
+  void *root; // An inner node, a tagged leaf, or NULL if empty
+  kvds_arena leaves;
+  kvds_arena nodes[4]; // One for each enum art_type
+  kvds_value_arena values;
+} art_db;
+
+typedef struct art_leaf {
+  long long key;
+  kvds_value value;
+} art_leaf;
+
+// Header shared by all inner nodes
+// Inner nodes only branch on key bytes their leaves don't all share; runs of shared bytes are compressed into the prefix of the node below them
+typedef struct art_node {
+  uint8_t type; // enum art_type
+  uint8_t prefix_length;
+  uint16_t count; // Number of children
+  uint8_t prefix[ART_KEY_BYTES - 1]; // Bytes shared by all keys under the node, right after the ones its ancestors branched on
+} art_node;
+
+typedef struct art_node4 {
+  art_node header;
+  uint8_t bytes[4]; // Sorted; bytes[i] leads to children[i]
+  void *children[4];
+} art_node4;
+
+typedef struct art_node16 {
+  art_node header;
+  uint8_t bytes[16]; // Sorted; bytes[i] leads to children[i]
+  void *children[16];
+} art_node16;
+
+typedef struct art_node48 {
+  art_node header;
+  uint8_t slots[256]; // 1 + index into children for each byte, or 0 if there is no such child
+  void *children[48];
+} art_node48;
+
+typedef struct art_node256 {
+  art_node header;
+  void *children[256]; // Indexed by byte directly
+} art_node256;
+
+typedef struct art_cursor {
+  long long key;
+  art_leaf *leaf; // Leaf holding the key, or NULL if it doesn't exist
+} art_cursor;
+
+static const size_t art_node_sizes[4] = {sizeof(art_node4), sizeof(art_node16), sizeof(art_node48), sizeof(art_node256)};
+static const int art_node_capacities[4] = {4, 16, 48, 256};
+
+// Children are either inner nodes or leaves; leaves are told apart by setting the lowest bit of the pointer
+static inline bool art_is_leaf(void *child) {
+  return ((uintptr_t)child & 1) != 0;
+}
+
+static inline art_leaf *art_as_leaf(void *child) {
+  return (art_leaf *)((uintptr_t)child & ~(uintptr_t)1);
+}
+
+static inline void *art_tag_leaf(art_leaf *leaf) {
+  return (void *)((uintptr_t)leaf | 1);
+}
+
+static inline uint8_t art_key_byte(long long key, int depth) {
+  return (uint8_t)((((unsigned long long)key ^ (1ull << 63)) >> (8 * (ART_KEY_BYTES - 1 - depth))) & 0xff);
+}
+
+// Pointer to the child for the given byte, or NULL if there is none
+static void **art_find_child(art_node *node, uint8_t byte) {
+  switch (node->type) {
+  case ART_NODE4: {
+    art_node4 *node4 = (art_node4 *)node;
+    for (int i = 0; i < node->count; i++) {
+      if (node4->bytes[i] == byte) {
+        return &node4->children[i];
+      }
+    }
+    return NULL;
+  }
+  case ART_NODE16: {
+    art_node16 *node16 = (art_node16 *)node;
+    for (int i = 0; i < node->count && node16->bytes[i] <= byte; i++) {
+      if (node16->bytes[i] == byte) {
+        return &node16->children[i];
+      }
+    }
+    return NULL;
+  }
+  case ART_NODE48: {
+    art_node48 *node48 = (art_node48 *)node;
+    return node48->slots[byte] != 0 ? &node48->children[node48->slots[byte] - 1] : NULL;
+  }
+  case ART_NODE256: {
+    art_node256 *node256 = (art_node256 *)node;
+    return node256->children[byte] != NULL ? &node256->children[byte] : NULL;
+  }
+  }
+  return NULL;
+}
+
+// The child with the lowest byte above the given one (which may be -1, for the lowest child overall), or NULL if there is none; stores its byte in *found
+static void *art_child_above(art_node *node, int byte, int *found) {
+  switch (node->type) {
+  case ART_NODE4:
+  case ART_NODE16: { // Both keep their bytes sorted
+    uint8_t *bytes = node->type == ART_NODE4 ? ((art_node4 *)node)->bytes : ((art_node16 *)node)->bytes;
+    void **children = node->type == ART_NODE4 ? ((art_node4 *)node)->children : ((art_node16 *)node)->children;
+    for (int i = 0; i < node->count; i++) {
+      if (bytes[i] > byte) {
+        *found = bytes[i];
+        return children[i];
+      }
+    }
+    return NULL;
+  }
+  case ART_NODE48: {
+    art_node48 *node48 = (art_node48 *)node;
+    for (int i = byte + 1; i < 256; i++) {
+      if (node48->slots[i] != 0) {
+        *found = i;
+        return node48->children[node48->slots[i] - 1];
+      }
+    }
+    return NULL;
+  }
+  case ART_NODE256: {
+    art_node256 *node256 = (art_node256 *)node;
+    for (int i = byte + 1; i < 256; i++) {
+      if (node256->children[i] != NULL) {
+        *found = i;
+        return node256->children[i];
+      }
+    }
+    return NULL;
+  }
+  }
+  return NULL;
+}
+
+// The child with the highest byte below the given one (which may be 256, for the highest child overall), or NULL if there is none
+static void *art_child_below(art_node *node, int byte) {
+  switch (node->type) {
+  case ART_NODE4:
+  case ART_NODE16: {
+    uint8_t *bytes = node->type == ART_NODE4 ? ((art_node4 *)node)->bytes : ((art_node16 *)node)->bytes;
+    void **children = node->type == ART_NODE4 ? ((art_node4 *)node)->children : ((art_node16 *)node)->children;
+    for (int i = node->count - 1; i >= 0; i--) {
+      if (bytes[i] < byte) {
+        return children[i];
+      }
+    }
+    return NULL;
+  }
+  case ART_NODE48: {
+    art_node48 *node48 = (art_node48 *)node;
+    for (int i = byte - 1; i >= 0; i--) {
+      if (node48->slots[i] != 0) {
+        return node48->children[node48->slots[i] - 1];
+      }
+    }
+    return NULL;
+  }
+  case ART_NODE256: {
+    art_node256 *node256 = (art_node256 *)node;
+    for (int i = byte - 1; i >= 0; i--) {
+      if (node256->children[i] != NULL) {
+        return node256->children[i];
+      }
+    }
+    return NULL;
+  }
+  }
+  return NULL;
+}
+
+static art_leaf *art_minimum(void *node) {
+  int byte;
+  while (!art_is_leaf(node)) {
+    node = art_child_above(node, -1, &byte);
+  }
+  return art_as_leaf(node);
+}
+
+static art_leaf *art_maximum(void *node) {
+  while (!art_is_leaf(node)) {
+    node = art_child_below(node, 256);
+  }
+  return art_as_leaf(node);
+}
+
+#ifndef NDEBUG
+// Checks every node's shape, and that leaves come out in ascending order and match the bytes branched on above them
+static void _art_assert_invariants(void *node, int depth, uint8_t *path, art_leaf **prev_leaf) {
+  if (art_is_leaf(node)) {
+    art_leaf *leaf = art_as_leaf(node);
+    for (int i = 0; i < depth; i++) {
+      assert(art_key_byte(leaf->key, i) == path[i]);
+    }
+    assert(*prev_leaf == NULL || (*prev_leaf)->key < leaf->key);
+    *prev_leaf = leaf;
+    return;
+  }
+  art_node *inner = node;
+  assert(inner->count >= 2 && inner->count <= art_node_capacities[inner->type]);
+  assert(depth + inner->prefix_length < ART_KEY_BYTES);
+  memcpy(&path[depth], inner->prefix, inner->prefix_length);
+  depth += inner->prefix_length;
+  int children = 0;
+  int byte = -1;
+  for (void *child = art_child_above(inner, -1, &byte); child != NULL; child = art_child_above(inner, byte, &byte)) {
+    path[depth] = byte;
+    _art_assert_invariants(child, depth + 1, path, prev_leaf);
+    children++;
+  }
+  assert(children == inner->count);
+  if (inner->type == ART_NODE4 || inner->type == ART_NODE16) {
+    uint8_t *bytes = inner->type == ART_NODE4 ? ((art_node4 *)inner)->bytes : ((art_node16 *)inner)->bytes;
+    for (int i = 1; i < inner->count; i++) {
+      assert(bytes[i - 1] < bytes[i]);
+    }
+  }
+}
+static void art_assert_invariants(art_db *db) {
+  if (db->root != NULL) {
+    uint8_t path[ART_KEY_BYTES];
+    art_leaf *prev_leaf = NULL;
+    _art_assert_invariants(db->root, 0, path, &prev_leaf);
+  }
+}
+#else
+static void art_assert_invariants(art_db *db) {
+  // pass
+}
+#endif
+
+static kvds_db *art_create_db(const kvds_options *options) {
+  art_db *db = malloc(sizeof(art_db));
+
+  db->root = NULL;
+  kvds_arena_init(&db->leaves, sizeof(art_leaf), options->allocator);
+  kvds_arena_reserve(&db->leaves, options->capacity);
+  for (int type = 0; type < 4; type++) {
+    kvds_arena_init(&db->nodes[type], art_node_sizes[type], options->allocator);
+  }
+  kvds_value_arena_init(&db->values, options->allocator);
+
+  return db;
+}
+
+static void art_destroy_db(kvds_db *_db) {
+  art_db *db = _db;
+
+  kvds_value_arena_release(&db->values);
+  for (int type = 0; type < 4; type++) {
+    kvds_arena_release(&db->nodes[type]);
+  }
+  kvds_arena_release(&db->leaves);
+  free(db);
+}
+
+static art_node *art_node_create(art_db *db, enum art_type type) {
+  art_node *node = kvds_arena_alloc(&db->nodes[type]);
+  memset(node, 0, art_node_sizes[type]);
+  node->type = type;
+  return node;
+}
+
+static art_leaf *art_leaf_find(art_db *db, long long key) {
+  void *node = db->root;
+  int depth = 0;
+  while (node != NULL && !art_is_leaf(node)) {
+    art_node *inner = node;
+    // The prefix isn't checked on the way down; the leaf's full key is compared at the end instead
+    depth += inner->prefix_length;
+    void **child = art_find_child(inner, art_key_byte(key, depth));
+    node = child != NULL ? *child : NULL;
+    depth++;
+  }
+  if (node != NULL && art_as_leaf(node)->key == key) {
+    return art_as_leaf(node);
+  }
+  return NULL;
+}
+
+// Lowest leaf with a key at least as high as the given one, among those under node; depth is the number of key bytes already branched on
+static art_leaf *art_seek_higher(void *node, long long key, int depth) {
+  if (node == NULL) {
+    return NULL;
+  }
+  if (art_is_leaf(node)) {
+    return art_as_leaf(node)->key >= key ? art_as_leaf(node) : NULL;
+  }
+  art_node *inner = node;
+  for (int i = 0; i < inner->prefix_length; i++) {
+    uint8_t byte = art_key_byte(key, depth + i);
+    if (inner->prefix[i] != byte) {
+      return inner->prefix[i] > byte ? art_minimum(inner) : NULL; // Everything under the node is either above or below the key
+    }
+  }
+  depth += inner->prefix_length;
+  uint8_t byte = art_key_byte(key, depth);
+  void **child = art_find_child(inner, byte);
+  if (child != NULL) {
+    art_leaf *found = art_seek_higher(*child, key, depth + 1);
+    if (found != NULL) {
+      return found;
+    }
+  }
+  int above;
+  void *next = art_child_above(inner, byte, &above);
+  return next != NULL ? art_minimum(next) : NULL;
+}
+
+// Highest leaf with a key at most as high as the given one
+static art_leaf *art_seek_lower(void *node, long long key, int depth) {
+  if (node == NULL) {
+    return NULL;
+  }
+  if (art_is_leaf(node)) {
+    return art_as_leaf(node)->key <= key ? art_as_leaf(node) : NULL;
+  }
+  art_node *inner = node;
+  for (int i = 0; i < inner->prefix_length; i++) {
+    uint8_t byte = art_key_byte(key, depth + i);
+    if (inner->prefix[i] != byte) {
+      return inner->prefix[i] < byte ? art_maximum(inner) : NULL;
+    }
+  }
+  depth += inner->prefix_length;
+  uint8_t byte = art_key_byte(key, depth);
+  void **child = art_find_child(inner, byte);
+  if (child != NULL) {
+    art_leaf *found = art_seek_lower(*child, key, depth + 1);
+    if (found != NULL) {
+      return found;
+    }
+  }
+  void *next = art_child_below(inner, byte);
+  return next != NULL ? art_maximum(next) : NULL;
+}
+
+static kvds_cursor *art_create_cursor(kvds_db *_db, long long key) {
+  art_db *db = _db;
+  art_cursor *cursor = malloc(sizeof(art_cursor));
+
+  cursor->key = key;
+  cursor->leaf = art_leaf_find(db, key);
+
+  return cursor;
+}
+
+static void art_move_cursor(kvds_db *_db, kvds_cursor *_cursor, long long key) {
+  art_db *db = _db;
+  art_cursor *cursor = _cursor;
+
+  cursor->key = key;
+  cursor->leaf = art_leaf_find(db, key);
+}
+
+static void art_destroy_cursor(kvds_db *_db, kvds_cursor *_cursor) {
+  art_db *db = _db;
+  art_cursor *cursor = _cursor;
+
+  free(cursor);
+}
+
+static long long art_key(kvds_db *_db, kvds_cursor *_cursor) {
+  art_db *db = _db;
+  art_cursor *cursor = _cursor;
+
+  return cursor->key;
+}
+
+static bool art_exists(kvds_db *_db, kvds_cursor *_cursor) {
+  art_db *db = _db;
+  art_cursor *cursor = _cursor;
+
+  return cursor->leaf != NULL;
+}
+
+// Copies the children of a full node into the next bigger type, which takes its place in *reference
+static art_node *art_node_grow(art_db *db, void **reference, art_node *node) {
+  art_node *grown = art_node_create(db, node->type + 1);
+  grown->prefix_length = node->prefix_length;
+  memcpy(grown->prefix, node->prefix, node->prefix_length);
+  grown->count = node->count;
+
+  switch (node->type) {
+  case ART_NODE4: {
+    art_node4 *from = (art_node4 *)node;
+    art_node16 *to = (art_node16 *)grown;
+    memcpy(to->bytes, from->bytes, node->count);
+    memcpy(to->children, from->children, node->count * sizeof(void *));
+  } break;
+  case ART_NODE16: {
+    art_node16 *from = (art_node16 *)node;
+    art_node48 *to = (art_node48 *)grown;
+    for (int i = 0; i < node->count; i++) {
+      to->slots[from->bytes[i]] = i + 1;
+      to->children[i] = from->children[i];
+    }
+  } break;
+  case ART_NODE48: {
+    art_node48 *from = (art_node48 *)node;
+    art_node256 *to = (art_node256 *)grown;
+    for (int byte = 0; byte < 256; byte++) {
+      if (from->slots[byte] != 0) {
+        to->children[byte] = from->children[from->slots[byte] - 1];
+      }
+    }
+  } break;
+  }
+
+  kvds_arena_free(&db->nodes[node->type], node);
+  *reference = grown;
+  return grown;
+}
+
+static void art_add_child(art_db *db, void **reference, art_node *node, uint8_t byte, void *child) {
+  if (node->count == art_node_capacities[node->type]) {
+    node = art_node_grow(db, reference, node);
+  }
+
+  switch (node->type) {
+  case ART_NODE4:
+  case ART_NODE16: {
+    uint8_t *bytes = node->type == ART_NODE4 ? ((art_node4 *)node)->bytes : ((art_node16 *)node)->bytes;
+    void **children = node->type == ART_NODE4 ? ((art_node4 *)node)->children : ((art_node16 *)node)->children;
+    int i = 0;
+    while (i < node->count && bytes[i] < byte) {
+      i++;
+    }
+    memmove(&bytes[i + 1], &bytes[i], node->count - i);
+    memmove(&children[i + 1], &children[i], (node->count - i) * sizeof(void *));
+    bytes[i] = byte;
+    children[i] = child;
+  } break;
+  case ART_NODE48: {
+    art_node48 *node48 = (art_node48 *)node;
+    int slot = 0;
+    while (node48->children[slot] != NULL) { // Removals may leave holes anywhere
+      slot++;
+    }
+    node48->children[slot] = child;
+    node48->slots[byte] = slot + 1;
+  } break;
+  case ART_NODE256:
+    ((art_node256 *)node)->children[byte] = child;
+    break;
+  }
+  node->count++;
+}
+
+// Makes a node4 holding the two given children under the given prefix
+static art_node *art_node_split(art_db *db, const uint8_t *prefix, int prefix_length, uint8_t byte_a, void *child_a, uint8_t byte_b, void *child_b) {
+  art_node4 *split = (art_node4 *)art_node_create(db, ART_NODE4);
+  split->header.prefix_length = prefix_length;
+  memcpy(split->header.prefix, prefix, prefix_length);
+  split->header.count = 2;
+  bool a_first = byte_a < byte_b;
+  split->bytes[0] = a_first ? byte_a : byte_b;
+  split->children[0] = a_first ? child_a : child_b;
+  split->bytes[1] = a_first ? byte_b : byte_a;
+  split->children[1] = a_first ? child_b : child_a;
+  return &split->header;
+}
+
+static void art_insert(art_db *db, art_leaf *leaf) {
+  long long key = leaf->key;
+  void **reference = &db->root;
+  int depth = 0;
+
+  for (;;) {
+    void *node = *reference;
+    if (node == NULL) {
+      *reference = art_tag_leaf(leaf);
+      return;
+    }
+
+    if (art_is_leaf(node)) { // Both keys share the bytes so far; branch where they stop sharing them
+      art_leaf *other = art_as_leaf(node);
+      assert(other->key != key);
+      uint8_t prefix[ART_KEY_BYTES];
+      int length = 0;
+      while (art_key_byte(other->key, depth + length) == art_key_byte(key, depth + length)) {
+        prefix[length] = art_key_byte(key, depth + length);
+        length++;
+      }
+      *reference = art_node_split(db, prefix, length, art_key_byte(other->key, depth + length), node, art_key_byte(key, depth + length), art_tag_leaf(leaf));
+      return;
+    }
+
+    art_node *inner = node;
+    int matched = 0;
+    while (matched < inner->prefix_length && inner->prefix[matched] == art_key_byte(key, depth + matched)) {
+      matched++;
+    }
+    if (matched < inner->prefix_length) { // Branch off in the middle of the prefix; the node keeps whatever is left of it past the branching byte
+      uint8_t old_byte = inner->prefix[matched];
+      art_node *split = art_node_split(db, inner->prefix, matched, old_byte, inner, art_key_byte(key, depth + matched), art_tag_leaf(leaf));
+      inner->prefix_length -= matched + 1;
+      memmove(inner->prefix, &inner->prefix[matched + 1], inner->prefix_length);
+      *reference = split;
+      return;
+    }
+
+    depth += inner->prefix_length;
+    uint8_t byte = art_key_byte(key, depth);
+    void **child = art_find_child(inner, byte);
+    if (child == NULL) {
+      art_add_child(db, reference, inner, byte, art_tag_leaf(leaf));
+      return;
+    }
+    reference = child;
+    depth++;
+  }
+}
+
+static void art_write(kvds_db *_db, kvds_cursor *_cursor, const kvds_value *value) {
+  art_db *db = _db;
+  art_cursor *cursor = _cursor;
+
+  if (cursor->leaf != NULL) { // Special case: already exists
+    kvds_value_replace(&db->values, &cursor->leaf->value, value);
+    return;
+  }
+
+  art_leaf *leaf = kvds_arena_alloc(&db->leaves);
+  leaf->key = cursor->key;
+  kvds_value_store(&db->values, &leaf->value, value);
+  art_insert(db, leaf);
+  cursor->leaf = leaf;
+
+  art_assert_invariants(db);
+}
+
+static const kvds_value *art_read(kvds_db *_db, kvds_cursor *_cursor) {
+  art_db *db = _db;
+  art_cursor *cursor = _cursor;
+
+  return cursor->leaf != NULL ? &cursor->leaf->value : NULL;
+}
+
+// Copies the children of a node that has become small enough into the next smaller type, which takes its place in *reference
+static void art_node_shrink(art_db *db, void **reference, art_node *node) {
+  art_node *shrunk = art_node_create(db, node->type - 1);
+  shrunk->prefix_length = node->prefix_length;
+  memcpy(shrunk->prefix, node->prefix, node->prefix_length);
+  shrunk->count = node->count;
+
+  switch (node->type) {
+  case ART_NODE16: {
+    art_node16 *from = (art_node16 *)node;
+    art_node4 *to = (art_node4 *)shrunk;
+    memcpy(to->bytes, from->bytes, node->count);
+    memcpy(to->children, from->children, node->count * sizeof(void *));
+  } break;
+  case ART_NODE48: {
+    art_node48 *from = (art_node48 *)node;
+    art_node16 *to = (art_node16 *)shrunk;
+    int i = 0;
+    for (int byte = 0; byte < 256; byte++) {
+      if (from->slots[byte] != 0) {
+        to->bytes[i] = byte;
+        to->children[i] = from->children[from->slots[byte] - 1];
+        i++;
+      }
+    }
+  } break;
+  case ART_NODE256: {
+    art_node256 *from = (art_node256 *)node;
+    art_node48 *to = (art_node48 *)shrunk;
+    int i = 0;
+    for (int byte = 0; byte < 256; byte++) {
+      if (from->children[byte] != NULL) {
+        to->slots[byte] = i + 1;
+        to->children[i] = from->children[byte];
+        i++;
+      }
+    }
+  } break;
+  }
+
+  kvds_arena_free(&db->nodes[node->type], node);
+  *reference = shrunk;
+}
+
+static void art_remove_child(art_db *db, void **reference, art_node *node, uint8_t byte) {
+  switch (node->type) {
+  case ART_NODE4:
+  case ART_NODE16: {
+    uint8_t *bytes = node->type == ART_NODE4 ? ((art_node4 *)node)->bytes : ((art_node16 *)node)->bytes;
+    void **children = node->type == ART_NODE4 ? ((art_node4 *)node)->children : ((art_node16 *)node)->children;
+    int i = 0;
+    while (bytes[i] != byte) {
+      i++;
+    }
+    memmove(&bytes[i], &bytes[i + 1], node->count - i - 1);
+    memmove(&children[i], &children[i + 1], (node->count - i - 1) * sizeof(void *));
+  } break;
+  case ART_NODE48: {
+    art_node48 *node48 = (art_node48 *)node;
+    node48->children[node48->slots[byte] - 1] = NULL;
+    node48->slots[byte] = 0;
+  } break;
+  case ART_NODE256:
+    ((art_node256 *)node)->children[byte] = NULL;
+    break;
+  }
+  node->count--;
+
+  // Shrink with some slack, so that adding and removing a single key doesn't keep converting the node back and forth
+  if ((node->type == ART_NODE16 && node->count <= 3) || (node->type == ART_NODE48 && node->count <= 12) || (node->type == ART_NODE256 && node->count <= 37)) {
+    art_node_shrink(db, reference, node);
+  } else if (node->type == ART_NODE4 && node->count == 1) { // A single child doesn't need a node; merge the node's prefix and byte into it
+    art_node4 *node4 = (art_node4 *)node;
+    void *child = node4->children[0];
+    if (!art_is_leaf(child)) {
+      art_node *inner = child;
+      uint8_t prefix[ART_KEY_BYTES];
+      int length = node->prefix_length;
+      memcpy(prefix, node->prefix, length);
+      prefix[length++] = node4->bytes[0];
+      memcpy(&prefix[length], inner->prefix, inner->prefix_length);
+      length += inner->prefix_length;
+      inner->prefix_length = length;
+      memcpy(inner->prefix, prefix, length);
+    }
+    kvds_arena_free(&db->nodes[ART_NODE4], node);
+    *reference = child;
+  }
+}
+
+static bool art_remove(kvds_db *_db, kvds_cursor *_cursor) {
+  art_db *db = _db;
+  art_cursor *cursor = _cursor;
+
+  if (cursor->leaf == NULL) {
+    return false;
+  }
+
+  // Find the node right above the leaf, and what points at it
+  void **reference = &db->root;
+  void **parent_reference = NULL;
+  int depth = 0;
+  while (!art_is_leaf(*reference)) {
+    art_node *inner = *reference;
+    depth += inner->prefix_length;
+    parent_reference = reference;
+    reference = art_find_child(inner, art_key_byte(cursor->key, depth));
+    depth++;
+  }
+  assert(art_as_leaf(*reference) == cursor->leaf);
+
+  if (parent_reference == NULL) {
+    db->root = NULL;
+  } else {
+    art_remove_child(db, parent_reference, *parent_reference, art_key_byte(cursor->key, depth - 1));
+  }
+
+  kvds_value_clear(&db->values, &cursor->leaf->value);
+  kvds_arena_free(&db->leaves, cursor->leaf);
+  cursor->leaf = NULL;
+
+  art_assert_invariants(db);
+
+  return true;
+}
+
+static void art_snap(kvds_db *_db, kvds_cursor *_cursor, enum kvds_snap_direction dir) {
+  art_db *db = _db;
+  art_cursor *cursor = _cursor;
+
+  if (db->root == NULL) {
+    return; // Nothing in the database, nothing to find
+  }
+
+  art_leaf *found = NULL;
+  switch (dir) {
+  case KVDS_SNAP_HIGHER: {
+    found = cursor->key < LLONG_MAX ? art_seek_higher(db->root, cursor->key + 1, 0) : NULL;
+    if (found == NULL) {
+      found = cursor->leaf != NULL ? cursor->leaf : art_maximum(db->root); // Past the highest key; stay on it
+    }
+  } break;
+  case KVDS_SNAP_LOWER: {
+    found = cursor->key > LLONG_MIN ? art_seek_lower(db->root, cursor->key - 1, 0) : NULL;
+    if (found == NULL) {
+      found = cursor->leaf != NULL ? cursor->leaf : art_minimum(db->root); // Past the lowest key; stay on it
+    }
+  } break;
+  case KVDS_SNAP_CLOSEST_LOW: {
+    if (cursor->leaf != NULL) {
+      found = cursor->leaf; // Already at closest
+    } else {
+      art_leaf *lower = art_seek_lower(db->root, cursor->key, 0);
+      art_leaf *higher = art_seek_higher(db->root, cursor->key, 0);
+      if (lower != NULL && higher != NULL) {
+        found = (unsigned long long)cursor->key - lower->key <= (unsigned long long)higher->key - cursor->key ? lower : higher;
+      } else {
+        found = lower != NULL ? lower : higher;
+      }
+    }
+  } break;
+  }
+
+  cursor->leaf = found;
+  cursor->key = found->key;
+}
+
+// In-order walk over the leaves under node, starting from the lowest key at least as high as from
+// from_bound says whether the walk is still on the path to from; once it has gone right of it, everything further is above from
+static bool art_iterate_node(void *node, int depth, long long from, bool from_bound, long long to, bool (*callback)(void *context, long long key, const kvds_value *value), void *context) {
+  if (art_is_leaf(node)) {
+    art_leaf *leaf = art_as_leaf(node);
+    if (leaf->key < from) {
+      return true;
+    }
+    return leaf->key <= to && callback(context, leaf->key, &leaf->value);
+  }
+  art_node *inner = node;
+  if (from_bound) {
+    for (int i = 0; i < inner->prefix_length; i++) {
+      uint8_t byte = art_key_byte(from, depth + i);
+      if (inner->prefix[i] != byte) {
+        if (inner->prefix[i] < byte) {
+          return true; // Everything under the node is below from
+        }
+        from_bound = false;
+        break;
+      }
+    }
+  }
+  depth += inner->prefix_length;
+
+  int byte = from_bound ? art_key_byte(from, depth) - 1 : -1;
+  for (void *child = art_child_above(inner, byte, &byte); child != NULL; child = art_child_above(inner, byte, &byte)) {
+    if (!art_iterate_node(child, depth + 1, from, from_bound && byte == art_key_byte(from, depth), to, callback, context)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void art_iterate(kvds_db *_db, kvds_cursor *_cursor, long long to, bool (*callback)(void *context, long long key, const kvds_value *value), void *context) {
+  art_db *db = _db;
+  art_cursor *cursor = _cursor;
+
+  if (db->root != NULL) {
+    art_iterate_node(db->root, 0, cursor->key, true, to, callback, context);
+  }
+}
+
+REGISTER("radix", "art", "Store entries in an adaptive radix tree over the bytes of the keys") = {
+  .create_db = art_create_db,
+  .destroy_db = art_destroy_db,
+  .create_cursor = art_create_cursor,
+  .move_cursor = art_move_cursor,
+  .destroy_cursor = art_destroy_cursor,
+
+  .key = art_key,
+  .exists = art_exists,
+  .snap = art_snap,
+
+  .write = art_write,
+  .read = art_read,
+  .remove = art_remove,
+  .iterate = art_iterate,
+};
@@ -0,0 +1,481 @@
+// SPDX-License-Identifier: MIT
+#include "../arena.h"
+#include "../registry.h"
+#include "../stats.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct avl_db {
+  struct avl_node *top;
+  kvds_arena nodes;
+  kvds_value_arena values;
+} avl_db;
+
+typedef struct avl_node {
+  long long key;
+  kvds_value value;
+  struct avl_node *left;
+  struct avl_node *right;
+
+  struct avl_node *parent;
+  int height; // Height of the subtree rooted at the node; leaves are 1
+} avl_node;
+
+typedef struct avl_cursor {
+  long long key;
+  struct avl_node *best;
+  // Node under which the key would be if it were to exist in the tree
+  // Same guarantees as scg_cursor
+} avl_cursor;
+
+static inline int avl_get_height(avl_node *node) {
+  return node == NULL ? 0 : node->height;
+}
+
+static inline void avl_update_height(avl_node *node) {
+  int left_height = avl_get_height(node->left);
+  int right_height = avl_get_height(node->right);
+  node->height = 1 + (left_height > right_height ? left_height : right_height);
+}
+
+#ifndef NDEBUG
+typedef struct avl_invariants {
+  long long range_min;
+  long long range_max;
+} avl_invariants;
+static avl_invariants _avl_assert_invariants(avl_node *node) {
+  avl_invariants inv;
+
+  if (node->left == NULL) {
+    inv.range_min = node->key;
+  } else {
+    assert(node->left->parent == node);
+    avl_invariants inv_left = _avl_assert_invariants(node->left);
+    inv.range_min = inv_left.range_min;
+    assert(inv_left.range_max < node->key);
+  }
+  if (node->right == NULL) {
+    inv.range_max = node->key;
+  } else {
+    assert(node->right->parent == node);
+    avl_invariants inv_right = _avl_assert_invariants(node->right);
+    inv.range_max = inv_right.range_max;
+    assert(node->key < inv_right.range_min);
+  }
+
+  int left_height = avl_get_height(node->left);
+  int right_height = avl_get_height(node->right);
+  assert(node->height == 1 + (left_height > right_height ? left_height : right_height));
+  assert(left_height - right_height <= 1 && right_height - left_height <= 1);
+
+  return inv;
+}
+static void avl_assert_invariants(avl_db *db) {
+  if (db->top == NULL) return;
+  _avl_assert_invariants(db->top);
+  assert(db->top->parent == NULL);
+}
+#else
+static void avl_assert_invariants(avl_db *db) {
+  // pass
+}
+#endif
+
+static kvds_db *avl_create_db(const kvds_options *options) {
+  avl_db *db = malloc(sizeof(avl_db));
+  db->top = NULL;
+  kvds_arena_init(&db->nodes, sizeof(avl_node), options->allocator);
+  kvds_arena_reserve(&db->nodes, options->capacity);
+  kvds_value_arena_init(&db->values, options->allocator);
+  return db;
+}
+
+static void avl_destroy_db(kvds_db *_db) {
+  avl_db *db = _db;
+  kvds_value_arena_release(&db->values);
+  kvds_arena_release(&db->nodes);
+  free(db);
+}
+
+static avl_node *avl_node_locate(avl_db *db, long long key) {
+  avl_node *best = db->top;
+
+  while (best != NULL && best->key != key) {
+    if (key < best->key) {
+      if (best->left == NULL) break;
+      best = best->left;
+    } else {
+      if (best->right == NULL) break;
+      best = best->right;
+    }
+  }
+
+  return best;
+}
+static avl_node *avl_node_navigate_left(avl_node *node) {
+  if (node->left) { // descend left if we can
+    avl_node *result = node->left;
+    while (result->right != NULL) result = result->right;
+    return result;
+  } else {
+    while (node->parent != NULL) {
+      if (node->parent->right == node) { // We were right of that parent, meaning it's left of us
+        return node->parent;
+      }
+      node = node->parent;
+    }
+    return NULL;
+  }
+}
+static avl_node *avl_node_navigate_right(avl_node *node) {
+  if (node->right) { // descend right if we can
+    avl_node *result = node->right;
+    while (result->left != NULL) result = result->left;
+    return result;
+  } else {
+    while (node->parent != NULL) {
+      if (node->parent->left == node) { // We were left of that parent, meaning it's right of us
+        return node->parent;
+      }
+      node = node->parent;
+    }
+    return NULL;
+  }
+}
+
+static kvds_cursor *avl_create_cursor(kvds_db *_db, long long key) {
+  avl_db *db = _db;
+  avl_cursor *cursor = malloc(sizeof(avl_cursor));
+
+  cursor->key = key;
+  cursor->best = avl_node_locate(db, key);
+
+  return cursor;
+}
+
+static void avl_move_cursor(kvds_db *_db, kvds_cursor *_cursor, long long key) {
+  avl_db *db = _db;
+  avl_cursor *cursor = _cursor;
+
+  cursor->key = key;
+  cursor->best = avl_node_locate(db, key);
+}
+
+static void avl_destroy_cursor(kvds_db *_db, kvds_cursor *_cursor) {
+  avl_db *db = _db;
+  avl_cursor *cursor = _cursor;
+
+  free(cursor);
+}
+
+static long long avl_key(kvds_db *_db, kvds_cursor *_cursor) {
+  avl_db *db = _db;
+  avl_cursor *cursor = _cursor;
+
+  return cursor->key;
+}
+
+static bool avl_exists(kvds_db *_db, kvds_cursor *_cursor) {
+  avl_db *db = _db;
+  avl_cursor *cursor = _cursor;
+
+  return cursor->best != NULL && cursor->best->key == cursor->key;
+}
+
+// Puts replacement (which may be NULL) where node was under parent
+static void avl_node_replace(avl_db *db, avl_node *parent, avl_node *node, avl_node *replacement) {
+  if (parent == NULL) {
+    assert(db->top == node);
+    db->top = replacement;
+  } else if (parent->left == node) {
+    parent->left = replacement;
+  } else {
+    assert(parent->right == node);
+    parent->right = replacement;
+  }
+  if (replacement != NULL) {
+    replacement->parent = parent;
+  }
+}
+
+// Rotates node's child on the given side up into node's place, returning it
+static avl_node *avl_node_rotate(avl_db *db, avl_node *node, bool left_up) {
+  avl_node *child = left_up ? node->left : node->right;
+  avl_node *middle = left_up ? child->right : child->left;
+
+  kvds_stats_count(KVDS_STAT_ROTATIONS, 1);
+  avl_node_replace(db, node->parent, node, child);
+
+  if (left_up) {
+    node->left = middle;
+    child->right = node;
+  } else {
+    node->right = middle;
+    child->left = node;
+  }
+  if (middle != NULL) middle->parent = node;
+  node->parent = child;
+
+  avl_update_height(node);
+  avl_update_height(child);
+  return child;
+}
+
+static void avl_node_rebalance_from(avl_db *db, avl_node *node) {
+  while (node != NULL) {
+    int old_height = node->height;
+    int balance = avl_get_height(node->left) - avl_get_height(node->right);
+
+    if (balance > 1) {
+      if (avl_get_height(node->left->left) < avl_get_height(node->left->right)) {
+        avl_node_rotate(db, node->left, false); // Left-right case
+      }
+      node = avl_node_rotate(db, node, true);
+    } else if (balance < -1) {
+      if (avl_get_height(node->right->right) < avl_get_height(node->right->left)) {
+        avl_node_rotate(db, node->right, true); // Right-left case
+      }
+      node = avl_node_rotate(db, node, false);
+    } else {
+      avl_update_height(node);
+    }
+
+    if (node->height == old_height) {
+      break; // Nothing changed for the ancestors
+    }
+    node = node->parent;
+  }
+}
+
+static void avl_write(kvds_db *_db, kvds_cursor *_cursor, const kvds_value *value) {
+  avl_db *db = _db;
+  avl_cursor *cursor = _cursor;
+
+  if (cursor->best != NULL && cursor->best->key == cursor->key) { // Special case: already exists
+    kvds_value_replace(&db->values, &cursor->best->value, value);
+    return;
+  }
+
+  avl_node *new_node = kvds_arena_alloc(&db->nodes);
+
+  kvds_value_store(&db->values, &new_node->value, value);
+  new_node->key = cursor->key;
+  new_node->left = NULL;
+  new_node->right = NULL;
+  new_node->parent = cursor->best;
+  new_node->height = 1;
+
+  if (cursor->best == NULL) {
+    db->top = new_node;
+  } else if (new_node->key < cursor->best->key) {
+    assert(cursor->best->left == NULL);
+    cursor->best->left = new_node;
+  } else {
+    assert(cursor->best->right == NULL);
+    cursor->best->right = new_node;
+  }
+  avl_node_rebalance_from(db, cursor->best);
+
+  cursor->best = new_node;
+
+  avl_assert_invariants(db);
+}
+
+static const kvds_value *avl_read(kvds_db *_db, kvds_cursor *_cursor) {
+  avl_db *db = _db;
+  avl_cursor *cursor = _cursor;
+
+  if (cursor->best != NULL && cursor->best->key == cursor->key) { // The node exists
+    return &cursor->best->value;
+  } else {
+    return NULL;
+  }
+}
+
+static bool avl_remove(kvds_db *_db, kvds_cursor *_cursor) {
+  avl_db *db = _db;
+  avl_cursor *cursor = _cursor;
+
+  if (cursor->best == NULL || cursor->best->key != cursor->key) {
+    return false;
+  }
+
+  avl_node *node = cursor->best;
+  avl_node *rebalance_from;
+
+  if (node->left != NULL && node->right != NULL) {
+    // Move the successor into the node's place; nodes are relinked rather than copied, so that other cursors stay valid
+    avl_node *swap_node = node->right;
+    while (swap_node->left != NULL) swap_node = swap_node->left;
+
+    if (swap_node->parent == node) {
+      rebalance_from = swap_node;
+    } else {
+      rebalance_from = swap_node->parent;
+      avl_node_replace(db, swap_node->parent, swap_node, swap_node->right);
+      swap_node->right = node->right;
+      swap_node->right->parent = swap_node;
+    }
+    avl_node_replace(db, node->parent, node, swap_node);
+    swap_node->left = node->left;
+    swap_node->left->parent = swap_node;
+    swap_node->height = node->height;
+  } else {
+    rebalance_from = node->parent;
+    avl_node_replace(db, node->parent, node, node->left != NULL ? node->left : node->right);
+  }
+
+  kvds_value_clear(&db->values, &node->value);
+  kvds_arena_free(&db->nodes, node);
+
+  avl_node_rebalance_from(db, rebalance_from);
+
+  cursor->best = avl_node_locate(db, cursor->key);
+
+  avl_assert_invariants(db);
+
+  return true;
+}
+
+static void avl_snap(kvds_db *_db, kvds_cursor *_cursor, enum kvds_snap_direction dir) {
+  avl_db *db = _db;
+  avl_cursor *cursor = _cursor;
+
+  if (cursor->best == NULL) {
+    return; // Nothing in the database, nothing to find
+  }
+
+  switch (dir) {
+  case KVDS_SNAP_HIGHER: {
+    if (cursor->best->key <= cursor->key) {
+      avl_node *alternative = avl_node_navigate_right(cursor->best);
+      if (alternative != NULL) {
+        cursor->best = alternative;
+      }
+    }
+    cursor->key = cursor->best->key;
+  } break;
+  case KVDS_SNAP_LOWER: {
+    if (cursor->key <= cursor->best->key) {
+      avl_node *alternative = avl_node_navigate_left(cursor->best);
+      if (alternative != NULL) {
+        cursor->best = alternative;
+      }
+    }
+    cursor->key = cursor->best->key;
+  } break;
+  case KVDS_SNAP_CLOSEST_LOW: {
+    if (cursor->best->key == cursor->key) {
+      // Already at closest
+    } else {
+      avl_node *left;
+      avl_node *right;
+      if (cursor->key < cursor->best->key) {
+        left = avl_node_navigate_left(cursor->best);
+        right = cursor->best;
+      } else {
+        left = cursor->best;
+        right = avl_node_navigate_right(cursor->best);
+      }
+      if (left != NULL && right != NULL) { // Not past the edge
+        if ((unsigned long long)cursor->key - left->key <= (unsigned long long)right->key - cursor->key) {
+          cursor->best = left;
+        } else {
+          cursor->best = right;
+        }
+      } else {
+        // cursor->best already contains closest
+      }
+    }
+    cursor->key = cursor->best->key;
+  } break;
+  }
+}
+
+// Explicit stack for in-order traversals; starts out on the caller's stack and only moves to the heap for unusually tall trees
+typedef struct avl_stack {
+  avl_node **nodes;
+  int depth;
+  int capacity;
+  avl_node *local[64];
+} avl_stack;
+
+static void avl_stack_push(avl_stack *stack, avl_node *node) {
+  if (stack->depth == stack->capacity) {
+    stack->capacity *= 2;
+    if (stack->nodes == stack->local) {
+      stack->nodes = malloc(stack->capacity * sizeof(avl_node *));
+      memcpy(stack->nodes, stack->local, sizeof stack->local);
+    } else {
+      stack->nodes = realloc(stack->nodes, stack->capacity * sizeof(avl_node *));
+    }
+  }
+  stack->nodes[stack->depth++] = node;
+}
+
+static void avl_iterate(kvds_db *_db, kvds_cursor *_cursor, long long to, bool (*callback)(void *context, long long key, const kvds_value *value), void *context) {
+  avl_db *db = _db;
+  avl_cursor *cursor = _cursor;
+
+  // Keep the ancestors we still have to visit on a stack, instead of walking up the parent pointers after each node
+  avl_stack stack;
+  stack.nodes = stack.local;
+  stack.depth = 0;
+  stack.capacity = sizeof stack.local / sizeof stack.local[0];
+
+  for (avl_node *node = db->top; node != NULL;) {
+    if (node->key >= cursor->key) {
+      avl_stack_push(&stack, node);
+      node = node->left;
+    } else {
+      node = node->right;
+    }
+  }
+
+  while (stack.depth > 0) {
+    avl_node *node = stack.nodes[--stack.depth];
+    if (node->key > to || !callback(context, node->key, &node->value)) {
+      break;
+    }
+    for (avl_node *next = node->right; next != NULL; next = next->left) {
+      avl_stack_push(&stack, next);
+    }
+  }
+
+  if (stack.nodes != stack.local) {
+    free(stack.nodes);
+  }
+}
+
+static long long avl_node_count(avl_node *node) {
+  return node == NULL ? 0 : 1 + avl_node_count(node->left) + avl_node_count(node->right);
+}
+
+static void avl_shape(kvds_db *_db, long long *nodes, long long *height) {
+  avl_db *db = _db;
+
+  *nodes = avl_node_count(db->top); // Balanced, so the recursion stays shallow
+  *height = avl_get_height(db->top);
+}
+
+REGISTER("avltree", "avl", "Store entries in an AVL-balanced binary search tree.") = {
+  .create_db = avl_create_db,
+  .destroy_db = avl_destroy_db,
+  .create_cursor = avl_create_cursor,
+  .move_cursor = avl_move_cursor,
+  .destroy_cursor = avl_destroy_cursor,
+
+  .key = avl_key,
+  .exists = avl_exists,
+  .snap = avl_snap,
+
+  .write = avl_write,
+  .read = avl_read,
+  .remove = avl_remove,
+  .iterate = avl_iterate,
+  .shape = avl_shape,
+};
@@ -0,0 +1,657 @@
+// SPDX-License-Identifier: MIT
+#include "../arena.h"
+#include "../registry.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BPT_INNER_KEYS 15 // So that an inner node is exactly 256 bytes, i.e. four cache lines
+#define BPT_INNER_MIN (BPT_INNER_KEYS / 2)
+#define BPT_LEAF_KEYS 32
+#define BPT_LEAF_MIN (BPT_LEAF_KEYS / 2)
+#define BPT_MAX_HEIGHT 32
+
+typedef struct bpt_db {
+  void *root; // bpt_inner, or bpt_leaf if height is 0
+  int height; // Number of inner levels above the leaves
+  kvds_arena inners;
+  kvds_arena leaves;
+  kvds_value_arena values;
+} bpt_db;
+
+typedef struct bpt_inner {
+  int count; // Number of keys; there is one more child than keys
+  long long keys[BPT_INNER_KEYS]; // keys[i] is the lowest key that can be in children[i + 1]
+  void *children[BPT_INNER_KEYS + 1]; // bpt_inner or bpt_leaf, depending on the level
+} bpt_inner;
+
+typedef struct bpt_leaf {
+  long long keys[BPT_LEAF_KEYS]; // Sorted; kept apart from the values so that searching a leaf only touches the keys
+  kvds_value values[BPT_LEAF_KEYS];
+  int count;
+
+  struct bpt_leaf *prev; // Siblings, across the whole tree
+  struct bpt_leaf *next;
+} bpt_leaf;
+
+typedef struct bpt_cursor {
+  long long key;
+  struct bpt_leaf *leaf; // Leaf where the key is, or would be if it were to exist
+  int slot; // Index of the first key in the leaf that isn't lower than the cursor's key; may be leaf->count
+} bpt_cursor;
+
+// Inner nodes passed on the way from the root down to a leaf, and the index of the child taken in each
+typedef struct bpt_path {
+  bpt_inner *nodes[BPT_MAX_HEIGHT];
+  int indices[BPT_MAX_HEIGHT];
+} bpt_path;
+
+#ifndef NDEBUG
+static void _bpt_assert_invariants(bpt_db *db, void *node, int level, long long low, bool has_low, long long high, bool has_high, bpt_leaf **prev_leaf) {
+  if (level == db->height) {
+    bpt_leaf *leaf = node;
+    assert(leaf->count >= (node == db->root ? 0 : BPT_LEAF_MIN) && leaf->count <= BPT_LEAF_KEYS);
+    for (int i = 0; i < leaf->count; i++) {
+      assert(i == 0 || leaf->keys[i - 1] < leaf->keys[i]);
+      assert(!has_low || leaf->keys[i] >= low);
+      assert(!has_high || leaf->keys[i] < high);
+    }
+    assert(leaf->prev == *prev_leaf);
+    if (*prev_leaf != NULL) {
+      assert((*prev_leaf)->next == leaf);
+    }
+    *prev_leaf = leaf;
+    return;
+  }
+  bpt_inner *inner = node;
+  assert(inner->count >= (node == db->root ? 1 : BPT_INNER_MIN) && inner->count <= BPT_INNER_KEYS);
+  for (int i = 0; i <= inner->count; i++) {
+    if (i < inner->count) {
+      assert(i == 0 || inner->keys[i - 1] < inner->keys[i]);
+      assert(!has_low || inner->keys[i] > low);
+      assert(!has_high || inner->keys[i] < high);
+    }
+    _bpt_assert_invariants(db, inner->children[i], level + 1, i == 0 ? low : inner->keys[i - 1], i == 0 ? has_low : true, i == inner->count ? high : inner->keys[i], i == inner->count ? has_high : true, prev_leaf);
+  }
+}
+static void bpt_assert_invariants(bpt_db *db) {
+  bpt_leaf *prev_leaf = NULL;
+  _bpt_assert_invariants(db, db->root, 0, 0, false, 0, false, &prev_leaf);
+  assert(prev_leaf->next == NULL);
+}
+#else
+static void bpt_assert_invariants(bpt_db *db) {
+  // pass
+}
+#endif
+
+static bpt_leaf *bpt_leaf_create(bpt_db *db) {
+  bpt_leaf *leaf = kvds_arena_alloc(&db->leaves);
+  leaf->count = 0;
+  leaf->prev = NULL;
+  leaf->next = NULL;
+  return leaf;
+}
+
+static kvds_db *bpt_create_db(const kvds_options *options) {
+  bpt_db *db = malloc(sizeof(bpt_db));
+  kvds_arena_init(&db->inners, sizeof(bpt_inner), options->allocator);
+  kvds_arena_init(&db->leaves, sizeof(bpt_leaf), options->allocator);
+  kvds_value_arena_init(&db->values, options->allocator);
+  db->root = bpt_leaf_create(db);
+  db->height = 0;
+
+  bpt_assert_invariants(db);
+
+  return db;
+}
+
+static void bpt_destroy_db(kvds_db *_db) {
+  bpt_db *db = _db;
+  kvds_value_arena_release(&db->values);
+  kvds_arena_release(&db->leaves);
+  kvds_arena_release(&db->inners);
+  free(db);
+}
+
+static inline int bpt_inner_search(bpt_inner *inner, long long key) {
+  // Index of the child the key belongs in; the keys fit in a couple cache lines, so a linear scan is as good as anything
+  int i = 0;
+  while (i < inner->count && key >= inner->keys[i]) {
+    i++;
+  }
+  return i;
+}
+
+static inline int bpt_leaf_search(bpt_leaf *leaf, long long key) {
+  // Index of the first key that isn't lower than key
+  int low = 0;
+  int high = leaf->count;
+  while (low < high) {
+    int middle = (low + high) / 2;
+    if (leaf->keys[middle] < key) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+// Finds the leaf the key belongs in; fills path if it's not NULL
+static bpt_leaf *bpt_leaf_locate(bpt_db *db, long long key, bpt_path *path) {
+  void *node = db->root;
+  for (int level = 0; level < db->height; level++) {
+    bpt_inner *inner = node;
+    int index = bpt_inner_search(inner, key);
+    if (path != NULL) {
+      path->nodes[level] = inner;
+      path->indices[level] = index;
+    }
+    node = inner->children[index];
+  }
+  return node;
+}
+
+static void bpt_cursor_locate(bpt_db *db, bpt_cursor *cursor) {
+  cursor->leaf = bpt_leaf_locate(db, cursor->key, NULL);
+  cursor->slot = bpt_leaf_search(cursor->leaf, cursor->key);
+}
+
+static kvds_cursor *bpt_create_cursor(kvds_db *_db, long long key) {
+  bpt_db *db = _db;
+  bpt_cursor *cursor = malloc(sizeof(bpt_cursor));
+
+  cursor->key = key;
+  bpt_cursor_locate(db, cursor);
+
+  return cursor;
+}
+
+static void bpt_move_cursor(kvds_db *_db, kvds_cursor *_cursor, long long key) {
+  bpt_db *db = _db;
+  bpt_cursor *cursor = _cursor;
+
+  cursor->key = key;
+  bpt_cursor_locate(db, cursor);
+}
+
+static void bpt_destroy_cursor(kvds_db *_db, kvds_cursor *_cursor) {
+  bpt_db *db = _db;
+  bpt_cursor *cursor = _cursor;
+
+  free(cursor);
+}
+
+static long long bpt_key(kvds_db *_db, kvds_cursor *_cursor) {
+  bpt_db *db = _db;
+  bpt_cursor *cursor = _cursor;
+
+  return cursor->key;
+}
+
+static bool bpt_exists(kvds_db *_db, kvds_cursor *_cursor) {
+  bpt_db *db = _db;
+  bpt_cursor *cursor = _cursor;
+
+  return cursor->slot < cursor->leaf->count && cursor->leaf->keys[cursor->slot] == cursor->key;
+}
+
+// Inserts key and the child right of it into the inner node at path->nodes[level], right after the child that was taken, splitting nodes upwards as needed
+static void bpt_inner_insert(bpt_db *db, bpt_path *path, int level, long long key, void *child) {
+  while (level >= 0) {
+    bpt_inner *inner = path->nodes[level];
+    int index = path->indices[level];
+
+    if (inner->count < BPT_INNER_KEYS) {
+      memmove(&inner->keys[index + 1], &inner->keys[index], (inner->count - index) * sizeof(long long));
+      memmove(&inner->children[index + 2], &inner->children[index + 1], (inner->count - index) * sizeof(void *));
+      inner->keys[index] = key;
+      inner->children[index + 1] = child;
+      inner->count++;
+      return;
+    }
+
+    // Full: lay out all the keys and children as they would be, then split them around the middle key, which moves up
+    long long keys[BPT_INNER_KEYS + 1];
+    void *children[BPT_INNER_KEYS + 2];
+    memcpy(keys, inner->keys, index * sizeof(long long));
+    keys[index] = key;
+    memcpy(&keys[index + 1], &inner->keys[index], (BPT_INNER_KEYS - index) * sizeof(long long));
+    memcpy(children, inner->children, (index + 1) * sizeof(void *));
+    children[index + 1] = child;
+    memcpy(&children[index + 2], &inner->children[index + 1], (BPT_INNER_KEYS - index) * sizeof(void *));
+
+    int left_count = (BPT_INNER_KEYS + 1) / 2;
+    bpt_inner *right = kvds_arena_alloc(&db->inners);
+    inner->count = left_count;
+    memcpy(inner->keys, keys, left_count * sizeof(long long));
+    memcpy(inner->children, children, (left_count + 1) * sizeof(void *));
+    right->count = BPT_INNER_KEYS - left_count;
+    memcpy(right->keys, &keys[left_count + 1], right->count * sizeof(long long));
+    memcpy(right->children, &children[left_count + 1], (right->count + 1) * sizeof(void *));
+
+    key = keys[left_count];
+    child = right;
+    level--;
+  }
+
+  // Split all the way up; grow a new root
+  bpt_inner *root = kvds_arena_alloc(&db->inners);
+  root->count = 1;
+  root->keys[0] = key;
+  root->children[0] = db->root;
+  root->children[1] = child;
+  db->root = root;
+  db->height++;
+}
+
+static void bpt_write(kvds_db *_db, kvds_cursor *_cursor, const kvds_value *value) {
+  bpt_db *db = _db;
+  bpt_cursor *cursor = _cursor;
+
+  bpt_leaf *leaf = cursor->leaf;
+  int slot = cursor->slot;
+
+  if (slot < leaf->count && leaf->keys[slot] == cursor->key) { // Special case: already exists
+    kvds_value_replace(&db->values, &leaf->values[slot], value);
+    return;
+  }
+
+  if (leaf->count == BPT_LEAF_KEYS) { // Split the leaf in two
+    bpt_path path;
+    bpt_leaf *located = bpt_leaf_locate(db, cursor->key, &path);
+    assert(located == leaf);
+
+    bpt_leaf *right = bpt_leaf_create(db);
+    right->count = BPT_LEAF_KEYS - BPT_LEAF_MIN;
+    memcpy(right->keys, &leaf->keys[BPT_LEAF_MIN], right->count * sizeof(long long));
+    memcpy(right->values, &leaf->values[BPT_LEAF_MIN], right->count * sizeof(kvds_value));
+    leaf->count = BPT_LEAF_MIN;
+
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next != NULL) {
+      leaf->next->prev = right;
+    }
+    leaf->next = right;
+
+    bpt_inner_insert(db, &path, db->height - 1, right->keys[0], right);
+
+    if (slot > leaf->count) {
+      slot -= leaf->count;
+      leaf = right;
+    }
+  }
+
+  memmove(&leaf->keys[slot + 1], &leaf->keys[slot], (leaf->count - slot) * sizeof(long long));
+  memmove(&leaf->values[slot + 1], &leaf->values[slot], (leaf->count - slot) * sizeof(kvds_value));
+  leaf->keys[slot] = cursor->key;
+  kvds_value_store(&db->values, &leaf->values[slot], value);
+  leaf->count++;
+
+  cursor->leaf = leaf;
+  cursor->slot = slot;
+
+  bpt_assert_invariants(db);
+}
+
+static const kvds_value *bpt_read(kvds_db *_db, kvds_cursor *_cursor) {
+  bpt_db *db = _db;
+  bpt_cursor *cursor = _cursor;
+
+  if (cursor->slot < cursor->leaf->count && cursor->leaf->keys[cursor->slot] == cursor->key) { // The key exists
+    return &cursor->leaf->values[cursor->slot];
+  } else {
+    return NULL;
+  }
+}
+
+// Removes keys[index] and children[index + 1]
+static void bpt_inner_remove(bpt_inner *inner, int index) {
+  memmove(&inner->keys[index], &inner->keys[index + 1], (inner->count - index - 1) * sizeof(long long));
+  memmove(&inner->children[index + 1], &inner->children[index + 2], (inner->count - index - 1) * sizeof(void *));
+  inner->count--;
+}
+
+// Fixes underfull inner nodes from path->nodes[level] upwards, by borrowing from or merging with a sibling
+static void bpt_inner_rebalance(bpt_db *db, bpt_path *path, int level) {
+  for (; level > 0; level--) {
+    bpt_inner *inner = path->nodes[level];
+    if (inner->count >= BPT_INNER_MIN) {
+      return;
+    }
+    bpt_inner *parent = path->nodes[level - 1];
+    int index = path->indices[level - 1];
+    bpt_inner *left = index > 0 ? parent->children[index - 1] : NULL;
+    bpt_inner *right = index < parent->count ? parent->children[index + 1] : NULL;
+
+    if (left != NULL && left->count > BPT_INNER_MIN) { // Rotate the left sibling's last child over
+      memmove(&inner->keys[1], &inner->keys[0], inner->count * sizeof(long long));
+      memmove(&inner->children[1], &inner->children[0], (inner->count + 1) * sizeof(void *));
+      inner->keys[0] = parent->keys[index - 1];
+      inner->children[0] = left->children[left->count];
+      inner->count++;
+      parent->keys[index - 1] = left->keys[left->count - 1];
+      left->count--;
+      return;
+    }
+    if (right != NULL && right->count > BPT_INNER_MIN) { // Rotate the right sibling's first child over
+      inner->keys[inner->count] = parent->keys[index];
+      inner->children[inner->count + 1] = right->children[0];
+      inner->count++;
+      parent->keys[index] = right->keys[0];
+      memmove(&right->keys[0], &right->keys[1], (right->count - 1) * sizeof(long long));
+      memmove(&right->children[0], &right->children[1], right->count * sizeof(void *));
+      right->count--;
+      return;
+    }
+
+    // Merge with a sibling, pulling the key between them down
+    if (left == NULL) {
+      left = inner;
+      inner = right;
+      index++;
+    }
+    left->keys[left->count] = parent->keys[index - 1];
+    memcpy(&left->keys[left->count + 1], inner->keys, inner->count * sizeof(long long));
+    memcpy(&left->children[left->count + 1], inner->children, (inner->count + 1) * sizeof(void *));
+    left->count += 1 + inner->count;
+    kvds_arena_free(&db->inners, inner);
+    bpt_inner_remove(parent, index - 1);
+  }
+
+  bpt_inner *root = db->root;
+  if (root->count == 0) { // Only one child left; it becomes the root
+    db->root = root->children[0];
+    db->height--;
+    kvds_arena_free(&db->inners, root);
+  }
+}
+
+// Fixes an underfull leaf, by borrowing from or merging with a sibling
+static void bpt_leaf_rebalance(bpt_db *db, bpt_leaf *leaf, bpt_path *path) {
+  bpt_inner *parent = path->nodes[db->height - 1];
+  int index = path->indices[db->height - 1];
+  bpt_leaf *left = index > 0 ? parent->children[index - 1] : NULL;
+  bpt_leaf *right = index < parent->count ? parent->children[index + 1] : NULL;
+
+  if (left != NULL && left->count > BPT_LEAF_MIN) { // Take the left sibling's last entry
+    memmove(&leaf->keys[1], &leaf->keys[0], leaf->count * sizeof(long long));
+    memmove(&leaf->values[1], &leaf->values[0], leaf->count * sizeof(kvds_value));
+    leaf->keys[0] = left->keys[left->count - 1];
+    leaf->values[0] = left->values[left->count - 1];
+    leaf->count++;
+    left->count--;
+    parent->keys[index - 1] = leaf->keys[0];
+    return;
+  }
+  if (right != NULL && right->count > BPT_LEAF_MIN) { // Take the right sibling's first entry
+    leaf->keys[leaf->count] = right->keys[0];
+    leaf->values[leaf->count] = right->values[0];
+    leaf->count++;
+    right->count--;
+    memmove(&right->keys[0], &right->keys[1], right->count * sizeof(long long));
+    memmove(&right->values[0], &right->values[1], right->count * sizeof(kvds_value));
+    parent->keys[index] = right->keys[0];
+    return;
+  }
+
+  // Merge with a sibling
+  if (left == NULL) {
+    left = leaf;
+    leaf = right;
+    index++;
+  }
+  memcpy(&left->keys[left->count], leaf->keys, leaf->count * sizeof(long long));
+  memcpy(&left->values[left->count], leaf->values, leaf->count * sizeof(kvds_value));
+  left->count += leaf->count;
+  left->next = leaf->next;
+  if (leaf->next != NULL) {
+    leaf->next->prev = left;
+  }
+  kvds_arena_free(&db->leaves, leaf);
+  bpt_inner_remove(parent, index - 1);
+
+  bpt_inner_rebalance(db, path, db->height - 1);
+}
+
+static bool bpt_remove(kvds_db *_db, kvds_cursor *_cursor) {
+  bpt_db *db = _db;
+  bpt_cursor *cursor = _cursor;
+
+  bpt_leaf *leaf = cursor->leaf;
+  int slot = cursor->slot;
+
+  if (slot >= leaf->count || leaf->keys[slot] != cursor->key) {
+    return false;
+  }
+
+  kvds_value_clear(&db->values, &leaf->values[slot]);
+
+  leaf->count--;
+  memmove(&leaf->keys[slot], &leaf->keys[slot + 1], (leaf->count - slot) * sizeof(long long));
+  memmove(&leaf->values[slot], &leaf->values[slot + 1], (leaf->count - slot) * sizeof(kvds_value));
+
+  if (leaf->count < BPT_LEAF_MIN && db->height > 0) {
+    bpt_path path;
+    bpt_leaf *located = bpt_leaf_locate(db, cursor->key, &path);
+    assert(located == leaf);
+    bpt_leaf_rebalance(db, leaf, &path);
+    bpt_cursor_locate(db, cursor); // The leaf may be gone
+  }
+  // Otherwise, the slot now holds the next key, which is still where the cursor's key would be
+
+  bpt_assert_invariants(db);
+
+  return true;
+}
+
+// Steps to the entry after/before the given one, across leaves; returns false if there is none
+static inline bool bpt_step_next(bpt_leaf **leaf, int *slot) {
+  if (*slot + 1 < (*leaf)->count) {
+    (*slot)++;
+    return true;
+  }
+  if ((*leaf)->next == NULL) {
+    return false;
+  }
+  *leaf = (*leaf)->next;
+  *slot = 0;
+  return true;
+}
+
+static inline bool bpt_step_prev(bpt_leaf **leaf, int *slot) {
+  if (*slot > 0) {
+    (*slot)--;
+    return true;
+  }
+  if ((*leaf)->prev == NULL) {
+    return false;
+  }
+  *leaf = (*leaf)->prev;
+  *slot = (*leaf)->count - 1;
+  return true;
+}
+
+static void bpt_snap(kvds_db *_db, kvds_cursor *_cursor, enum kvds_snap_direction dir) {
+  bpt_db *db = _db;
+  bpt_cursor *cursor = _cursor;
+
+  bpt_leaf *leaf = cursor->leaf;
+  int slot = cursor->slot;
+
+  if (leaf->count == 0) {
+    return; // Only the root can be empty; nothing in the database, nothing to find
+  }
+
+  bool exists = slot < leaf->count && leaf->keys[slot] == cursor->key;
+
+  // The entries right below and right above the cursor's key, if any
+  bpt_leaf *lower_leaf = leaf;
+  int lower_slot = slot;
+  bool has_lower = bpt_step_prev(&lower_leaf, &lower_slot);
+  bpt_leaf *higher_leaf = leaf;
+  int higher_slot = slot;
+  bool has_higher = true;
+  if (exists) { // Step over the key itself
+    has_higher = bpt_step_next(&higher_leaf, &higher_slot);
+  } else if (slot == leaf->count) { // Step to the next leaf
+    higher_slot = slot - 1;
+    has_higher = bpt_step_next(&higher_leaf, &higher_slot);
+  }
+
+  switch (dir) {
+  case KVDS_SNAP_CLOSEST_LOW: {
+    if (exists) {
+      // Already at closest
+    } else if (has_lower && has_higher) {
+      if ((unsigned long long)cursor->key - lower_leaf->keys[lower_slot] <= (unsigned long long)higher_leaf->keys[higher_slot] - cursor->key) {
+        leaf = lower_leaf;
+        slot = lower_slot;
+      } else {
+        leaf = higher_leaf;
+        slot = higher_slot;
+      }
+    } else if (has_lower) {
+      leaf = lower_leaf;
+      slot = lower_slot;
+    } else {
+      leaf = higher_leaf;
+      slot = higher_slot;
+    }
+  } break;
+  case KVDS_SNAP_HIGHER: {
+    if (has_higher) {
+      leaf = higher_leaf;
+      slot = higher_slot;
+    } else if (!exists) {
+      leaf = lower_leaf; // Past the highest key; stay on it
+      slot = lower_slot;
+    }
+  } break;
+  case KVDS_SNAP_LOWER: {
+    if (has_lower) {
+      leaf = lower_leaf;
+      slot = lower_slot;
+    } else if (!exists) {
+      leaf = higher_leaf; // Past the lowest key; stay on it
+      slot = higher_slot;
+    }
+  } break;
+  }
+
+  cursor->leaf = leaf;
+  cursor->slot = slot;
+  cursor->key = leaf->keys[slot];
+}
+
+static void bpt_iterate(kvds_db *_db, kvds_cursor *_cursor, long long to, bool (*callback)(void *context, long long key, const kvds_value *value), void *context) {
+  bpt_db *db = _db;
+  bpt_cursor *cursor = _cursor;
+
+  int slot = cursor->slot;
+  for (bpt_leaf *leaf = cursor->leaf; leaf != NULL; leaf = leaf->next) {
+    for (; slot < leaf->count; slot++) {
+      if (leaf->keys[slot] > to || !callback(context, leaf->keys[slot], &leaf->values[slot])) {
+        return;
+      }
+    }
+    slot = 0;
+  }
+}
+
+static void bpt_bulk_load(kvds_db *_db, bool (*next)(void *context, long long *key, kvds_value *value), void *context) {
+  bpt_db *db = _db;
+  assert(db->height == 0 && ((bpt_leaf *)db->root)->count == 0);
+
+  // Fill leaves completely, one after the other
+  unsigned long count = 1;
+  unsigned long capacity = 64;
+  void **children = malloc(capacity * sizeof(void *));
+  children[0] = db->root;
+  bpt_leaf *leaf = db->root;
+
+  long long key;
+  kvds_value value;
+  while (next(context, &key, &value)) {
+    if (leaf->count == BPT_LEAF_KEYS) {
+      bpt_leaf *new_leaf = bpt_leaf_create(db);
+      new_leaf->prev = leaf;
+      leaf->next = new_leaf;
+      leaf = new_leaf;
+      if (count == capacity) {
+        capacity *= 2;
+        children = realloc(children, capacity * sizeof(void *));
+      }
+      children[count++] = leaf;
+    }
+    assert(leaf->count == 0 || leaf->keys[leaf->count - 1] < key);
+    leaf->keys[leaf->count] = key;
+    kvds_value_store(&db->values, &leaf->values[leaf->count], &value);
+    leaf->count++;
+  }
+  if (count > 1 && leaf->count < BPT_LEAF_MIN) { // Even out the last two leaves
+    bpt_leaf *prev = leaf->prev;
+    int move = (prev->count - leaf->count) / 2;
+    memmove(&leaf->keys[move], leaf->keys, leaf->count * sizeof(long long));
+    memmove(&leaf->values[move], leaf->values, leaf->count * sizeof(kvds_value));
+    memcpy(leaf->keys, &prev->keys[prev->count - move], move * sizeof(long long));
+    memcpy(leaf->values, &prev->values[prev->count - move], move * sizeof(kvds_value));
+    leaf->count += move;
+    prev->count -= move;
+  }
+
+  // Build the inner levels bottom-up, spreading the children evenly so that no node ends up underfull
+  long long *lows = malloc(count * sizeof(long long)); // Lowest key under each child
+  for (unsigned long i = 0; i < count; i++) {
+    lows[i] = ((bpt_leaf *)children[i])->keys[0];
+  }
+  while (count > 1) {
+    unsigned long parents = (count + BPT_INNER_KEYS) / (BPT_INNER_KEYS + 1);
+    unsigned long child = 0;
+    for (unsigned long i = 0; i < parents; i++) {
+      unsigned long take = count / parents + (i < count % parents ? 1 : 0);
+      bpt_inner *inner = kvds_arena_alloc(&db->inners);
+      inner->count = take - 1;
+      for (unsigned long j = 0; j < take; j++) {
+        inner->children[j] = children[child + j];
+        if (j > 0) {
+          inner->keys[j - 1] = lows[child + j];
+        }
+      }
+      lows[i] = lows[child];
+      children[i] = inner;
+      child += take;
+    }
+    count = parents;
+    db->height++;
+  }
+  db->root = children[0];
+
+  free(lows);
+  free(children);
+
+  bpt_assert_invariants(db);
+}
+
+REGISTER("bplustree", "bpt", "Store entries in a B+tree with cache-line-sized inner nodes and packed leaves") = {
+  .create_db = bpt_create_db,
+  .destroy_db = bpt_destroy_db,
+  .create_cursor = bpt_create_cursor,
+  .move_cursor = bpt_move_cursor,
+  .destroy_cursor = bpt_destroy_cursor,
+
+  .key = bpt_key,
+  .exists = bpt_exists,
+  .snap = bpt_snap,
+
+  .write = bpt_write,
+  .read = bpt_read,
+  .remove = bpt_remove,
+  .iterate = bpt_iterate,
+  .bulk_load = bpt_bulk_load,
+};
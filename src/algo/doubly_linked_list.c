@@ -1,20 +1,34 @@
 // SPDX-License-Identifier: MIT
+#include "../arena.h"
+#include "../ebr.h"
+#include "../hash_index.h"
 #include "../registry.h"
+#include "../stats.h"
 #include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifndef LST_HASH_INDEX
+#define LST_HASH_INDEX true // Whether to keep a hash index of the nodes, so that moving to an existing key doesn't walk the list
+#endif
+
 typedef struct lst_db {
   struct lst_node *head; // lowest
   struct lst_node *tail; // highest
   // int size;
+  kvds_arena nodes;
+  kvds_value_arena values;
+  kvds_ebr_limbo limbo; // Nodes unlinked by the writer that readers may still be looking at
+  kvds_hash_index index; // Maps keys to their nodes, if LST_HASH_INDEX is set
+  bool shared; // Whether readers may walk the list alongside the writer
 } lst_db;
 
+// In a shared list, a node's key and value are fixed once it is published; changing a value replaces the whole node
 typedef struct lst_node {
   long long key;
-  char *data;
+  kvds_value value;
 
   struct lst_node *prev; // lower
   struct lst_node *next; // higher
@@ -22,6 +36,7 @@ typedef struct lst_node {
 
 typedef struct lst_cursor {
   long long key;
+  unsigned long long generation; // The limbo's generation when best was found; if it has moved on, best may be gone
   struct lst_node *best; // Either exact key or either node that would be next to the key
 } lst_cursor;
 
@@ -29,14 +44,18 @@ typedef struct lst_cursor {
 static void lst_assert_invariants(lst_db *db) {
   lst_node *prev_node = NULL;
   lst_node *node = db->head;
+  size_t count = 0;
   while (node != NULL) {
     assert(node->prev == prev_node);
     if (prev_node != NULL) {
       assert(node->key > prev_node->key);
     }
+    assert(!LST_HASH_INDEX || kvds_hash_index_get(&db->index, node->key) == node);
     prev_node = node;
     node = node->next;
+    count++;
   }
+  assert(!LST_HASH_INDEX || db->index.count == count);
   assert(db->tail == prev_node);
   if (prev_node != NULL) {
     assert(prev_node->next == NULL);
@@ -48,50 +67,87 @@ static void lst_assert_invariants(lst_db *db) {
 }
 #endif
 
-static kvds_db *lst_create_db() {
+static kvds_db *lst_create_db(const kvds_options *options) {
   lst_db *db = malloc(sizeof(lst_db));
   db->head = NULL;
   db->tail = NULL;
+  kvds_arena_init(&db->nodes, sizeof(lst_node), options->allocator);
+  kvds_arena_reserve(&db->nodes, options->capacity);
+  kvds_value_arena_init(&db->values, options->allocator);
+  kvds_ebr_limbo_init(&db->limbo, db);
+  kvds_hash_index_init(&db->index, &db->limbo);
+  db->shared = options->concurrent_readers;
+  if (LST_HASH_INDEX) {
+    kvds_hash_index_reserve(&db->index, options->capacity);
+  }
 
   lst_assert_invariants(db);
 
   return db;
 }
 
-static void lst_destroy_db(kvds_db *_db, void (*free_data)(char *data)) {
+static void lst_destroy_db(kvds_db *_db) {
   lst_db *db = _db;
-  lst_node *node = db->head;
-  while (node != NULL) {
-    lst_node *next = node->next;
-    free_data(node->data);
-    free(node);
-    node = next;
-  }
+  kvds_ebr_limbo_release(&db->limbo);
+  kvds_hash_index_release(&db->index);
+  kvds_value_arena_release(&db->values);
+  kvds_arena_release(&db->nodes);
   free(db);
 }
 
+static void lst_reclaim_node(void *_db, void *_node) {
+  lst_db *db = _db;
+  lst_node *node = _node;
+  kvds_value_clear(&db->values, &node->value);
+  kvds_arena_free(&db->nodes, node);
+}
+
 static lst_node *lst_node_locate(lst_db *db, lst_node *node, long long key) {
   if (node == NULL) {
-    if (db->head == NULL) {
-      return NULL; // Empty list; not much we can do
+    lst_node *head = KVDS_LOAD(db->head);
+    lst_node *tail = KVDS_LOAD(db->tail);
+    if (head == NULL || tail == NULL) {
+      return head != NULL ? head : tail; // Empty list (or a reader catching the first insert halfway); not much we can do
     }
     // We start from the "closest" end of the list, hoping that the keys are uniformly distributed
     // Since this is a linked list, we can't do much better than hope anyway.
-    node = (db->tail->key - key < key - db->head->key) ? db->tail : db->head;
+    if (key <= head->key) {
+      node = head;
+    } else if (key >= tail->key) {
+      node = tail;
+    } else { // Both distances are positive, but may not fit in a long long
+      node = ((unsigned long long)tail->key - key < (unsigned long long)key - head->key) ? tail : head;
+    }
   }
+  int visits = 1;
   if (node->key > key) { // We need to follow the prev pointer
-    do {
-      node = node->prev;
-    } while (node != NULL && node->key > key);
-    return node != NULL ? node : db->head;
+    lst_node *prev;
+    while ((prev = KVDS_LOAD(node->prev)) != NULL) {
+      node = prev;
+      visits++;
+      if (node->key <= key) break;
+    }
+    // Or else, we're at the lowest node
   } else if (node->key < key) { // We need to follow the next pointer
-    do {
-      node = node->next;
-    } while (node != NULL && node->key < key);
-    return node != NULL ? node : db->tail;
-  } else {
-    return node;
+    lst_node *next;
+    while ((next = KVDS_LOAD(node->next)) != NULL) {
+      node = next;
+      visits++;
+      if (node->key >= key) break;
+    }
+    // Or else, we're at the highest node
   }
+  kvds_stats_count(KVDS_STAT_NODE_VISITS, visits);
+  return node;
+}
+
+// The node holding the key, or NULL if the index doesn't have it (or a reader raced with the writer); misses still need to walk the list to find where the key would be
+static lst_node *lst_node_lookup(lst_db *db, long long key) {
+  if (!LST_HASH_INDEX) {
+    return NULL;
+  }
+  lst_node *node = kvds_hash_index_get(&db->index, key);
+  return node != NULL && node->key == key ? node : NULL;
 }
 
 static kvds_cursor *lst_create_cursor(kvds_db *_db, long long key) {
@@ -99,7 +155,11 @@ static kvds_cursor *lst_create_cursor(kvds_db *_db, long long key) {
   lst_cursor *cursor = malloc(sizeof(lst_cursor));
 
   cursor->key = key;
-  cursor->best = lst_node_locate(db, NULL, key);
+  cursor->generation = kvds_ebr_generation(&db->limbo);
+  cursor->best = lst_node_lookup(db, key);
+  if (cursor->best == NULL) {
+    cursor->best = lst_node_locate(db, NULL, key);
+  }
 
   return cursor;
 }
@@ -108,8 +168,14 @@ static void lst_move_cursor(kvds_db *_db, kvds_cursor *_cursor, long long key) {
   lst_db *db = _db;
   lst_cursor *cursor = _cursor;
 
+  unsigned long long generation = kvds_ebr_generation(&db->limbo);
   cursor->key = key;
-  cursor->best = lst_node_locate(db, cursor->best, key); // Assume that we are moving to a close-by node
+  cursor->best = lst_node_lookup(db, key);
+  if (cursor->best == NULL) {
+    // Assume that we are moving to a close-by node, unless it may have been retired since we got to it
+    cursor->best = lst_node_locate(db, cursor->generation == generation ? cursor->best : NULL, key);
+  }
+  cursor->generation = generation;
 }
 
 static void lst_destroy_cursor(kvds_db *_db, kvds_cursor *_cursor) {
@@ -133,28 +199,28 @@ static bool lst_exists(kvds_db *_db, kvds_cursor *_cursor) {
   return cursor->best != NULL && cursor->best->key == cursor->key;
 }
 
-static char *lst_write(kvds_db *_db, kvds_cursor *_cursor, char *data) {
+static void lst_write(kvds_db *_db, kvds_cursor *_cursor, const kvds_value *value) {
   lst_db *db = _db;
   lst_cursor *cursor = _cursor;
 
-  if (cursor->best != NULL && cursor->best->key == cursor->key) { // Special case: already exists
-    char *old_data = cursor->best->data;
-    cursor->best->data = data;
-    return old_data;
+  if (cursor->best != NULL && cursor->best->key == cursor->key && !db->shared) { // Already exists, and nobody else is looking
+    kvds_value_replace(&db->values, &cursor->best->value, value);
+    return;
   }
 
-  lst_node *new_node = malloc(sizeof(lst_node));
+  lst_node *old_node = NULL;
+  lst_node *new_node = kvds_arena_alloc(&db->nodes);
 
-  new_node->data = data;
+  kvds_value_store(&db->values, &new_node->value, value);
   new_node->key = cursor->key;
   new_node->prev = NULL;
   new_node->next = NULL;
 
-  if (cursor->best == NULL) { // First node in the list
-    db->head = new_node;
-    db->tail = new_node;
-  } else { // Insert ourselves on the correct side of the cursor
-
+  if (cursor->best != NULL && cursor->best->key == cursor->key) { // Already exists: replace the whole node, so that readers never see a value that's half-written
+    old_node = cursor->best;
+    new_node->prev = old_node->prev;
+    new_node->next = old_node->next;
+  } else if (cursor->best != NULL) { // Insert ourselves on the correct side of the cursor
     if (cursor->best->key < cursor->key) {
       new_node->prev = cursor->best;
       new_node->next = cursor->best->next;
@@ -162,68 +228,83 @@ static char *lst_write(kvds_db *_db, kvds_cursor *_cursor, char *data) {
       new_node->prev = cursor->best->prev;
       new_node->next = cursor->best;
     }
+  }
 
-    if (new_node->next != NULL) {
-      new_node->next->prev = new_node;
-    } else {
-      db->tail = new_node;
-    }
+  // The new node is complete by now; readers may find it from either side from here on
+  if (new_node->next != NULL) {
+    KVDS_PUBLISH(new_node->next->prev, new_node);
+  } else {
+    KVDS_PUBLISH(db->tail, new_node);
+  }
+  if (new_node->prev != NULL) {
+    KVDS_PUBLISH(new_node->prev->next, new_node);
+  } else {
+    KVDS_PUBLISH(db->head, new_node);
+  }
 
-    if (new_node->prev != NULL) {
-      new_node->prev->next = new_node;
+  cursor->best = new_node;
+
+  if (LST_HASH_INDEX) {
+    if (old_node != NULL) {
+      kvds_hash_index_set(&db->index, new_node->key, new_node);
     } else {
-      db->head = new_node;
+      kvds_hash_index_put(&db->index, new_node->key, new_node);
     }
   }
 
-  cursor->best = new_node;
+  if (old_node != NULL) {
+    kvds_ebr_retire(&db->limbo, old_node, lst_reclaim_node);
+    cursor->generation = kvds_ebr_generation(&db->limbo);
+    kvds_ebr_collect(&db->limbo);
+  }
 
   lst_assert_invariants(db);
-  return NULL;
 }
 
-static char *lst_read(kvds_db *_db, kvds_cursor *_cursor) {
+static const kvds_value *lst_read(kvds_db *_db, kvds_cursor *_cursor) {
   lst_db *db = _db;
   lst_cursor *cursor = _cursor;
 
   if (cursor->best != NULL && cursor->best->key == cursor->key) { // The node exists
-    return cursor->best->data;
+    return &cursor->best->value;
   } else {
     return NULL;
   }
 }
 
-static char *lst_remove(kvds_db *_db, kvds_cursor *_cursor) {
+static bool lst_remove(kvds_db *_db, kvds_cursor *_cursor) {
   lst_db *db = _db;
   lst_cursor *cursor = _cursor;
 
   if (cursor->best == NULL || cursor->best->key != cursor->key) {
-    return NULL;
+    return false;
   }
 
-  char *data = cursor->best->data;
-
   lst_node *old_node = cursor->best;
 
+  // The removed node keeps its own links, so that readers still on it can walk off it
   if (old_node->next != NULL) {
-    old_node->next->prev = old_node->prev;
+    KVDS_PUBLISH(old_node->next->prev, old_node->prev);
   } else {
-    db->tail = old_node->prev;
+    KVDS_PUBLISH(db->tail, old_node->prev);
   }
 
   if (old_node->prev != NULL) {
-    old_node->prev->next = old_node->next;
+    KVDS_PUBLISH(old_node->prev->next, old_node->next);
   } else {
-    db->head = old_node->next;
+    KVDS_PUBLISH(db->head, old_node->next);
   }
 
   cursor->best = old_node->next != NULL ? old_node->next : old_node->prev; // Either one is fine, just pick the non-NULL one
 
-  free(old_node);
+  if (LST_HASH_INDEX) kvds_hash_index_remove(&db->index, old_node->key);
+  kvds_ebr_retire(&db->limbo, old_node, lst_reclaim_node);
+  cursor->generation = kvds_ebr_generation(&db->limbo);
+  kvds_ebr_collect(&db->limbo);
 
   lst_assert_invariants(db);
 
-  return data;
+  return true;
 }
 
 static void lst_snap(kvds_db *_db, kvds_cursor *_cursor, enum kvds_snap_direction dir) {
@@ -242,14 +323,14 @@ static void lst_snap(kvds_db *_db, kvds_cursor *_cursor, enum kvds_snap_directio
       lst_node *left;
       lst_node *right;
       if (cursor->key < cursor->best->key) {
-        left = cursor->best->prev;
+        left = KVDS_LOAD(cursor->best->prev);
         right = cursor->best;
       } else {
         left = cursor->best;
-        right = cursor->best->next;
+        right = KVDS_LOAD(cursor->best->next);
       }
       if (left != NULL && right != NULL) { // Not past the edge
-        if (cursor->key - left->key <= right->key - cursor->key) {
+        if ((unsigned long long)cursor->key - left->key <= (unsigned long long)right->key - cursor->key) {
           cursor->best = left;
         } else {
           cursor->best = right;
@@ -262,16 +343,18 @@ static void lst_snap(kvds_db *_db, kvds_cursor *_cursor, enum kvds_snap_directio
   } break;
   case KVDS_SNAP_HIGHER: {
     if (cursor->key >= cursor->best->key) {
-      if (cursor->best->next != NULL) {
-        cursor->best = cursor->best->next;
+      lst_node *next = KVDS_LOAD(cursor->best->next);
+      if (next != NULL) {
+        cursor->best = next;
       }
     }
     cursor->key = cursor->best->key;
   } break;
   case KVDS_SNAP_LOWER: {
     if (cursor->key <= cursor->best->key) {
-      if (cursor->best->prev != NULL) {
-        cursor->best = cursor->best->prev;
+      lst_node *prev = KVDS_LOAD(cursor->best->prev);
+      if (prev != NULL) {
+        cursor->best = prev;
       }
     }
     cursor->key = cursor->best->key;
@@ -279,6 +362,57 @@ static void lst_snap(kvds_db *_db, kvds_cursor *_cursor, enum kvds_snap_directio
   }
 }
 
+static void lst_iterate(kvds_db *_db, kvds_cursor *_cursor, long long to, bool (*callback)(void *context, long long key, const kvds_value *value), void *context) {
+  lst_db *db = _db;
+  lst_cursor *cursor = _cursor;
+
+  lst_node *node = cursor->best;
+  if (node != NULL && node->key < cursor->key) {
+    node = KVDS_LOAD(node->next); // best is right before the key
+  }
+  for (; node != NULL && node->key <= to; node = KVDS_LOAD(node->next)) {
+    if (!callback(context, node->key, &node->value)) {
+      break;
+    }
+  }
+}
+
+static void lst_bulk_load(kvds_db *_db, bool (*next)(void *context, long long *key, kvds_value *value), void *context) {
+  lst_db *db = _db;
+  assert(db->head == NULL);
+
+  long long key;
+  kvds_value value;
+  while (next(context, &key, &value)) {
+    assert(db->tail == NULL || db->tail->key < key);
+    lst_node *node = kvds_arena_alloc(&db->nodes);
+    node->key = key;
+    kvds_value_store(&db->values, &node->value, &value);
+    node->prev = db->tail;
+    node->next = NULL;
+
+    if (db->tail != NULL) {
+      KVDS_PUBLISH(db->tail->next, node);
+    } else {
+      KVDS_PUBLISH(db->head, node);
+    }
+    KVDS_PUBLISH(db->tail, node);
+    if (LST_HASH_INDEX) kvds_hash_index_put(&db->index, node->key, node);
+  }
+
+  lst_assert_invariants(db);
+}
+
+static void lst_shape(kvds_db *_db, long long *nodes, long long *height) {
+  lst_db *db = _db;
+
+  *nodes = 0;
+  for (lst_node *node = db->head; node != NULL; node = node->next) {
+    (*nodes)++;
+  }
+  *height = -1;
+}
+
 REGISTER("linkedlist", "lst", "Store entries in a sorted doubly-linked list") = {
   .create_db = lst_create_db,
   .destroy_db = lst_destroy_db,
@@ -293,4 +427,8 @@ REGISTER("linkedlist", "lst", "Store entries in a sorted doubly-linked list") =
   .write = lst_write,
   .read = lst_read,
   .remove = lst_remove,
+  .iterate = lst_iterate,
+  .bulk_load = lst_bulk_load,
+  .shape = lst_shape,
+  .concurrent_readers = true,
 };
@@ -2,6 +2,7 @@
 #ifndef NDEBUG
 #include "../registry.h"
 #include <assert.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -17,7 +18,7 @@ typedef struct inv_cursor {
   kvds_cursor **cursors;
 } inv_cursor;
 
-static kvds_db *inv_create_db();
+static kvds_db *inv_create_db(const kvds_options *options);
 
 static int inv_list_algos(struct kvds_database_algo **result) {
   int algos_count = 0;
@@ -39,7 +40,7 @@ static int inv_list_algos(struct kvds_database_algo **result) {
   return algos_count;
 }
 
-static kvds_db *inv_create_db() {
+static kvds_db *inv_create_db(const kvds_options *options) {
   inv_db *db = malloc(sizeof(inv_db));
 
   db->algos_count = inv_list_algos(NULL);
@@ -49,25 +50,17 @@ static kvds_db *inv_create_db() {
   db->databases = calloc(db->algos_count, sizeof(kvds_db *));
 
   for (int i = 0; i < db->algos_count; i++) {
-    db->databases[i] = db->algos[i]->create_db();
+    db->databases[i] = db->algos[i]->create_db(options);
   }
 
   return db;
 }
 
-static void inv_dummy_free(char *data) {
-  // pass
-}
-
-static void inv_destroy_db(kvds_db *_db, void (*free_data)(char *data)) {
+static void inv_destroy_db(kvds_db *_db) {
   inv_db *db = _db;
 
   for (int i = 0; i < db->algos_count; i++) {
-    if (i == db->algos_count - 1) {
-      db->algos[i]->destroy_db(db->databases[i], free_data); // Only free the last db's data, to avoid a double-free
-    } else {
-      db->algos[i]->destroy_db(db->databases[i], inv_dummy_free);
-    }
+    db->algos[i]->destroy_db(db->databases[i]);
   }
 
   free(db->algos);
@@ -158,27 +151,225 @@ static void inv_snap(kvds_db *_db, kvds_cursor *_cursor, enum kvds_snap_directio
   INV_ASSERT(db, i, _key, (db->algos[i]->snap(db->databases[i], cursor->cursors[i], dir), db->algos[i]->key(db->databases[i], cursor->cursors[i])));
 }
 
-static char *inv_write(kvds_db *_db, kvds_cursor *_cursor, char *data) {
+static void inv_write(kvds_db *_db, kvds_cursor *_cursor, const kvds_value *value) {
   inv_db *db = _db;
   inv_cursor *cursor = _cursor;
 
-  INV_ASSERT_RETURN(db, i, (db->algos[i]->write(db->databases[i], cursor->cursors[i], data)));
+  // Each database stores its own copy
+  for (int i = 0; i < db->algos_count; i++) {
+    db->algos[i]->write(db->databases[i], cursor->cursors[i], value);
+  }
 }
 
-static char *inv_read(kvds_db *_db, kvds_cursor *_cursor) {
+static const kvds_value *inv_read(kvds_db *_db, kvds_cursor *_cursor) {
   inv_db *db = _db;
   inv_cursor *cursor = _cursor;
 
-  INV_ASSERT_RETURN(db, i, (db->algos[i]->read(db->databases[i], cursor->cursors[i])));
+  // Values are copied into each database, so compare what they hold rather than where
+  const kvds_value *result = NULL;
+  for (int i = 0; i < db->algos_count; i++) {
+    const kvds_value *result_i = db->algos[i]->read(db->databases[i], cursor->cursors[i]);
+    if (i == 0) {
+      result = result_i;
+    } else {
+      assert((result == NULL) == (result_i == NULL));
+      assert(result == NULL || kvds_value_equal(result, result_i));
+    }
+  }
+  return result;
 }
 
-static char *inv_remove(kvds_db *_db, kvds_cursor *_cursor) {
+static bool inv_remove(kvds_db *_db, kvds_cursor *_cursor) {
   inv_db *db = _db;
   inv_cursor *cursor = _cursor;
 
   INV_ASSERT_RETURN(db, i, (db->algos[i]->remove(db->databases[i], cursor->cursors[i])));
 }
 
+typedef struct inv_iterate_context {
+  long long *keys;
+  const kvds_value **values;
+  long long count;
+  long long capacity;
+  long long checked;
+  bool stopped; // Whether the callback asked us to stop, as opposed to running out of keys
+
+  bool (*callback)(void *context, long long key, const kvds_value *value);
+  void *context;
+} inv_iterate_context;
+
+static bool inv_iterate_record(void *_context, long long key, const kvds_value *value) {
+  inv_iterate_context *context = _context;
+  if (context->count == context->capacity) {
+    context->capacity = context->capacity == 0 ? 16 : context->capacity * 2;
+    context->keys = realloc(context->keys, context->capacity * sizeof(long long));
+    context->values = realloc(context->values, context->capacity * sizeof(kvds_value *));
+  }
+  context->keys[context->count] = key;
+  context->values[context->count] = value;
+  context->count++;
+
+  if (!context->callback(context->context, key, value)) {
+    context->stopped = true;
+    return false;
+  }
+  return true;
+}
+
+static bool inv_iterate_compare(void *_context, long long key, const kvds_value *value) {
+  inv_iterate_context *context = _context;
+  assert(context->checked < context->count);
+  assert(context->keys[context->checked] == key);
+  assert(kvds_value_equal(context->values[context->checked], value));
+  context->checked++;
+
+  return !(context->stopped && context->checked == context->count);
+}
+
+static void inv_iterate(kvds_db *_db, kvds_cursor *_cursor, long long to, bool (*callback)(void *context, long long key, const kvds_value *value), void *context) {
+  inv_db *db = _db;
+  inv_cursor *cursor = _cursor;
+
+  inv_iterate_context record = {
+    .keys = NULL,
+    .values = NULL,
+    .count = 0,
+    .capacity = 0,
+    .checked = 0,
+    .stopped = false,
+    .callback = callback,
+    .context = context,
+  };
+
+  // The first algorithm feeds the callback; the rest have to visit exactly the same entries
+  for (int i = 0; i < db->algos_count; i++) {
+    if (i == 0) {
+      kvds_algo_iterate(db->algos[i], db->databases[i], cursor->cursors[i], to, inv_iterate_record, &record);
+    } else {
+      record.checked = 0;
+      kvds_algo_iterate(db->algos[i], db->databases[i], cursor->cursors[i], to, inv_iterate_compare, &record);
+      assert(record.checked == record.count);
+    }
+  }
+
+  free(record.keys);
+  free(record.values);
+}
+
+static long long inv_rank_one(inv_db *db, int i, kvds_cursor *cursor) {
+  if (db->algos[i]->rank != NULL) {
+    return db->algos[i]->rank(db->databases[i], cursor);
+  }
+  long long key = db->algos[i]->key(db->databases[i], cursor);
+  return key == LLONG_MIN ? 0 : kvds_algo_count_walk(db->algos[i], db->databases[i], LLONG_MIN, key - 1, -1, NULL);
+}
+
+static void inv_nth_one(inv_db *db, int i, kvds_cursor **cursor, long long index) {
+  if (db->algos[i]->nth != NULL) {
+    db->algos[i]->nth(db->databases[i], *cursor, index);
+    return;
+  }
+  long long last;
+  if (kvds_algo_count_walk(db->algos[i], db->databases[i], LLONG_MIN, LLONG_MAX, index < 0 ? 1 : index < LLONG_MAX ? index + 1 : -1, &last) > 0) {
+    if (db->algos[i]->move_cursor != NULL) {
+      db->algos[i]->move_cursor(db->databases[i], *cursor, last);
+    } else {
+      db->algos[i]->destroy_cursor(db->databases[i], *cursor);
+      *cursor = db->algos[i]->create_cursor(db->databases[i], last);
+    }
+  }
+}
+
+static long long inv_count_one(inv_db *db, int i, long long from, long long to) {
+  if (db->algos[i]->count != NULL) {
+    return db->algos[i]->count(db->databases[i], from, to);
+  }
+  return from > to ? 0 : kvds_algo_count_walk(db->algos[i], db->databases[i], from, to, -1, NULL);
+}
+
+static long long inv_rank(kvds_db *_db, kvds_cursor *_cursor) {
+  inv_db *db = _db;
+  inv_cursor *cursor = _cursor;
+
+  INV_ASSERT_RETURN(db, i, inv_rank_one(db, i, cursor->cursors[i]));
+}
+
+static void inv_nth(kvds_db *_db, kvds_cursor *_cursor, long long index) {
+  inv_db *db = _db;
+  inv_cursor *cursor = _cursor;
+
+  INV_ASSERT(db, i, _key, (inv_nth_one(db, i, &cursor->cursors[i], index), db->algos[i]->key(db->databases[i], cursor->cursors[i])));
+}
+
+static long long inv_count(kvds_db *_db, long long from, long long to) {
+  inv_db *db = _db;
+
+  INV_ASSERT_RETURN(db, i, inv_count_one(db, i, from, to));
+}
+
+typedef struct inv_bulk_load_context {
+  long long *keys;
+  kvds_value *values;
+  kvds_value_arena storage; // Transient values have to be copied before asking for the next one
+  long long count;
+  long long position;
+} inv_bulk_load_context;
+
+static bool inv_bulk_load_replay(void *_context, long long *key, kvds_value *value) {
+  inv_bulk_load_context *context = _context;
+  if (context->position == context->count) {
+    return false;
+  }
+  *key = context->keys[context->position];
+  *value = context->values[context->position];
+  context->position++;
+  return true;
+}
+
+static void inv_bulk_load(kvds_db *_db, bool (*next)(void *context, long long *key, kvds_value *value), void *context) {
+  inv_db *db = _db;
+
+  // The stream can only be read once, so buffer it and replay it to each algorithm
+  inv_bulk_load_context buffer = {
+    .keys = NULL,
+    .values = NULL,
+    .count = 0,
+    .position = 0,
+  };
+  kvds_value_arena_init(&buffer.storage, KVDS_ALLOCATOR_DEFAULT);
+  long long capacity = 0;
+  long long key;
+  kvds_value value;
+  while (next(context, &key, &value)) {
+    if (buffer.count == capacity) {
+      capacity = capacity == 0 ? 16 : capacity * 2;
+      buffer.keys = realloc(buffer.keys, capacity * sizeof(long long));
+      buffer.values = realloc(buffer.values, capacity * sizeof(kvds_value));
+    }
+    buffer.keys[buffer.count] = key;
+    kvds_value_store(&buffer.storage, &buffer.values[buffer.count], &value);
+    buffer.count++;
+  }
+
+  for (int i = 0; i < db->algos_count; i++) {
+    buffer.position = 0;
+    if (db->algos[i]->bulk_load != NULL) {
+      db->algos[i]->bulk_load(db->databases[i], inv_bulk_load_replay, &buffer);
+    } else {
+      kvds_cursor *cursor = db->algos[i]->create_cursor(db->databases[i], 0);
+      while (inv_bulk_load_replay(&buffer, &key, &value)) {
+        db->algos[i]->move_cursor(db->databases[i], cursor, key);
+        db->algos[i]->write(db->databases[i], cursor, &value);
+      }
+      db->algos[i]->destroy_cursor(db->databases[i], cursor);
+    }
+  }
+
+  free(buffer.keys);
+  free(buffer.values);
+  kvds_value_arena_release(&buffer.storage);
+}
+
 #undef INV_ASSERT_RETURN
 #undef INV_ASSERT
 #undef _INV_ASSERT
@@ -197,6 +388,11 @@ REGISTER("default", "inv", "Run all algorithms and compare the results") = {
   .write = inv_write,
   .read = inv_read,
   .remove = inv_remove,
+  .iterate = inv_iterate,
+  .bulk_load = inv_bulk_load,
+  .rank = inv_rank,
+  .nth = inv_nth,
+  .count = inv_count,
 };
 
 #endif
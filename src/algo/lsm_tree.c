@@ -0,0 +1,654 @@
+// SPDX-License-Identifier: MIT
+#include "../registry.h"
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef LSM_MEMTABLE_ALGO
+#define LSM_MEMTABLE_ALGO "scg"
+#endif
+#ifndef LSM_MEMTABLE_KEYS
+#define LSM_MEMTABLE_KEYS 16384 // Keys (and tombstones) in the memtable before it gets frozen into a run
+#endif
+
+#define LSM_MAX_RUNS 32 // Writes wait for compactions to catch up rather than go over this
+#define LSM_RUN_GROWTH 2 // Runs get merged into the next older one until each is at least this many times smaller than it
+
+// Removed keys that may still be in older runs are shadowed by a tombstone: a borrowed value pointing here, too long to be inlined, so that it is stored by reference and can be told apart from real values
+static const char lsm_tombstone_bytes[KVDS_VALUE_INLINE + 1];
+static const kvds_value lsm_tombstone = {.length = sizeof lsm_tombstone_bytes, .kind = KVDS_VALUE_BORROWED, .pointer = lsm_tombstone_bytes};
+
+static inline bool lsm_is_tombstone(const kvds_value *value) {
+  return value->kind == KVDS_VALUE_BORROWED && value->pointer == lsm_tombstone_bytes;
+}
+
+// Immutable sorted run of entries; never changed once built, so the compaction thread can read it while the caller reads it too
+typedef struct lsm_run {
+  long long count;
+  long long capacity;
+  long long *keys; // Strictly ascending
+  kvds_value *values; // values[i] belongs to keys[i]
+  kvds_value_arena storage;
+} lsm_run;
+
+typedef struct lsm_db {
+  struct kvds_database_algo *algo; // Of the memtable
+  kvds_options memtable_options;
+  kvds_db *memtable;
+  kvds_cursor *memtable_cursor; // Shared by all cursors, as only one of them is ever used at a time
+  long long memtable_count;
+
+  lsm_run *runs[LSM_MAX_RUNS]; // Newest first; only changed by the caller's thread, with the mutex held
+  int run_count;
+  unsigned long long version; // Bumped on every change, so that cursors know to look their key up again
+
+  // Compaction thread; merges two neighbouring runs at a time into a new one, which the caller's thread swaps in at its next change
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t wakeup; // Signalled for the compaction thread, when there is a new run or a merge was swapped in
+  pthread_cond_t merged; // Signalled for the caller's thread, when a merge is done
+  bool stopping;
+  lsm_run *merging[2]; // Newer and older run being merged, or NULL if none
+  lsm_run *result; // Merge of the runs in merging, waiting to be swapped in; NULL if not done yet
+} lsm_db;
+
+// A k-way merge over the memtable and the runs; for each run, keeps the position of the first key at least as high as the cursor's key
+typedef struct lsm_cursor {
+  long long key;
+  unsigned long long version; // The database's version when value and positions were found
+  const kvds_value *value; // Newest value for the key, or NULL if it doesn't exist (or was removed)
+  long long positions[LSM_MAX_RUNS];
+} lsm_cursor;
+
+// Runs
+
+static lsm_run *lsm_run_create(enum kvds_allocator allocator) {
+  lsm_run *run = malloc(sizeof(lsm_run));
+  run->count = 0;
+  run->capacity = 0;
+  run->keys = NULL;
+  run->values = NULL;
+  kvds_value_arena_init(&run->storage, allocator);
+  return run;
+}
+
+static void lsm_run_destroy(lsm_run *run) {
+  kvds_value_arena_release(&run->storage);
+  free(run->keys);
+  free(run->values);
+  free(run);
+}
+
+static bool lsm_run_append(void *_run, long long key, const kvds_value *value) {
+  lsm_run *run = _run;
+  assert(run->count == 0 || run->keys[run->count - 1] < key);
+  if (run->count == run->capacity) {
+    run->capacity = run->capacity == 0 ? 1024 : run->capacity * 2;
+    run->keys = realloc(run->keys, run->capacity * sizeof(long long));
+    run->values = realloc(run->values, run->capacity * sizeof(kvds_value));
+  }
+  run->keys[run->count] = key;
+  kvds_value_store(&run->storage, &run->values[run->count], value); // Tombstones stay borrowed
+  run->count++;
+  return true;
+}
+
+// Index of the first key in the run that is at least as high as the given one
+static long long lsm_run_lower_bound(lsm_run *run, long long key) {
+  long long low = 0, high = run->count;
+  while (low < high) {
+    long long middle = low + (high - low) / 2;
+    if (run->keys[middle] < key) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+// Merges two runs, with the newer one's entries winning over the older one's; tombstones are only needed while there are older runs left for them to shadow
+static lsm_run *lsm_run_merge(lsm_run *newer, lsm_run *older, bool oldest, enum kvds_allocator allocator) {
+  lsm_run *merged = lsm_run_create(allocator);
+  long long i = 0, j = 0;
+  while (i < newer->count || j < older->count) {
+    lsm_run *from;
+    long long index;
+    if (j == older->count || (i < newer->count && newer->keys[i] <= older->keys[j])) {
+      if (j < older->count && newer->keys[i] == older->keys[j]) {
+        j++; // Shadowed
+      }
+      from = newer;
+      index = i++;
+    } else {
+      from = older;
+      index = j++;
+    }
+    if (!(oldest && lsm_is_tombstone(&from->values[index]))) {
+      lsm_run_append(merged, from->keys[index], &from->values[index]);
+    }
+  }
+  return merged;
+}
+
+// Compaction
+
+// Picks two neighbouring runs to merge: the newest ones that break the growth factor, or the newest two if there are too many runs; call with the mutex held
+static bool lsm_pick_merge(lsm_db *db) {
+  for (int i = 0; i + 1 < db->run_count; i++) {
+    if (db->runs[i]->count * LSM_RUN_GROWTH > db->runs[i + 1]->count || (i == 0 && db->run_count > LSM_MAX_RUNS / 2)) {
+      db->merging[0] = db->runs[i];
+      db->merging[1] = db->runs[i + 1];
+      return true;
+    }
+  }
+  return false;
+}
+
+static void *lsm_compact(void *_db) {
+  lsm_db *db = _db;
+  pthread_mutex_lock(&db->mutex);
+  while (!db->stopping) {
+    if (db->merging[0] == NULL && lsm_pick_merge(db)) {
+      lsm_run *newer = db->merging[0];
+      lsm_run *older = db->merging[1];
+      bool oldest = db->runs[db->run_count - 1] == older; // New runs only ever come in at the front, so it stays the oldest
+      pthread_mutex_unlock(&db->mutex);
+      lsm_run *result = lsm_run_merge(newer, older, oldest, db->memtable_options.allocator);
+      pthread_mutex_lock(&db->mutex);
+      __atomic_store_n(&db->result, result, __ATOMIC_RELEASE);
+      pthread_cond_signal(&db->merged);
+      continue;
+    }
+    pthread_cond_wait(&db->wakeup, &db->mutex);
+  }
+  pthread_mutex_unlock(&db->mutex);
+  return NULL;
+}
+
+// Swaps a finished merge in for the two runs it came from; returns whether there was one
+static bool lsm_install_merge(lsm_db *db) {
+  if (__atomic_load_n(&db->result, __ATOMIC_ACQUIRE) == NULL) {
+    return false;
+  }
+  pthread_mutex_lock(&db->mutex);
+  lsm_run *newer = db->merging[0];
+  lsm_run *older = db->merging[1];
+  int i = 0;
+  while (db->runs[i] != newer) {
+    i++;
+  }
+  assert(db->runs[i + 1] == older);
+  db->runs[i] = db->result;
+  memmove(&db->runs[i + 1], &db->runs[i + 2], (db->run_count - i - 2) * sizeof(lsm_run *));
+  db->run_count--;
+  if (db->runs[i]->count == 0) { // Everything in it was removed
+    lsm_run_destroy(db->runs[i]);
+    memmove(&db->runs[i], &db->runs[i + 1], (db->run_count - i - 1) * sizeof(lsm_run *));
+    db->run_count--;
+  }
+  db->merging[0] = db->merging[1] = NULL;
+  db->result = NULL;
+  db->version++;
+  pthread_cond_signal(&db->wakeup);
+  pthread_mutex_unlock(&db->mutex);
+
+  lsm_run_destroy(newer);
+  lsm_run_destroy(older);
+  return true;
+}
+
+// Turns the memtable into the newest run, and starts over with an empty one
+static void lsm_freeze(lsm_db *db) {
+  while (db->run_count == LSM_MAX_RUNS) { // Wait for the compaction thread to catch up
+    pthread_mutex_lock(&db->mutex);
+    while (db->result == NULL) {
+      pthread_cond_wait(&db->merged, &db->mutex);
+    }
+    pthread_mutex_unlock(&db->mutex);
+    lsm_install_merge(db);
+  }
+
+  lsm_run *run = lsm_run_create(db->memtable_options.allocator);
+  kvds_cursor *cursor = db->algo->create_cursor(db->memtable, LLONG_MIN);
+  db->algo->iterate(db->memtable, cursor, LLONG_MAX, lsm_run_append, run);
+  db->algo->destroy_cursor(db->memtable, cursor);
+  db->algo->destroy_cursor(db->memtable, db->memtable_cursor);
+  db->algo->destroy_db(db->memtable);
+  db->memtable = db->algo->create_db(&db->memtable_options);
+  db->memtable_cursor = db->algo->create_cursor(db->memtable, 0);
+  db->memtable_count = 0;
+
+  pthread_mutex_lock(&db->mutex);
+  memmove(&db->runs[1], &db->runs[0], db->run_count * sizeof(lsm_run *));
+  db->runs[0] = run;
+  db->run_count++;
+  db->version++;
+  pthread_cond_signal(&db->wakeup);
+  pthread_mutex_unlock(&db->mutex);
+}
+
+#ifndef NDEBUG
+static void lsm_assert_invariants(lsm_db *db) {
+  assert(db->run_count <= LSM_MAX_RUNS);
+  for (int i = 0; i < db->run_count; i++) {
+    lsm_run *run = db->runs[i];
+    for (long long j = 1; j < run->count; j++) {
+      assert(run->keys[j - 1] < run->keys[j]);
+    }
+  }
+}
+#else
+static void lsm_assert_invariants(lsm_db *db) {
+  // pass
+}
+#endif
+
+static kvds_db *lsm_create_db(const kvds_options *options) {
+  lsm_db *db = malloc(sizeof(lsm_db));
+
+  db->algo = kvds_get_algo(LSM_MEMTABLE_ALGO);
+  assert(db->algo != NULL && db->algo->create_db != lsm_create_db && db->algo->iterate != NULL);
+  db->memtable_options = *options;
+  if (db->memtable_options.capacity > LSM_MEMTABLE_KEYS) {
+    db->memtable_options.capacity = LSM_MEMTABLE_KEYS; // The rest of the keys go into runs, which are sized as they are built
+  }
+  db->memtable = db->algo->create_db(&db->memtable_options);
+  db->memtable_cursor = db->algo->create_cursor(db->memtable, 0);
+  db->memtable_count = 0;
+  db->run_count = 0;
+  db->version = 0;
+
+  pthread_mutex_init(&db->mutex, NULL);
+  pthread_cond_init(&db->wakeup, NULL);
+  pthread_cond_init(&db->merged, NULL);
+  db->stopping = false;
+  db->merging[0] = db->merging[1] = NULL;
+  db->result = NULL;
+  pthread_create(&db->thread, NULL, lsm_compact, db);
+
+  return db;
+}
+
+static void lsm_destroy_db(kvds_db *_db) {
+  lsm_db *db = _db;
+
+  pthread_mutex_lock(&db->mutex);
+  db->stopping = true;
+  pthread_cond_signal(&db->wakeup);
+  pthread_mutex_unlock(&db->mutex);
+  pthread_join(db->thread, NULL);
+
+  if (db->result != NULL) {
+    lsm_run_destroy(db->result);
+  }
+  for (int i = 0; i < db->run_count; i++) {
+    lsm_run_destroy(db->runs[i]);
+  }
+  pthread_mutex_destroy(&db->mutex);
+  pthread_cond_destroy(&db->wakeup);
+  pthread_cond_destroy(&db->merged);
+  db->algo->destroy_cursor(db->memtable, db->memtable_cursor);
+  db->algo->destroy_db(db->memtable);
+  free(db);
+}
+
+// Value of the key in the memtable (possibly a tombstone), or NULL if it isn't there
+static const kvds_value *lsm_memtable_find(lsm_db *db, long long key) {
+  db->algo->move_cursor(db->memtable, db->memtable_cursor, key);
+  return db->algo->read(db->memtable, db->memtable_cursor);
+}
+
+// Looks the cursor's key up from scratch
+static void lsm_locate(lsm_db *db, lsm_cursor *cursor) {
+  const kvds_value *value = lsm_memtable_find(db, cursor->key);
+  for (int i = 0; i < db->run_count; i++) {
+    lsm_run *run = db->runs[i];
+    cursor->positions[i] = lsm_run_lower_bound(run, cursor->key);
+    if (value == NULL && cursor->positions[i] < run->count && run->keys[cursor->positions[i]] == cursor->key) {
+      value = &run->values[cursor->positions[i]];
+    }
+  }
+  cursor->value = value != NULL && !lsm_is_tombstone(value) ? value : NULL;
+  cursor->version = db->version;
+}
+
+// Makes sure the cursor hasn't been left behind by changes made through other cursors
+static void lsm_refresh(lsm_db *db, lsm_cursor *cursor) {
+  if (cursor->version != db->version) {
+    lsm_locate(db, cursor);
+  }
+}
+
+static kvds_cursor *lsm_create_cursor(kvds_db *_db, long long key) {
+  lsm_db *db = _db;
+  lsm_cursor *cursor = malloc(sizeof(lsm_cursor));
+
+  cursor->key = key;
+  lsm_locate(db, cursor);
+
+  return cursor;
+}
+
+static void lsm_move_cursor(kvds_db *_db, kvds_cursor *_cursor, long long key) {
+  lsm_db *db = _db;
+  lsm_cursor *cursor = _cursor;
+
+  cursor->key = key;
+  lsm_locate(db, cursor);
+}
+
+static void lsm_destroy_cursor(kvds_db *_db, kvds_cursor *_cursor) {
+  lsm_db *db = _db;
+  lsm_cursor *cursor = _cursor;
+
+  free(cursor);
+}
+
+static long long lsm_key(kvds_db *_db, kvds_cursor *_cursor) {
+  lsm_db *db = _db;
+  lsm_cursor *cursor = _cursor;
+
+  return cursor->key;
+}
+
+static bool lsm_exists(kvds_db *_db, kvds_cursor *_cursor) {
+  lsm_db *db = _db;
+  lsm_cursor *cursor = _cursor;
+
+  lsm_refresh(db, cursor);
+  return cursor->value != NULL;
+}
+
+static const kvds_value *lsm_read(kvds_db *_db, kvds_cursor *_cursor) {
+  lsm_db *db = _db;
+  lsm_cursor *cursor = _cursor;
+
+  lsm_refresh(db, cursor);
+  return cursor->value;
+}
+
+// Puts a value (or a tombstone) for the cursor's key into the memtable, freezing it if it's full
+static void lsm_memtable_write(lsm_db *db, lsm_cursor *cursor, const kvds_value *value) {
+  lsm_install_merge(db);
+  db->algo->move_cursor(db->memtable, db->memtable_cursor, cursor->key);
+  if (!db->algo->exists(db->memtable, db->memtable_cursor)) {
+    db->memtable_count++;
+  }
+  db->algo->write(db->memtable, db->memtable_cursor, value);
+  db->version++;
+
+  if (db->memtable_count >= LSM_MEMTABLE_KEYS) {
+    lsm_freeze(db);
+  }
+}
+
+static void lsm_write(kvds_db *_db, kvds_cursor *_cursor, const kvds_value *value) {
+  lsm_db *db = _db;
+  lsm_cursor *cursor = _cursor;
+
+  lsm_refresh(db, cursor);
+  unsigned long long version = db->version;
+  lsm_memtable_write(db, cursor, value);
+  if (db->version == version + 1) { // Only the memtable changed, so the positions still hold
+    cursor->value = db->algo->read(db->memtable, db->memtable_cursor);
+    cursor->version = db->version;
+  } else {
+    lsm_locate(db, cursor);
+  }
+
+  lsm_assert_invariants(db);
+}
+
+static bool lsm_remove(kvds_db *_db, kvds_cursor *_cursor) {
+  lsm_db *db = _db;
+  lsm_cursor *cursor = _cursor;
+
+  lsm_refresh(db, cursor);
+  if (cursor->value == NULL) {
+    return false;
+  }
+
+  bool in_runs = false;
+  for (int i = 0; i < db->run_count; i++) {
+    lsm_run *run = db->runs[i];
+    in_runs = in_runs || (cursor->positions[i] < run->count && run->keys[cursor->positions[i]] == cursor->key);
+  }
+  if (in_runs) {
+    lsm_memtable_write(db, cursor, &lsm_tombstone);
+  } else { // Only ever written since the last freeze; no need to leave anything behind
+    lsm_install_merge(db);
+    db->algo->move_cursor(db->memtable, db->memtable_cursor, cursor->key);
+    db->algo->remove(db->memtable, db->memtable_cursor);
+    db->memtable_count--;
+    db->version++;
+  }
+  lsm_locate(db, cursor);
+
+  lsm_assert_invariants(db);
+
+  return true;
+}
+
+// Finds the nearest key in the given direction that hasn't been removed, merging the memtable and all runs; on success, fills in where the cursor would be on it
+static bool lsm_seek(lsm_db *db, lsm_cursor *cursor, enum kvds_snap_direction dir, long long *found, const kvds_value **found_value, long long *positions) {
+  bool higher = dir == KVDS_SNAP_HIGHER;
+  long long key = cursor->key;
+  memcpy(positions, cursor->positions, db->run_count * sizeof(long long));
+
+  while (true) {
+    // The memtable's candidate
+    bool has_next = false;
+    long long next;
+    const kvds_value *value = NULL;
+    db->algo->move_cursor(db->memtable, db->memtable_cursor, key);
+    db->algo->snap(db->memtable, db->memtable_cursor, dir);
+    long long memtable_key = db->algo->key(db->memtable, db->memtable_cursor);
+    if (db->algo->exists(db->memtable, db->memtable_cursor) && (higher ? memtable_key > key : memtable_key < key)) {
+      has_next = true;
+      next = memtable_key;
+      value = db->algo->read(db->memtable, db->memtable_cursor);
+    }
+    // Each run's candidate; the newest one wins ties
+    for (int i = 0; i < db->run_count; i++) {
+      lsm_run *run = db->runs[i];
+      long long index = positions[i];
+      if (higher) {
+        index += index < run->count && run->keys[index] == key;
+      } else {
+        index--;
+      }
+      if (index < 0 || index >= run->count) {
+        continue;
+      }
+      if (!has_next || (higher ? run->keys[index] < next : run->keys[index] > next)) {
+        has_next = true;
+        next = run->keys[index];
+        value = &run->values[index];
+      }
+    }
+    if (!has_next) {
+      return false;
+    }
+
+    // No run has keys strictly between key and next, so each position moves by at most one
+    for (int i = 0; i < db->run_count; i++) {
+      lsm_run *run = db->runs[i];
+      if (higher) {
+        positions[i] += positions[i] < run->count && run->keys[positions[i]] == key;
+      } else if (positions[i] > 0 && run->keys[positions[i] - 1] == next) {
+        positions[i]--;
+      }
+    }
+    key = next;
+    if (!lsm_is_tombstone(value)) {
+      *found = next;
+      *found_value = value;
+      return true;
+    }
+  }
+}
+
+static void lsm_snap(kvds_db *_db, kvds_cursor *_cursor, enum kvds_snap_direction dir) {
+  lsm_db *db = _db;
+  lsm_cursor *cursor = _cursor;
+
+  lsm_refresh(db, cursor);
+
+  // Past the last key in the given direction, the cursor ends up on the nearest key on the other side instead, just like in the other algorithms
+  long long found;
+  const kvds_value *value;
+  long long positions[LSM_MAX_RUNS];
+  switch (dir) {
+  case KVDS_SNAP_HIGHER:
+  case KVDS_SNAP_LOWER: {
+    enum kvds_snap_direction other = dir == KVDS_SNAP_HIGHER ? KVDS_SNAP_LOWER : KVDS_SNAP_HIGHER;
+    if (lsm_seek(db, cursor, dir, &found, &value, positions) || (cursor->value == NULL && lsm_seek(db, cursor, other, &found, &value, positions))) {
+      cursor->key = found;
+      cursor->value = value;
+      memcpy(cursor->positions, positions, db->run_count * sizeof(long long));
+    }
+  } break;
+  case KVDS_SNAP_CLOSEST_LOW: {
+    if (cursor->value != NULL) {
+      break; // Already at closest
+    }
+    long long left, right;
+    const kvds_value *left_value, *right_value;
+    long long right_positions[LSM_MAX_RUNS];
+    bool has_left = lsm_seek(db, cursor, KVDS_SNAP_LOWER, &left, &left_value, positions);
+    bool has_right = lsm_seek(db, cursor, KVDS_SNAP_HIGHER, &right, &right_value, right_positions);
+    if (has_left && (!has_right || (unsigned long long)cursor->key - left <= (unsigned long long)right - cursor->key)) {
+      cursor->key = left;
+      cursor->value = left_value;
+      memcpy(cursor->positions, positions, db->run_count * sizeof(long long));
+    } else if (has_right) {
+      cursor->key = right;
+      cursor->value = right_value;
+      memcpy(cursor->positions, right_positions, db->run_count * sizeof(long long));
+    }
+  } break;
+  }
+}
+
+typedef struct lsm_iterate_context {
+  lsm_db *db;
+  long long positions[LSM_MAX_RUNS];
+  bool (*callback)(void *context, long long key, const kvds_value *value);
+  void *context;
+  bool stopped;
+} lsm_iterate_context;
+
+// Passes on the entries of the runs below limit (or up to it, if inclusive), merged, to the callback
+static bool lsm_iterate_runs(lsm_iterate_context *context, long long limit, bool inclusive) {
+  lsm_db *db = context->db;
+  while (true) {
+    int newest = -1;
+    for (int i = 0; i < db->run_count; i++) {
+      long long index = context->positions[i];
+      if (index < db->runs[i]->count && (newest < 0 || db->runs[i]->keys[index] < db->runs[newest]->keys[context->positions[newest]])) {
+        newest = i;
+      }
+    }
+    if (newest < 0) {
+      return true;
+    }
+    long long key = db->runs[newest]->keys[context->positions[newest]];
+    if (inclusive ? key > limit : key >= limit) {
+      return true;
+    }
+    const kvds_value *value = &db->runs[newest]->values[context->positions[newest]];
+    for (int i = newest; i < db->run_count; i++) {
+      long long index = context->positions[i];
+      context->positions[i] += index < db->runs[i]->count && db->runs[i]->keys[index] == key;
+    }
+    if (!lsm_is_tombstone(value) && !context->callback(context->context, key, value)) {
+      context->stopped = true;
+      return false;
+    }
+  }
+}
+
+static bool lsm_iterate_memtable(void *_context, long long key, const kvds_value *value) {
+  lsm_iterate_context *context = _context;
+  if (!lsm_iterate_runs(context, key, false)) {
+    return false;
+  }
+  // The memtable's entry shadows those of all runs
+  for (int i = 0; i < context->db->run_count; i++) {
+    lsm_run *run = context->db->runs[i];
+    context->positions[i] += context->positions[i] < run->count && run->keys[context->positions[i]] == key;
+  }
+  if (!lsm_is_tombstone(value) && !context->callback(context->context, key, value)) {
+    context->stopped = true;
+    return false;
+  }
+  return true;
+}
+
+static void lsm_iterate(kvds_db *_db, kvds_cursor *_cursor, long long to, bool (*callback)(void *context, long long key, const kvds_value *value), void *context) {
+  lsm_db *db = _db;
+  lsm_cursor *cursor = _cursor;
+
+  lsm_refresh(db, cursor);
+  lsm_iterate_context merge = {
+    .db = db,
+    .callback = callback,
+    .context = context,
+    .stopped = false,
+  };
+  memcpy(merge.positions, cursor->positions, db->run_count * sizeof(long long));
+
+  db->algo->move_cursor(db->memtable, db->memtable_cursor, cursor->key);
+  db->algo->iterate(db->memtable, db->memtable_cursor, to, lsm_iterate_memtable, &merge);
+  if (!merge.stopped) {
+    lsm_iterate_runs(&merge, to, true);
+  }
+}
+
+static void lsm_bulk_load(kvds_db *_db, bool (*next)(void *context, long long *key, kvds_value *value), void *context) {
+  lsm_db *db = _db;
+  assert(db->run_count == 0 && db->memtable_count == 0);
+
+  // Already sorted, so it can go straight into a run
+  lsm_run *run = lsm_run_create(db->memtable_options.allocator);
+  long long key;
+  kvds_value value;
+  while (next(context, &key, &value)) {
+    lsm_run_append(run, key, &value);
+  }
+  if (run->count == 0) {
+    lsm_run_destroy(run);
+    return;
+  }
+
+  pthread_mutex_lock(&db->mutex);
+  db->runs[0] = run;
+  db->run_count = 1;
+  db->version++;
+  pthread_mutex_unlock(&db->mutex);
+
+  lsm_assert_invariants(db);
+}
+
+REGISTER("logstructured", "lsm", "Write entries into a " LSM_MEMTABLE_ALGO " memtable, frozen into sorted runs that get merged in the background") = {
+  .create_db = lsm_create_db,
+  .destroy_db = lsm_destroy_db,
+  .create_cursor = lsm_create_cursor,
+  .move_cursor = lsm_move_cursor,
+  .destroy_cursor = lsm_destroy_cursor,
+
+  .key = lsm_key,
+  .exists = lsm_exists,
+  .snap = lsm_snap,
+
+  .write = lsm_write,
+  .read = lsm_read,
+  .remove = lsm_remove,
+  .iterate = lsm_iterate,
+  .bulk_load = lsm_bulk_load,
+};
@@ -1,31 +1,61 @@
 // SPDX-License-Identifier: MIT
+#include "../arena.h"
+#include "../ebr.h"
+#include "../hash_index.h"
 #include "../registry.h"
+#include "../stats.h"
 #include <assert.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifndef SCG_SCAPEGOAT_FACTOR
-#define SCG_SCAPEGOAT_FACTOR 10 / 16
+#define SCG_SCAPEGOAT_FACTOR 10 / 16 // Default alpha, when the options don't give one
+#endif
+
+#define SCG_BALANCE_ONE 65536 // Fixed-point scale of scg_db.balance
+
+#ifndef SCG_FINGER_CLIMB
+#define SCG_FINGER_CLIMB 8 // Levels a cursor move climbs before giving up on the key being nearby and starting from the top
+#endif
+
+#ifndef SCG_FINGER_BACKOFF
+#define SCG_FINGER_BACKOFF 256 // Most cursor moves that skip the climb after it gave up; starting from one, it doubles every time it gives up again, as far-away moves tend to be followed by more of them
+#endif
+
+#ifndef SCG_HASH_INDEX
+#define SCG_HASH_INDEX true // Whether to keep a hash index of the nodes, so that moving to an existing key takes a single probe
 #endif
 
 typedef struct scg_db {
   struct scg_node *top;
+  kvds_arena nodes;
+  kvds_value_arena values;
+  kvds_ebr_limbo limbo; // Nodes unlinked by the writer that readers may still be looking at
+  kvds_hash_index index; // Maps keys to their nodes, if SCG_HASH_INDEX is set
+  long long balance; // Alpha, in SCG_BALANCE_ONE-ths
+  bool shared; // Whether readers may walk the tree alongside the writer; if not, values are replaced and subtrees rebuilt in place, rather than out of copies
 } scg_db;
 
+// In a shared tree, nodes are never changed in ways readers could see half-done: the key and value are fixed once a node is published, and the links are only ever swapped with KVDS_PUBLISH
 typedef struct scg_node {
   long long key;
-  char *data;
+  kvds_value value;
   struct scg_node *left;
   struct scg_node *right;
 
   struct scg_node *parent;
-  int size;
+  int size; // Only used by the writer
 } scg_node;
 
 typedef struct scg_cursor {
   long long key;
+  unsigned long long generation; // The limbo's generation when best was found; if it has moved on, best may be gone
+  int skip_climbs; // Moves left before trying the finger search again, see SCG_FINGER_BACKOFF
+  int backoff; // How many moves were skipped after the last climb gave up, or 0 if it didn't
   struct scg_node *best;
   // Node under which the key would be if it were to exist in the tree
   // Guarantees: if key < best->key, then for each P of best->parent...->parent,
@@ -65,7 +95,7 @@ typedef struct scg_invariants {
   long long range_min;
   long long range_max;
 } scg_invariants;
-static scg_invariants _scg_assert_invariants(scg_node *node, int depth) {
+static scg_invariants _scg_assert_invariants(scg_db *db, scg_node *node, int depth) {
   // fprintf(stderr, "%*c Node: %lld, size: %d\n", depth * 2, scg_is_left(node) ? '-' : '+', node->key, node->size);
 
   scg_invariants inv;
@@ -76,7 +106,7 @@ static scg_invariants _scg_assert_invariants(scg_node *node, int depth) {
     inv.range_min = node->key;
   } else {
     assert(node->left->parent == node);
-    scg_invariants inv_left = _scg_assert_invariants(node->left, depth + 1);
+    scg_invariants inv_left = _scg_assert_invariants(db, node->left, depth + 1);
     inv.range_min = inv_left.range_min;
     assert(inv_left.range_max < node->key);
     left_size = node->left->size;
@@ -85,20 +115,23 @@ static scg_invariants _scg_assert_invariants(scg_node *node, int depth) {
     inv.range_max = node->key;
   } else {
     assert(node->right->parent == node);
-    scg_invariants inv_right = _scg_assert_invariants(node->right, depth + 1);
+    scg_invariants inv_right = _scg_assert_invariants(db, node->right, depth + 1);
     inv.range_max = inv_right.range_max;
     assert(node->key < inv_right.range_min);
     right_size = node->right->size;
   }
 
   assert(node->size == left_size + right_size + 1);
-  assert(left_size <= node->size * SCG_SCAPEGOAT_FACTOR);
-  assert(right_size <= node->size * SCG_SCAPEGOAT_FACTOR);
+  assert((long long)left_size * SCG_BALANCE_ONE <= node->size * db->balance);
+  assert((long long)right_size * SCG_BALANCE_ONE <= node->size * db->balance);
+  assert(!SCG_HASH_INDEX || kvds_hash_index_get(&db->index, node->key) == node);
 
   return inv;
 }
 static void scg_assert_invariants(scg_db *db) {
-  _scg_assert_invariants(db->top, 0);
+  assert(!SCG_HASH_INDEX || db->index.count == scg_get_size(db->top));
+  if (db->top == NULL) return;
+  _scg_assert_invariants(db, db->top, 0);
   assert(db->top->parent == NULL);
 }
 #else
@@ -107,66 +140,123 @@ static void scg_assert_invariants(scg_db *db) {
 }
 #endif
 
-static kvds_db *scg_create_db() {
+static kvds_db *scg_create_db(const kvds_options *options) {
   scg_db *db = malloc(sizeof(scg_db));
   db->top = NULL;
+  kvds_arena_init(&db->nodes, sizeof(scg_node), options->allocator);
+  kvds_arena_reserve(&db->nodes, options->capacity);
+  kvds_value_arena_init(&db->values, options->allocator);
+  kvds_ebr_limbo_init(&db->limbo, db);
+  kvds_hash_index_init(&db->index, &db->limbo);
+  if (SCG_HASH_INDEX) {
+    kvds_hash_index_reserve(&db->index, options->capacity);
+  }
+  db->shared = options->concurrent_readers;
+  db->balance = options->alpha > 0 ? (long long)(options->alpha * SCG_BALANCE_ONE) : SCG_BALANCE_ONE * SCG_SCAPEGOAT_FACTOR;
   return db;
 }
 
-static void scg_node_destroy(scg_node *node, void (*free_data)(char *data)) {
-  free_data(node->data);
-  if (node->left) scg_node_destroy(node->left, free_data);
-  if (node->right) scg_node_destroy(node->right, free_data);
-  free(node);
+static void scg_destroy_db(kvds_db *_db) {
+  scg_db *db = _db;
+  kvds_ebr_limbo_release(&db->limbo);
+  kvds_hash_index_release(&db->index);
+  kvds_value_arena_release(&db->values);
+  kvds_arena_release(&db->nodes);
+  free(db);
 }
 
-static void scg_destroy_db(kvds_db *_db, void (*free_data)(char *data)) {
+static void scg_reclaim_node(void *_db, void *node) {
   scg_db *db = _db;
-  if (db->top) scg_node_destroy(db->top, free_data);
-  free(db);
+  kvds_arena_free(&db->nodes, node);
 }
 
-static scg_node *scg_node_locate(scg_db *db, long long key) {
-  scg_node *best = db->top;
+static void scg_reclaim_node_and_value(void *_db, void *_node) {
+  scg_db *db = _db;
+  scg_node *node = _node;
+  kvds_value_clear(&db->values, &node->value);
+  kvds_arena_free(&db->nodes, node);
+}
 
+static scg_node *scg_node_descend(scg_node *best, long long key) {
+  int visits = 1;
   while (best != NULL && best->key != key) {
-    if (key < best->key) {
-      if (best->left == NULL) break;
-      best = best->left;
-    } else { // key < best->key
-      if (best->right == NULL) break;
-      best = best->right;
-    }
+    scg_node *next = key < best->key ? KVDS_LOAD(best->left) : KVDS_LOAD(best->right);
+    if (next == NULL) break;
+    best = next;
+    visits++;
   }
+  kvds_stats_count(KVDS_STAT_NODE_VISITS, best != NULL ? visits : 0);
 
   return best;
 }
+
+static scg_node *scg_node_locate(scg_db *db, long long key) {
+  return scg_node_descend(KVDS_LOAD(db->top), key);
+}
+
+// The node holding the key, or NULL if the index doesn't have it (or a reader raced with the writer); misses still need an ordered search to find where the key would be
+static scg_node *scg_node_lookup(scg_db *db, long long key) {
+  if (!SCG_HASH_INDEX) {
+    return NULL;
+  }
+  scg_node *node = kvds_hash_index_get(&db->index, key);
+  return node != NULL && node->key == key ? node : NULL;
+}
+
+// Finger search: finds the same node as scg_node_locate, but climbs from a node close to the key to the lowest ancestor whose subtree the key falls in, and only descends from there; O(log d) for a key d entries away
+// The bounds of a subtree are the keys of the closest ancestors it is right/left of, which are the first ones met on the way up
+// Returns NULL if the key is too far away to be found within SCG_FINGER_CLIMB levels (or only from the root), leaving the search to the caller
+static scg_node *scg_node_locate_from(scg_node *node, long long key) {
+  long long low, high;
+  bool has_low = false;
+  bool has_high = false;
+
+  int climbed = 0;
+  for (; node->key != key; climbed++) {
+    if (key < node->key ? has_low && low < key : has_high && key < high) {
+      break; // The key is in the subtree under node
+    }
+    scg_node *parent = KVDS_LOAD(node->parent);
+    if (parent == NULL || climbed == SCG_FINGER_CLIMB) {
+      kvds_stats_count(KVDS_STAT_NODE_VISITS, climbed);
+      return NULL; // Far away; climbing the rest of the way would only double the work
+    }
+    if (parent->key < node->key) {
+      if (!has_low) low = parent->key, has_low = true;
+    } else {
+      if (!has_high) high = parent->key, has_high = true;
+    }
+    node = parent;
+  }
+
+  kvds_stats_count(KVDS_STAT_NODE_VISITS, climbed); // The node the descent starts from is counted there
+  return scg_node_descend(node, key);
+}
+// The parent checks compare keys rather than node identities, so that a reader still holding a node the writer has since replaced with a copy walks out of it the right way
 static scg_node *scg_node_navigate_left(scg_node *node) {
-  if (node->left) { // descend left if we can
-    scg_node *result = node->left;
-    while (result->right != NULL) result = result->right;
+  scg_node *result = KVDS_LOAD(node->left);
+  if (result != NULL) { // descend left if we can
+    for (scg_node *next; (next = KVDS_LOAD(result->right)) != NULL;) result = next;
     return result;
   } else {
-    while (node->parent != NULL) {
-      if (node->parent->right == node) { // We were right of that parent, meaning it's left of us
-        return node->parent;
+    for (scg_node *parent; (parent = KVDS_LOAD(node->parent)) != NULL; node = parent) {
+      if (parent->key < node->key) { // We were right of that parent, meaning it's left of us
+        return parent;
       }
-      node = node->parent;
     }
     return NULL;
   }
 }
 static scg_node *scg_node_navigate_right(scg_node *node) {
-  if (node->right) { // descend right if we can
-    scg_node *result = node->right;
-    while (result->left != NULL) result = result->left;
+  scg_node *result = KVDS_LOAD(node->right);
+  if (result != NULL) { // descend right if we can
+    for (scg_node *next; (next = KVDS_LOAD(result->left)) != NULL;) result = next;
     return result;
   } else {
-    while (node->parent != NULL) {
-      if (node->parent->left == node) { // We were left of that parent, meaning it's right of us
-        return node->parent;
+    for (scg_node *parent; (parent = KVDS_LOAD(node->parent)) != NULL; node = parent) {
+      if (parent->key > node->key) { // We were left of that parent, meaning it's right of us
+        return parent;
       }
-      node = node->parent;
     }
     return NULL;
   }
@@ -177,7 +267,13 @@ static kvds_cursor *scg_create_cursor(kvds_db *_db, long long key) {
   scg_cursor *cursor = malloc(sizeof(scg_cursor));
 
   cursor->key = key;
-  cursor->best = scg_node_locate(db, key);
+  cursor->generation = kvds_ebr_generation(&db->limbo);
+  cursor->skip_climbs = 0;
+  cursor->backoff = 0;
+  cursor->best = scg_node_lookup(db, key);
+  if (cursor->best == NULL) {
+    cursor->best = scg_node_locate(db, key);
+  }
 
   return cursor;
 }
@@ -186,8 +282,28 @@ static void scg_move_cursor(kvds_db *_db, kvds_cursor *_cursor, long long key) {
   scg_db *db = _db;
   scg_cursor *cursor = _cursor;
 
+  unsigned long long generation = kvds_ebr_generation(&db->limbo);
   cursor->key = key;
-  cursor->best = scg_node_locate(db, key);
+  scg_node *found = NULL;
+  if (cursor->skip_climbs > 0) {
+    cursor->skip_climbs--;
+  } else if (cursor->best != NULL && cursor->generation == generation) {
+    found = scg_node_locate_from(cursor->best, key); // Assume that we are moving to a close-by node
+    if (found != NULL) {
+      cursor->backoff = 0;
+    } else {
+      cursor->backoff = cursor->backoff == 0 ? 1 : cursor->backoff < SCG_FINGER_BACKOFF ? cursor->backoff * 2 : SCG_FINGER_BACKOFF;
+      cursor->skip_climbs = cursor->backoff;
+    }
+  }
+  if (found == NULL) {
+    found = scg_node_lookup(db, key); // Only probe the index when not climbing, as nearby moves are cheaper than the probe's cache miss
+  }
+  if (found == NULL) {
+    found = scg_node_locate(db, key);
+  }
+  cursor->best = found;
+  cursor->generation = generation;
 }
 
 static void scg_destroy_cursor(kvds_db *_db, kvds_cursor *_cursor) {
@@ -211,111 +327,162 @@ static bool scg_exists(kvds_db *_db, kvds_cursor *_cursor) {
   return cursor->best != NULL && cursor->best->key == cursor->key;
 }
 
-static void scg_node_detach(scg_db *db, scg_node *node, bool update_size) {
-  if (node->parent == NULL) {
-    assert(db->top == node);
-    db->top = NULL;
-  } else if (node->parent->left == node) {
-    node->parent->left = NULL;
-  } else if (node->parent->right == node) {
-    node->parent->right = NULL;
+// Points whatever pointed at old (its parent's link, or the top of the tree) at replacement instead, in a single store that readers see either side of
+static void scg_node_relink(scg_db *db, scg_node *parent, scg_node *old, scg_node *replacement) {
+  if (parent == NULL) {
+    assert(db->top == old);
+    KVDS_PUBLISH(db->top, replacement);
+  } else if (parent->left == old) {
+    KVDS_PUBLISH(parent->left, replacement);
   } else {
-    assert(false);
+    assert(parent->right == old);
+    KVDS_PUBLISH(parent->right, replacement);
   }
-  if (update_size) {
-    for (scg_node *old_parent = node->parent; old_parent != NULL; old_parent = old_parent->parent) {
-      old_parent->size -= node->size;
-    }
-  }
-  node->parent = NULL;
 }
-static void scg_node_attach(scg_db *db, scg_node *node, scg_node *parent, bool on_left, bool update_size) {
+static void scg_node_attach(scg_db *db, scg_node *node, scg_node *parent, bool on_left) {
   assert(node->parent == NULL);
   node->parent = parent;
 
-  if (node->parent == NULL) {
-    assert(db != NULL && db->top == NULL);
-    db->top = node;
+  if (parent == NULL) {
+    assert(db->top == NULL);
+    KVDS_PUBLISH(db->top, node);
   } else if (on_left) {
     assert(parent->left == NULL);
-    node->parent->left = node;
+    KVDS_PUBLISH(parent->left, node);
   } else {
     assert(parent->right == NULL);
-    node->parent->right = node;
+    KVDS_PUBLISH(parent->right, node);
   }
-  if (update_size) {
-    for (scg_node *new_parent = node->parent; new_parent != NULL; new_parent = new_parent->parent) {
-      assert(new_parent != node);
-      new_parent->size += node->size;
-    }
+  for (scg_node *new_parent = parent; new_parent != NULL; new_parent = new_parent->parent) {
+    new_parent->size += node->size;
   }
 }
-static scg_node *scg_node_rotate(scg_db *db, scg_node *node) {
-  assert(node->parent != NULL);
-  scg_node *parent = node->parent;
-  bool is_left = parent->left == node;
-  scg_node *parent_other = is_left ? parent->right : parent->left;
-  scg_node *middle = is_left ? node->right : node->left;
-  scg_node *parent_old_loc = parent->parent;
-  bool parent_old_is_left = scg_is_left(parent);
-
-  scg_node_detach(db, parent, true);
-  scg_node_detach(db, node, true);
-  if (middle != NULL) scg_node_detach(db, middle, true);
-
-  scg_node_attach(db, parent, node, !is_left, true);
-  scg_node_attach(db, node, parent_old_loc, parent_old_is_left, true);
-  if (middle != NULL) scg_node_attach(db, middle, parent, is_left, true);
-  return node;
+// Makes a copy of node to be published in its place, leaving the original untouched for readers that are still on it
+static scg_node *scg_node_copy(scg_db *db, scg_node *node) {
+  scg_node *copy = kvds_arena_alloc(&db->nodes);
+  *copy = *node;
+  return copy;
+}
+// Points the children of a node that replaced another one back at it
+static void scg_node_adopt_children(scg_node *node) {
+  if (node->left != NULL) KVDS_PUBLISH(node->left->parent, node);
+  if (node->right != NULL) KVDS_PUBLISH(node->right->parent, node);
 }
 
-static void _scg_node_recreate_collect(scg_node *node, scg_node ***nodes_i_p) {
-  if (node != NULL) {
-    scg_node *left_to_process = node->left;
-    scg_node *right_to_process = node->right;
-    _scg_node_recreate_collect(left_to_process, nodes_i_p);
-    // Process nodes in order:
-
-    **nodes_i_p = node;
-    (*nodes_i_p)++;
-
-    _scg_node_recreate_collect(right_to_process, nodes_i_p);
+// Flattens a subtree into a list linked through ->right, in order, and returns its lowest node
+static scg_node *scg_node_flatten(scg_node *root, int size) {
+  // Walk the subtree in order, linking each visited node to its predecessor through ->left;
+  // the walk never reads the ->left of a node it has already visited, so that is safe to overwrite
+  scg_node *node = root;
+  while (node->left != NULL) node = node->left;
+  scg_node *last = NULL;
+  for (int i = 0; i < size; i++) {
+    scg_node *next = i + 1 < size ? scg_node_navigate_right(node) : NULL; // Never walks out of the subtree
+    node->left = last;
+    last = node;
+    node = next;
   }
-}
-static scg_node *_scg_node_recreate_reparent(scg_node **nodes, int count, scg_node *parent) {
-  if (count == 0) {
-    return NULL;
+  // Then walk back, turning it into a forward list
+  scg_node *first = NULL;
+  for (node = last; node != NULL; node = node->left) {
+    node->right = first;
+    first = node;
   }
-  scg_node *median = nodes[count / 2];
-
-  median->left = _scg_node_recreate_reparent(nodes, count / 2, median);
-  median->right = _scg_node_recreate_reparent(&nodes[count / 2] + 1, (count - 1) / 2, median);
-  median->parent = parent;
-  median->size = 1 + scg_get_size(median->left) + scg_get_size(median->right);
+  return first;
+}
 
-  return median;
+// Builds a perfectly balanced tree out of the first count nodes of a list linked through ->right, advancing *list past them
+// The median of every subtree becomes its root, just like a recursive median split would do, but the recursion is replaced by an explicit stack of O(log n) frames
+static scg_node *scg_node_build(scg_node **list, int count) {
+  struct {
+    scg_node *median; // NULL while the left subtree is still being built
+    int count;
+  } stack[sizeof(int) * CHAR_BIT];
+  int depth = 0;
+
+  while (true) {
+    // Descend into the left subtrees until there are no more nodes left for them
+    while (count > 0) {
+      stack[depth].median = NULL;
+      stack[depth].count = count;
+      depth++;
+      count = count / 2;
+    }
+    scg_node *subtree = NULL;
+    // Go back up while we are completing right subtrees
+    while (depth > 0 && stack[depth - 1].median != NULL) {
+      scg_node *median = stack[depth - 1].median;
+      median->right = subtree;
+      if (subtree != NULL) subtree->parent = median;
+      median->size = stack[depth - 1].count;
+      subtree = median;
+      depth--;
+    }
+    if (depth == 0) {
+      if (subtree != NULL) subtree->parent = NULL;
+      return subtree;
+    }
+    // Completed a left subtree; the next node in the list is its parent, after which comes the right subtree
+    scg_node *median = *list;
+    *list = median->right;
+    median->left = subtree;
+    if (subtree != NULL) subtree->parent = median;
+    stack[depth - 1].median = median;
+    count = (stack[depth - 1].count - 1) / 2;
+  }
 }
 
 static void scg_node_recreate(scg_db *db, scg_node *old_root, int size) {
-  scg_node *old_parent = old_root->parent;
-  bool old_parent_loc = scg_is_left(old_root);
-
-  scg_node_detach(db, old_root, false);
-
-  scg_node **nodes = malloc(size * sizeof(scg_node *));
-
-  scg_node **nodes_i = nodes;
-  _scg_node_recreate_collect(old_root, &nodes_i);
-  assert(&nodes[size] == nodes_i);
-
-  scg_node *new_root = _scg_node_recreate_reparent(nodes, size, NULL); // old_root
-
-  free(nodes);
+  kvds_stats_rebuild(size);
+  if (!db->shared) { // Nobody else is looking, so the nodes themselves are rearranged, without allocating anything
+    scg_node *parent = old_root->parent;
+    scg_node *list = scg_node_flatten(old_root, size);
+    scg_node *new_root = scg_node_build(&list, size);
+    assert(list == NULL);
+    new_root->parent = parent;
+    scg_node_relink(db, parent, old_root, new_root);
+    return;
+  }
+  // Readers may be walking the old subtree, so the balanced one is built out of copies of its nodes, and swapped in with a single store
+  scg_node *first = NULL;
+  scg_node *last = NULL;
+  scg_node *old_first = old_root;
+  while (old_first->left != NULL) old_first = old_first->left;
+  scg_node *node = old_first;
+  for (int i = 0; i < size; i++) {
+    scg_node *copy = scg_node_copy(db, node); // The copy takes over the value
+    copy->right = NULL;
+    if (last != NULL) {
+      last->right = copy;
+    } else {
+      first = copy;
+    }
+    last = copy;
+    node = i + 1 < size ? scg_node_navigate_right(node) : NULL; // Never walks out of the subtree
+  }
 
-  scg_node_attach(db, new_root, old_parent, old_parent_loc, false);
+  scg_node *new_root = scg_node_build(&first, size);
+  assert(first == NULL);
+
+  new_root->parent = old_root->parent;
+  scg_node_relink(db, old_root->parent, old_root, new_root);
+
+  // Only retire the old nodes once they are unreachable, from the index too, so that a reader that got to one can tell from the generation
+  scg_node *copy = new_root;
+  while (copy->left != NULL) copy = copy->left;
+  node = old_first;
+  for (int i = 0; i < size; i++) {
+    scg_node *next_copy = i + 1 < size ? scg_node_navigate_right(copy) : NULL;
+    scg_node *next = i + 1 < size ? scg_node_navigate_right(node) : NULL;
+    if (SCG_HASH_INDEX) kvds_hash_index_set(&db->index, copy->key, copy);
+    kvds_ebr_retire(&db->limbo, node, scg_reclaim_node);
+    copy = next_copy;
+    node = next;
+  }
 }
 
-static void scg_node_rebalance_from(scg_db *db, scg_node *node) {
+// Returns whether a subtree had to be rebuilt, which leaves any node pointers into it pointing at retired copies
+static bool scg_node_rebalance_from(scg_db *db, scg_node *node) {
   // Using the general algorithm for a Scrapegoat tree via https://en.wikipedia.org/wiki/Scapegoat_tree
   // After plenty of sweat and tears trying to come up with something more efficient on my own
   scg_node *to_recreate = NULL;
@@ -324,111 +491,143 @@ static void scg_node_rebalance_from(scg_db *db, scg_node *node) {
     int right_size = scg_get_size(node->right);
     int node_size = scg_get_size(node);
 
-    if (left_size > node_size * SCG_SCAPEGOAT_FACTOR || right_size > node_size * SCG_SCAPEGOAT_FACTOR) {
+    if ((long long)left_size * SCG_BALANCE_ONE > node_size * db->balance || (long long)right_size * SCG_BALANCE_ONE > node_size * db->balance) {
       to_recreate = node;
     }
   }
   if (to_recreate != NULL) {
     scg_node_recreate(db, to_recreate, scg_get_size(to_recreate));
+    return true;
   }
+  return false;
 }
 
-static char *scg_write(kvds_db *_db, kvds_cursor *_cursor, char *data) {
+static void scg_write(kvds_db *_db, kvds_cursor *_cursor, const kvds_value *value) {
   scg_db *db = _db;
   scg_cursor *cursor = _cursor;
 
-  if (cursor->best != NULL && cursor->best->key == cursor->key) { // Special case: already exists
-    char *old_data = cursor->best->data;
-    cursor->best->data = data;
-    return old_data;
+  if (cursor->best != NULL && cursor->best->key == cursor->key && !db->shared) { // Special case: already exists
+    kvds_value_replace(&db->values, &cursor->best->value, value);
+    return;
+  }
+  if (cursor->best != NULL && cursor->best->key == cursor->key) { // Same, but replace the whole node, so that readers never see a value that's half-written
+    scg_node *old_node = cursor->best;
+    scg_node *new_node = scg_node_copy(db, old_node);
+    kvds_value_store(&db->values, &new_node->value, value);
+    scg_node_relink(db, old_node->parent, old_node, new_node);
+    scg_node_adopt_children(new_node);
+    if (SCG_HASH_INDEX) kvds_hash_index_set(&db->index, new_node->key, new_node);
+    kvds_ebr_retire(&db->limbo, old_node, scg_reclaim_node_and_value);
+    cursor->best = new_node;
+    cursor->generation = kvds_ebr_generation(&db->limbo);
+    kvds_ebr_collect(&db->limbo);
+    return;
   }
 
-  scg_node *new_node = malloc(sizeof(scg_node));
+  scg_node *new_node = kvds_arena_alloc(&db->nodes);
 
-  new_node->data = data;
+  kvds_value_store(&db->values, &new_node->value, value);
   new_node->key = cursor->key;
   new_node->left = NULL;
   new_node->right = NULL;
   new_node->parent = NULL;
   new_node->size = 1;
 
-  scg_node_attach(db, new_node, cursor->best, (cursor->best && new_node->key < cursor->best->key), true);
-  scg_node_rebalance_from(db, new_node);
-
-  cursor->best = new_node;
+  scg_node_attach(db, new_node, cursor->best, (cursor->best && new_node->key < cursor->best->key));
+  if (SCG_HASH_INDEX) kvds_hash_index_put(&db->index, new_node->key, new_node);
+  if (scg_node_rebalance_from(db, new_node)) {
+    cursor->best = scg_node_locate(db, cursor->key);
+  } else {
+    cursor->best = new_node;
+  }
+  cursor->generation = kvds_ebr_generation(&db->limbo);
+  kvds_ebr_collect(&db->limbo);
 
   scg_assert_invariants(db);
-  return NULL;
 }
 
-static char *scg_read(kvds_db *_db, kvds_cursor *_cursor) {
+static const kvds_value *scg_read(kvds_db *_db, kvds_cursor *_cursor) {
   scg_db *db = _db;
   scg_cursor *cursor = _cursor;
 
   if (cursor->best != NULL && cursor->best->key == cursor->key) { // The node exists
-    return cursor->best->data;
+    return &cursor->best->value;
   } else {
     return NULL;
   }
 }
 
-static char *scg_remove(kvds_db *_db, kvds_cursor *_cursor) {
+static bool scg_remove(kvds_db *_db, kvds_cursor *_cursor) {
   scg_db *db = _db;
   scg_cursor *cursor = _cursor;
 
   if (cursor->best == NULL || cursor->best->key != cursor->key) {
-    return NULL;
+    return false;
+  }
+  scg_node *node = cursor->best;
+  scg_node *rebalance_from;
+
+  if (node->left == NULL || node->right == NULL) {
+    // Splice the node out, moving its only child (if any) up in its place
+    scg_node *child = node->left != NULL ? node->left : node->right;
+    if (child != NULL) KVDS_PUBLISH(child->parent, node->parent);
+    scg_node_relink(db, node->parent, node, child);
+    for (scg_node *parent = node->parent; parent != NULL; parent = parent->parent) {
+      parent->size--;
+    }
+    rebalance_from = node->parent;
   } else {
-    char *data = cursor->best->data;
-    scg_node *node = cursor->best;
-    scg_node *swap_node = NULL;
-    if (node->left == NULL && node->right == NULL) {
-      // YAY!
-    } else if (scg_get_size(node->right) > scg_get_size(node->left)) { // Swap with a node from the side that's heavier
-      assert(node->right != NULL);
-      swap_node = node->right;
+    // Replace the node with a copy of its in-order neighbour from the heavier side, without the neighbour underneath
+    // Readers still on the original node may be on their way down to the neighbour, so the whole path down to it is copied, rather than changed in place
+    bool from_right = scg_get_size(node->right) > scg_get_size(node->left);
+    scg_node *swap_node = from_right ? node->right : node->left;
+    if (from_right) {
       while (swap_node->left != NULL) swap_node = swap_node->left;
-      if (swap_node->right != NULL) {
-        scg_node_rotate(db, swap_node->right);
-      }
     } else {
-      assert(node->left != NULL);
-      swap_node = node->left;
       while (swap_node->right != NULL) swap_node = swap_node->right;
-      if (swap_node->left != NULL) {
-        scg_node_rotate(db, swap_node->left);
-      }
     }
-    scg_node *old_parent = node->parent;
-    bool old_was_left = scg_is_left(node);
-
-    scg_node_detach(db, node, true);
+    scg_node *swap_child = from_right ? swap_node->right : swap_node->left;
+    for (scg_node *parent = swap_node->parent; parent != NULL; parent = parent->parent) {
+      parent->size--;
+    }
 
-    if (swap_node != NULL) {
-      scg_node *node_left = node->left;
-      scg_node *node_right = node->right;
-      if (node_left != NULL) scg_node_detach(db, node_left, true);
-      if (node_right != NULL) scg_node_detach(db, node_right, true);
+    scg_node *copy = scg_node_copy(db, node);
+    copy->key = swap_node->key;
+    copy->value = swap_node->value; // Taken over from the neighbour, which gets retired without it
+    scg_node *last = copy;
+    scg_node **link = from_right ? &copy->right : &copy->left;
+    for (scg_node *original = *link; original != swap_node; original = from_right ? original->left : original->right) {
+      scg_node *original_copy = scg_node_copy(db, original);
+      original_copy->parent = last;
+      *link = original_copy;
+      link = from_right ? &original_copy->left : &original_copy->right;
+      last = original_copy;
+    }
+    *link = swap_child;
+    scg_node_relink(db, node->parent, node, copy);
 
-      scg_node *rebalance_from = swap_node;
-      if (node_left != swap_node && node_right != swap_node) {
-        rebalance_from = swap_node->parent;
-        scg_node_detach(db, swap_node, true);
-      }
+    for (scg_node *path = last; path != copy->parent; path = path->parent) {
+      scg_node_adopt_children(path);
+      if (SCG_HASH_INDEX) kvds_hash_index_set(&db->index, path->key, path);
+    }
+    for (scg_node *original = from_right ? node->right : node->left; original != swap_node; original = from_right ? original->left : original->right) {
+      kvds_ebr_retire(&db->limbo, original, scg_reclaim_node);
+    }
+    kvds_ebr_retire(&db->limbo, swap_node, scg_reclaim_node);
+    rebalance_from = last;
+  }
+  if (SCG_HASH_INDEX) kvds_hash_index_remove(&db->index, node->key);
+  kvds_ebr_retire(&db->limbo, node, scg_reclaim_node_and_value);
 
-      if (node_left != swap_node && node_left != NULL) scg_node_attach(db, node_left, swap_node, true, true);
-      if (node_right != swap_node && node_right != NULL) scg_node_attach(db, node_right, swap_node, false, true);
-      scg_node_attach(db, swap_node, old_parent, old_was_left, true);
+  scg_node_rebalance_from(db, rebalance_from);
 
-      scg_node_rebalance_from(db, rebalance_from);
-    } else {
-      scg_node_rebalance_from(db, old_parent);
-    }
+  cursor->best = scg_node_locate(db, cursor->key);
+  cursor->generation = kvds_ebr_generation(&db->limbo);
+  kvds_ebr_collect(&db->limbo);
 
-    cursor->best = scg_node_locate(db, cursor->key);
+  scg_assert_invariants(db);
 
-    return data;
-  }
+  return true;
 }
 
 static void scg_snap(kvds_db *_db, kvds_cursor *_cursor, enum kvds_snap_direction dir) {
@@ -472,7 +671,7 @@ static void scg_snap(kvds_db *_db, kvds_cursor *_cursor, enum kvds_snap_directio
         right = scg_node_navigate_right(cursor->best);
       }
       if (left != NULL && right != NULL) { // Not past the edge
-        if (cursor->key - left->key <= right->key - cursor->key) {
+        if ((unsigned long long)cursor->key - left->key <= (unsigned long long)right->key - cursor->key) {
           cursor->best = left;
         } else {
           cursor->best = right;
@@ -486,6 +685,180 @@ static void scg_snap(kvds_db *_db, kvds_cursor *_cursor, enum kvds_snap_directio
   }
 }
 
+// Number of keys below key (or up to and including it), adding up the sizes of the subtrees left of the path down to it
+static long long scg_node_rank(scg_db *db, long long key, bool inclusive) {
+  long long rank = 0;
+  for (scg_node *node = db->top; node != NULL;) {
+    if (key < node->key || (key == node->key && !inclusive)) {
+      node = node->left;
+    } else {
+      rank += scg_get_size(node->left) + 1;
+      node = node->right;
+    }
+  }
+  return rank;
+}
+
+static long long scg_rank(kvds_db *_db, kvds_cursor *_cursor) {
+  scg_db *db = _db;
+  scg_cursor *cursor = _cursor;
+
+  return scg_node_rank(db, cursor->key, false);
+}
+
+static void scg_nth(kvds_db *_db, kvds_cursor *_cursor, long long index) {
+  scg_db *db = _db;
+  scg_cursor *cursor = _cursor;
+
+  scg_node *node = db->top;
+  if (node == NULL) {
+    return;
+  }
+  if (index < 0) {
+    index = 0;
+  } else if (index >= node->size) {
+    index = node->size - 1;
+  }
+
+  for (;;) {
+    int left_size = scg_get_size(node->left);
+    if (index < left_size) {
+      node = node->left;
+    } else if (index > left_size) {
+      index -= left_size + 1;
+      node = node->right;
+    } else {
+      break;
+    }
+  }
+
+  cursor->key = node->key;
+  cursor->best = node;
+  cursor->generation = kvds_ebr_generation(&db->limbo);
+}
+
+static long long scg_count(kvds_db *_db, long long from, long long to) {
+  scg_db *db = _db;
+
+  if (from > to) {
+    return 0;
+  }
+  return scg_node_rank(db, to, true) - scg_node_rank(db, from, false);
+}
+
+// Explicit stack for in-order traversals; starts out on the caller's stack and only moves to the heap for unusually tall trees
+typedef struct scg_stack {
+  scg_node **nodes;
+  int depth;
+  int capacity;
+  scg_node *local[64];
+} scg_stack;
+
+static void scg_stack_push(scg_stack *stack, scg_node *node) {
+  if (stack->depth == stack->capacity) {
+    stack->capacity *= 2;
+    if (stack->nodes == stack->local) {
+      stack->nodes = malloc(stack->capacity * sizeof(scg_node *));
+      memcpy(stack->nodes, stack->local, sizeof stack->local);
+    } else {
+      stack->nodes = realloc(stack->nodes, stack->capacity * sizeof(scg_node *));
+    }
+  }
+  stack->nodes[stack->depth++] = node;
+}
+
+static void scg_iterate(kvds_db *_db, kvds_cursor *_cursor, long long to, bool (*callback)(void *context, long long key, const kvds_value *value), void *context) {
+  scg_db *db = _db;
+  scg_cursor *cursor = _cursor;
+
+  // Keep the ancestors we still have to visit on a stack, instead of walking up the parent pointers after each node
+  scg_stack stack;
+  stack.nodes = stack.local;
+  stack.depth = 0;
+  stack.capacity = sizeof stack.local / sizeof stack.local[0];
+
+  for (scg_node *node = KVDS_LOAD(db->top); node != NULL;) {
+    if (node->key >= cursor->key) {
+      scg_stack_push(&stack, node);
+      node = KVDS_LOAD(node->left);
+    } else {
+      node = KVDS_LOAD(node->right);
+    }
+  }
+
+  while (stack.depth > 0) {
+    scg_node *node = stack.nodes[--stack.depth];
+    if (node->key > to || !callback(context, node->key, &node->value)) {
+      break;
+    }
+    for (scg_node *next = KVDS_LOAD(node->right); next != NULL; next = KVDS_LOAD(next->left)) {
+      scg_stack_push(&stack, next);
+    }
+  }
+
+  if (stack.nodes != stack.local) {
+    free(stack.nodes);
+  }
+}
+
+static void scg_bulk_load(kvds_db *_db, bool (*next)(void *context, long long *key, kvds_value *value), void *context) {
+  scg_db *db = _db;
+  assert(db->top == NULL);
+
+  // Chain the nodes through ->right as they come in, then build the tree out of them just like scg_node_recreate does
+  scg_node *first = NULL;
+  scg_node *last = NULL;
+  int count = 0;
+
+  long long key;
+  kvds_value value;
+  while (next(context, &key, &value)) {
+    assert(last == NULL || last->key < key);
+    scg_node *node = kvds_arena_alloc(&db->nodes);
+    node->key = key;
+    kvds_value_store(&db->values, &node->value, &value);
+    node->left = NULL;
+    node->right = NULL;
+    node->parent = NULL;
+    node->size = 1;
+
+    if (last != NULL) {
+      last->right = node;
+    } else {
+      first = node;
+    }
+    last = node;
+    count++;
+  }
+
+  KVDS_PUBLISH(db->top, scg_node_build(&first, count));
+  if (SCG_HASH_INDEX && count > 0) {
+    scg_node *node = db->top;
+    while (node->left != NULL) node = node->left;
+    for (; node != NULL; node = scg_node_navigate_right(node)) {
+      kvds_hash_index_put(&db->index, node->key, node);
+    }
+  }
+
+  scg_assert_invariants(db);
+}
+
+static long long scg_node_height(scg_node *node) {
+  if (node == NULL) {
+    return 0;
+  }
+  long long left_height = scg_node_height(node->left);
+  long long right_height = scg_node_height(node->right);
+  return 1 + (left_height > right_height ? left_height : right_height);
+}
+
+static void scg_shape(kvds_db *_db, long long *nodes, long long *height) {
+  scg_db *db = _db;
+
+  *nodes = scg_get_size(db->top);
+  *height = scg_node_height(db->top); // Balanced, so the recursion stays shallow
+}
+
 REGISTER("scapegoat", "scg", "Store entries in a scapegoat-balanced binary search tree.") = {
   .create_db = scg_create_db,
   .destroy_db = scg_destroy_db,
@@ -500,4 +873,11 @@ REGISTER("scapegoat", "scg", "Store entries in a scapegoat-balanced binary searc
   .write = scg_write,
   .read = scg_read,
   .remove = scg_remove,
+  .iterate = scg_iterate,
+  .bulk_load = scg_bulk_load,
+  .rank = scg_rank,
+  .nth = scg_nth,
+  .count = scg_count,
+  .shape = scg_shape,
+  .concurrent_readers = true,
 };
@@ -0,0 +1,773 @@
+// SPDX-License-Identifier: MIT
+#define _GNU_SOURCE // For pthread_setaffinity_np
+#include "../registry.h"
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef SHARD_COUNT
+#define SHARD_COUNT 4
+#endif
+#ifndef SHARD_ALGO
+#define SHARD_ALGO "scg"
+#endif
+
+#define SHARD_QUEUE_SIZE 1024 // Requests in flight per shard
+#define SHARD_INLINE 64 // Written values up to this long travel inside the request, longer ones get copied to the heap
+#define SHARD_SPIN 128 // Polls before yielding (or, for workers, going to sleep)
+#define SHARD_SAMPLE 1024 // Written keys sampled between rebalances
+#define SHARD_REBALANCE_FIRST 16 // Writes before the first rebalance; the gaps then double, up to SHARD_REBALANCE_INTERVAL
+#define SHARD_REBALANCE_INTERVAL 65536
+
+_Static_assert(SHARD_COUNT >= 1 && SHARD_COUNT <= 64, "shard_cursor.moved has one bit per shard");
+
+enum shard_op {
+  SHARD_WRITE,
+  SHARD_REMOVE,
+  SHARD_EXISTS,
+  SHARD_READ,
+  SHARD_SEEK,
+  SHARD_ITERATE,
+  SHARD_EXTRACT,
+  SHARD_INSERT,
+  SHARD_BULK_LOAD,
+  SHARD_RESET_CURSORS,
+  SHARD_DESTROY_CURSOR,
+  SHARD_STOP,
+};
+
+// Entries in transit between the caller and the workers, or from one worker to another
+typedef struct shard_batch {
+  long long *keys;
+  kvds_value *values;
+  long long count;
+  long long capacity;
+  kvds_value_arena storage;
+} shard_batch;
+
+typedef struct shard_request {
+  enum shard_op op;
+  struct shard_cursor *cursor;
+  long long key;
+  bool refresh; // The cursor was moved since it was last used in this shard, so its inner cursor has to be moved even if it's already on the key
+  union {
+    struct {
+      kvds_value value;
+      bool copied; // value points at a heap copy that the worker frees
+      char bytes[SHARD_INLINE];
+    } write;
+    struct {
+      enum kvds_snap_direction dir;
+      bool strict;
+    } seek;
+    struct {
+      long long to;
+      bool (*callback)(void *context, long long key, const kvds_value *value);
+      void *context;
+    } iterate;
+    struct {
+      long long to;
+      shard_batch *batch;
+    } extract; // Also used by SHARD_INSERT, without to
+    struct {
+      shard_batch *batch;
+      long long position;
+      long long end;
+    } bulk_load;
+  };
+} shard_request;
+
+typedef struct shard_reply {
+  bool found;
+  long long key;
+  const kvds_value *value;
+} shard_reply;
+
+// A single-producer single-consumer queue of requests into one worker, which owns one inner database
+// The caller's thread is the only producer, and waits for the queue to drain whenever it needs a reply
+typedef struct shard {
+  _Alignas(64) unsigned long long tail; // Written by the caller
+  _Alignas(64) unsigned long long head; // Written by the worker, once it is done with a request
+  bool sleeping;
+  pthread_mutex_t mutex;
+  pthread_cond_t wakeup;
+
+  _Alignas(64) int index;
+  struct shard_db *db;
+  struct kvds_database_algo *algo;
+  kvds_db *inner;
+  pthread_t thread;
+  shard_reply reply; // Of the last request that had one
+  shard_request requests[SHARD_QUEUE_SIZE];
+} shard;
+
+typedef struct shard_db {
+  int count;
+  shard *shards[SHARD_COUNT];
+  long long bounds[SHARD_COUNT]; // Lowest key of each shard; bounds[0] is always LLONG_MIN, and shards with the same bound as the next one are empty
+  struct shard_cursor *cursors; // All open cursors, so that their inner cursors can be reset after entries change shards
+
+  // Reservoir sample of the keys written since the last rebalance
+  long long sample[SHARD_SAMPLE];
+  long long sampled;
+  long long seen;
+  uint64_t random_state;
+  long long writes;
+  long long next_rebalance;
+} shard_db;
+
+typedef struct shard_cursor {
+  long long key;
+  uint64_t moved; // One bit per shard; see shard_request.refresh
+  struct shard_cursor *prev;
+  struct shard_cursor *next;
+  kvds_cursor *inner[SHARD_COUNT]; // Created by each worker when first needed, and only ever touched by it
+} shard_cursor;
+
+static void shard_backoff(int *spins) {
+  if (*spins < SHARD_SPIN) {
+    (*spins)++;
+  } else {
+    sched_yield();
+  }
+}
+
+static shard_request *shard_begin(shard_db *db, int index, enum shard_op op, shard_cursor *cursor, long long key) {
+  shard *shard = db->shards[index];
+  int spins = 0;
+  while (shard->tail - __atomic_load_n(&shard->head, __ATOMIC_ACQUIRE) == SHARD_QUEUE_SIZE) {
+    shard_backoff(&spins);
+  }
+  shard_request *request = &shard->requests[shard->tail % SHARD_QUEUE_SIZE];
+  request->op = op;
+  request->cursor = cursor;
+  request->key = key;
+  request->refresh = false;
+  if (cursor != NULL) {
+    request->refresh = (cursor->moved >> index) & 1;
+    cursor->moved &= ~(1ull << index);
+  }
+  return request;
+}
+
+static void shard_submit(shard_db *db, int index) {
+  shard *shard = db->shards[index];
+  // Pairs with the worker setting sleeping before checking tail one last time
+  __atomic_store_n(&shard->tail, shard->tail + 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&shard->sleeping, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&shard->mutex);
+    pthread_cond_signal(&shard->wakeup);
+    pthread_mutex_unlock(&shard->mutex);
+  }
+}
+
+static void shard_wait(shard_db *db, int index) {
+  shard *shard = db->shards[index];
+  int spins = 0;
+  while (__atomic_load_n(&shard->head, __ATOMIC_ACQUIRE) != shard->tail) {
+    shard_backoff(&spins);
+  }
+}
+
+static shard_reply *shard_call(shard_db *db, int index) {
+  shard_submit(db, index);
+  shard_wait(db, index);
+  return &db->shards[index]->reply;
+}
+
+static int shard_route(shard_db *db, long long key) {
+  int low = 0;
+  int high = db->count - 1;
+  while (low < high) { // Last shard whose bound is at most key
+    int middle = (low + high + 1) / 2;
+    if (db->bounds[middle] <= key) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
+  }
+  return low;
+}
+
+static long long shard_upper(shard_db *db, const long long *bounds, int index) { // Highest key of a shard, or lower than its bound if it's empty
+  return index + 1 < db->count ? bounds[index + 1] - 1 : LLONG_MAX; // Only the first bound is ever LLONG_MIN
+}
+
+static void shard_batch_init(shard_batch *batch) {
+  batch->keys = NULL;
+  batch->values = NULL;
+  batch->count = 0;
+  batch->capacity = 0;
+  kvds_value_arena_init(&batch->storage, KVDS_ALLOCATOR_DEFAULT); // Only holds values on their way to a shard
+}
+
+static void shard_batch_release(shard_batch *batch) {
+  free(batch->keys);
+  free(batch->values);
+  kvds_value_arena_release(&batch->storage);
+}
+
+static bool shard_batch_add(void *_batch, long long key, const kvds_value *value) {
+  shard_batch *batch = _batch;
+  if (batch->count == batch->capacity) {
+    batch->capacity = batch->capacity == 0 ? 64 : batch->capacity * 2;
+    batch->keys = realloc(batch->keys, batch->capacity * sizeof(long long));
+    batch->values = realloc(batch->values, batch->capacity * sizeof(kvds_value));
+  }
+  batch->keys[batch->count] = key;
+  kvds_value_store(&batch->storage, &batch->values[batch->count], value);
+  batch->count++;
+  return true;
+}
+
+// Worker side
+
+static kvds_cursor *shard_position(shard *shard, shard_request *request) {
+  kvds_cursor **inner = &request->cursor->inner[shard->index];
+  if (*inner == NULL) {
+    *inner = shard->algo->create_cursor(shard->inner, request->key);
+  } else if (request->refresh || shard->algo->key(shard->inner, *inner) != request->key) {
+    shard->algo->move_cursor(shard->inner, *inner, request->key);
+  }
+  return *inner;
+}
+
+typedef struct shard_iterate_context {
+  bool (*callback)(void *context, long long key, const kvds_value *value);
+  void *context;
+  bool stopped;
+} shard_iterate_context;
+
+static bool shard_iterate_forward(void *_context, long long key, const kvds_value *value) {
+  shard_iterate_context *context = _context;
+  if (!context->callback(context->context, key, value)) {
+    context->stopped = true;
+    return false;
+  }
+  return true;
+}
+
+static bool shard_bulk_load_next(void *_request, long long *key, kvds_value *value) {
+  shard_request *request = _request;
+  if (request->bulk_load.position == request->bulk_load.end) {
+    return false;
+  }
+  *key = request->bulk_load.batch->keys[request->bulk_load.position];
+  *value = request->bulk_load.batch->values[request->bulk_load.position];
+  request->bulk_load.position++;
+  return true;
+}
+
+static void shard_execute(shard *shard, shard_request *request) {
+  struct kvds_database_algo *algo = shard->algo;
+  kvds_db *inner = shard->inner;
+  shard_reply *reply = &shard->reply;
+
+  switch (request->op) {
+  case SHARD_WRITE:
+    algo->write(inner, shard_position(shard, request), &request->write.value);
+    if (request->write.copied) {
+      free((char *)request->write.value.pointer);
+    }
+    break;
+  case SHARD_REMOVE:
+    reply->found = algo->remove(inner, shard_position(shard, request));
+    break;
+  case SHARD_EXISTS:
+    reply->found = algo->exists(inner, shard_position(shard, request));
+    break;
+  case SHARD_READ:
+    reply->value = algo->read(inner, shard_position(shard, request));
+    break;
+  case SHARD_SEEK: {
+    // Finds the nearest key in the given direction, or the key itself unless strict
+    kvds_cursor *cursor = shard_position(shard, request);
+    if (!request->seek.strict && algo->exists(inner, cursor)) {
+      reply->found = true;
+      reply->key = request->key;
+      break;
+    }
+    algo->snap(inner, cursor, request->seek.dir);
+    reply->key = algo->key(inner, cursor);
+    reply->found = algo->exists(inner, cursor) && (request->seek.dir == KVDS_SNAP_HIGHER ? reply->key > request->key : reply->key < request->key);
+  } break;
+  case SHARD_ITERATE: {
+    shard_iterate_context context = {
+      .callback = request->iterate.callback,
+      .context = request->iterate.context,
+      .stopped = false,
+    };
+    kvds_algo_iterate(algo, inner, shard_position(shard, request), request->iterate.to, shard_iterate_forward, &context);
+    reply->found = context.stopped;
+  } break;
+  case SHARD_EXTRACT: {
+    // Copies out and removes all entries from key to to, for another shard to take over
+    shard_batch *batch = request->extract.batch;
+    kvds_cursor *cursor = algo->create_cursor(inner, request->key);
+    kvds_algo_iterate(algo, inner, cursor, request->extract.to, shard_batch_add, batch);
+    for (long long i = 0; i < batch->count; i++) {
+      algo->move_cursor(inner, cursor, batch->keys[i]);
+      algo->remove(inner, cursor);
+    }
+    algo->destroy_cursor(inner, cursor);
+  } break;
+  case SHARD_INSERT: {
+    shard_batch *batch = request->extract.batch;
+    kvds_cursor *cursor = algo->create_cursor(inner, batch->count > 0 ? batch->keys[0] : 0);
+    for (long long i = 0; i < batch->count; i++) {
+      algo->move_cursor(inner, cursor, batch->keys[i]);
+      algo->write(inner, cursor, &batch->values[i]);
+    }
+    algo->destroy_cursor(inner, cursor);
+  } break;
+  case SHARD_BULK_LOAD:
+    if (algo->bulk_load != NULL) {
+      algo->bulk_load(inner, shard_bulk_load_next, request);
+    } else {
+      kvds_cursor *cursor = algo->create_cursor(inner, 0);
+      long long key;
+      kvds_value value;
+      while (shard_bulk_load_next(request, &key, &value)) {
+        algo->move_cursor(inner, cursor, key);
+        algo->write(inner, cursor, &value);
+      }
+      algo->destroy_cursor(inner, cursor);
+    }
+    break;
+  case SHARD_RESET_CURSORS:
+    for (shard_cursor *cursor = shard->db->cursors; cursor != NULL; cursor = cursor->next) {
+      if (cursor->inner[shard->index] != NULL) {
+        algo->destroy_cursor(inner, cursor->inner[shard->index]);
+        cursor->inner[shard->index] = NULL;
+      }
+    }
+    break;
+  case SHARD_DESTROY_CURSOR:
+    if (request->cursor->inner[shard->index] != NULL) {
+      algo->destroy_cursor(inner, request->cursor->inner[shard->index]);
+    }
+    break;
+  case SHARD_STOP:
+    break;
+  }
+}
+
+static void *shard_run(void *_shard) {
+  shard *shard = _shard;
+  unsigned long long head = shard->head;
+  while (true) {
+    int spins = 0;
+    while (__atomic_load_n(&shard->tail, __ATOMIC_ACQUIRE) == head) {
+      if (spins < SHARD_SPIN) {
+        spins++;
+        continue;
+      }
+      pthread_mutex_lock(&shard->mutex);
+      __atomic_store_n(&shard->sleeping, true, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&shard->tail, __ATOMIC_SEQ_CST) == head) {
+        pthread_cond_wait(&shard->wakeup, &shard->mutex);
+      }
+      __atomic_store_n(&shard->sleeping, false, __ATOMIC_RELAXED);
+      pthread_mutex_unlock(&shard->mutex);
+    }
+
+    shard_request *request = &shard->requests[head % SHARD_QUEUE_SIZE];
+    bool stop = request->op == SHARD_STOP;
+    shard_execute(shard, request);
+    head++;
+    __atomic_store_n(&shard->head, head, __ATOMIC_RELEASE);
+    if (stop) {
+      return NULL;
+    }
+  }
+}
+
+// Caller side
+
+static kvds_db *shard_create_db(const kvds_options *options) {
+  shard_db *db = malloc(sizeof(shard_db));
+  db->count = SHARD_COUNT;
+  db->cursors = NULL;
+  db->sampled = 0;
+  db->seen = 0;
+  db->random_state = 0x9e3779b97f4a7c15ull;
+  db->writes = 0;
+  db->next_rebalance = SHARD_REBALANCE_FIRST;
+
+  struct kvds_database_algo *algo = kvds_get_algo(SHARD_ALGO);
+  assert(algo != NULL && algo->create_db != shard_create_db);
+  kvds_options inner_options = *options;
+  inner_options.capacity = options->capacity / SHARD_COUNT; // Once rebalanced, every shard holds about as many keys
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  for (int i = 0; i < db->count; i++) {
+    db->bounds[i] = i == 0 ? LLONG_MIN : LLONG_MAX; // Everything starts out in the first shard, until the first rebalance
+    shard *shard = aligned_alloc(64, sizeof(*shard));
+    shard->tail = 0;
+    shard->head = 0;
+    shard->sleeping = false;
+    pthread_mutex_init(&shard->mutex, NULL);
+    pthread_cond_init(&shard->wakeup, NULL);
+    shard->index = i;
+    shard->db = db;
+    shard->algo = algo;
+    shard->inner = algo->create_db(&inner_options);
+    db->shards[i] = shard;
+
+    pthread_create(&shard->thread, NULL, shard_run, shard);
+    if (cpus > 1) { // Keep the first CPU for the caller
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET((i + 1) % cpus, &set);
+      pthread_setaffinity_np(shard->thread, sizeof(set), &set);
+    }
+  }
+  return db;
+}
+
+static void shard_destroy_db(kvds_db *_db) {
+  shard_db *db = _db;
+  for (int i = 0; i < db->count; i++) {
+    shard_begin(db, i, SHARD_STOP, NULL, 0);
+    shard_submit(db, i);
+  }
+  for (int i = 0; i < db->count; i++) {
+    shard *shard = db->shards[i];
+    pthread_join(shard->thread, NULL);
+    shard->algo->destroy_db(shard->inner);
+    pthread_mutex_destroy(&shard->mutex);
+    pthread_cond_destroy(&shard->wakeup);
+    free(shard);
+  }
+  free(db);
+}
+
+static void shard_reset_cursors(shard_db *db) {
+  for (int i = 0; i < db->count; i++) {
+    shard_begin(db, i, SHARD_RESET_CURSORS, NULL, 0);
+    shard_submit(db, i);
+  }
+  for (int i = 0; i < db->count; i++) {
+    shard_wait(db, i);
+  }
+}
+
+static int shard_compare_keys(const void *a, const void *b) {
+  long long x = *(const long long *)a;
+  long long y = *(const long long *)b;
+  return (x > y) - (x < y);
+}
+
+// Picks bounds that split the given sorted keys evenly; keys that repeat still go to a single shard
+static void shard_split(shard_db *db, const long long *keys, long long count, long long *bounds) {
+  bounds[0] = LLONG_MIN;
+  for (int i = 1; i < db->count; i++) {
+    long long bound = keys[count * i / db->count];
+    if (bound <= bounds[i - 1]) {
+      bound = bounds[i - 1] == LLONG_MAX ? LLONG_MAX : bounds[i - 1] + 1;
+    }
+    bounds[i] = bound;
+  }
+}
+
+static void shard_rebalance(shard_db *db) {
+  long long counts[SHARD_COUNT] = {0};
+  long long busiest = 0;
+  for (long long i = 0; i < db->sampled; i++) {
+    int index = shard_route(db, db->sample[i]);
+    counts[index]++;
+    if (counts[index] > busiest) busiest = counts[index];
+  }
+  bool unbalanced = db->count > 1 && busiest * db->count > db->sampled * 2; // Some shard gets over twice its fair share of the writes
+  if (unbalanced) {
+    qsort(db->sample, db->sampled, sizeof(long long), shard_compare_keys);
+    long long bounds[SHARD_COUNT];
+    shard_split(db, db->sample, db->sampled, bounds);
+
+    // Move every range that changes hands from its old shard to its new one
+    for (int to = 0; to < db->count; to++) {
+      long long low = bounds[to];
+      long long high = shard_upper(db, bounds, to);
+      if (high < low) continue;
+      for (int from = shard_route(db, low); from < db->count && db->bounds[from] <= high; from++) {
+        long long from_low = low > db->bounds[from] ? low : db->bounds[from];
+        long long from_high = high < shard_upper(db, db->bounds, from) ? high : shard_upper(db, db->bounds, from);
+        if (from == to || from_high < from_low) continue;
+
+        shard_batch batch;
+        shard_batch_init(&batch);
+        shard_request *request = shard_begin(db, from, SHARD_EXTRACT, NULL, from_low);
+        request->extract.to = from_high;
+        request->extract.batch = &batch;
+        shard_call(db, from);
+        request = shard_begin(db, to, SHARD_INSERT, NULL, 0);
+        request->extract.batch = &batch;
+        shard_call(db, to);
+        shard_batch_release(&batch);
+      }
+    }
+    memcpy(db->bounds, bounds, sizeof(bounds));
+    shard_reset_cursors(db); // Other cursors may have been left on entries that were moved away
+  }
+  db->sampled = 0;
+  db->seen = 0;
+}
+
+static kvds_cursor *shard_create_cursor(kvds_db *_db, long long key) {
+  shard_db *db = _db;
+  shard_cursor *cursor = malloc(sizeof(shard_cursor));
+
+  cursor->key = key;
+  cursor->moved = 0;
+  for (int i = 0; i < db->count; i++) {
+    cursor->inner[i] = NULL;
+  }
+  cursor->prev = NULL;
+  cursor->next = db->cursors;
+  if (db->cursors != NULL) {
+    db->cursors->prev = cursor;
+  }
+  db->cursors = cursor;
+
+  return cursor;
+}
+
+static void shard_move_cursor(kvds_db *_db, kvds_cursor *_cursor, long long key) {
+  shard_db *db = _db;
+  shard_cursor *cursor = _cursor;
+
+  cursor->key = key;
+  cursor->moved = ~0ull;
+}
+
+static void shard_destroy_cursor(kvds_db *_db, kvds_cursor *_cursor) {
+  shard_db *db = _db;
+  shard_cursor *cursor = _cursor;
+
+  for (int i = 0; i < db->count; i++) {
+    shard_begin(db, i, SHARD_DESTROY_CURSOR, cursor, 0);
+    shard_submit(db, i);
+  }
+  for (int i = 0; i < db->count; i++) {
+    shard_wait(db, i);
+  }
+
+  if (cursor->prev != NULL) {
+    cursor->prev->next = cursor->next;
+  } else {
+    db->cursors = cursor->next;
+  }
+  if (cursor->next != NULL) {
+    cursor->next->prev = cursor->prev;
+  }
+  free(cursor);
+}
+
+static long long shard_key(kvds_db *_db, kvds_cursor *_cursor) {
+  shard_db *db = _db;
+  shard_cursor *cursor = _cursor;
+
+  return cursor->key;
+}
+
+static bool shard_exists(kvds_db *_db, kvds_cursor *_cursor) {
+  shard_db *db = _db;
+  shard_cursor *cursor = _cursor;
+
+  int index = shard_route(db, cursor->key);
+  shard_begin(db, index, SHARD_EXISTS, cursor, cursor->key);
+  return shard_call(db, index)->found;
+}
+
+// Finds the nearest existing key in the given direction (or the key itself, unless strict), going on to the following shards while they come up empty
+static bool shard_seek(shard_db *db, shard_cursor *cursor, long long key, enum kvds_snap_direction dir, bool strict, long long *found) {
+  int step = dir == KVDS_SNAP_HIGHER ? 1 : -1;
+  for (int index = shard_route(db, key); index >= 0 && index < db->count; index += step) {
+    if (shard_upper(db, db->bounds, index) >= db->bounds[index]) { // Skip shards with an empty range
+      shard_request *request = shard_begin(db, index, SHARD_SEEK, cursor, key);
+      request->seek.dir = dir;
+      request->seek.strict = strict;
+      shard_reply *reply = shard_call(db, index);
+      if (reply->found) {
+        *found = reply->key;
+        return true;
+      }
+    }
+    // Any key in the following shards is past the one we started from
+    key = dir == KVDS_SNAP_HIGHER ? LLONG_MIN : LLONG_MAX;
+    strict = false;
+  }
+  return false;
+}
+
+static void shard_snap(kvds_db *_db, kvds_cursor *_cursor, enum kvds_snap_direction dir) {
+  shard_db *db = _db;
+  shard_cursor *cursor = _cursor;
+
+  // Past the last key in the given direction, the cursor ends up on the nearest key on the other side instead, just like in the inner algorithms
+  long long found;
+  switch (dir) {
+  case KVDS_SNAP_HIGHER:
+    if (shard_seek(db, cursor, cursor->key, KVDS_SNAP_HIGHER, true, &found) || shard_seek(db, cursor, cursor->key, KVDS_SNAP_LOWER, false, &found)) {
+      cursor->key = found;
+    }
+    break;
+  case KVDS_SNAP_LOWER:
+    if (shard_seek(db, cursor, cursor->key, KVDS_SNAP_LOWER, true, &found) || shard_seek(db, cursor, cursor->key, KVDS_SNAP_HIGHER, false, &found)) {
+      cursor->key = found;
+    }
+    break;
+  case KVDS_SNAP_CLOSEST_LOW: {
+    long long left;
+    long long right;
+    bool has_left = shard_seek(db, cursor, cursor->key, KVDS_SNAP_LOWER, false, &left);
+    if (has_left && left == cursor->key) {
+      break; // Already at closest
+    }
+    bool has_right = shard_seek(db, cursor, cursor->key, KVDS_SNAP_HIGHER, true, &right);
+    if (has_left && has_right) {
+      cursor->key = (unsigned long long)cursor->key - left <= (unsigned long long)right - cursor->key ? left : right;
+    } else if (has_left) {
+      cursor->key = left;
+    } else if (has_right) {
+      cursor->key = right;
+    }
+  } break;
+  }
+}
+
+static void shard_write(kvds_db *_db, kvds_cursor *_cursor, const kvds_value *value) {
+  shard_db *db = _db;
+  shard_cursor *cursor = _cursor;
+
+  // Doesn't wait for the worker; whatever the caller asks next of the same shard gets queued behind the write anyway
+  int index = shard_route(db, cursor->key);
+  shard_request *request = shard_begin(db, index, SHARD_WRITE, cursor, cursor->key);
+  request->write.copied = false;
+  if (value->kind == KVDS_VALUE_BORROWED) {
+    request->write.value = *value;
+  } else if (value->length <= SHARD_INLINE) {
+    memcpy(request->write.bytes, kvds_value_data(value), value->length);
+    request->write.value = kvds_value_wrap(request->write.bytes, value->length);
+  } else {
+    char *copy = malloc(value->length);
+    memcpy(copy, kvds_value_data(value), value->length);
+    request->write.value = kvds_value_wrap(copy, value->length);
+    request->write.copied = true;
+  }
+  shard_submit(db, index);
+
+  db->seen++;
+  if (db->sampled < SHARD_SAMPLE) {
+    db->sample[db->sampled++] = cursor->key;
+  } else {
+    db->random_state ^= db->random_state << 13;
+    db->random_state ^= db->random_state >> 7;
+    db->random_state ^= db->random_state << 17;
+    long long slot = db->random_state % db->seen;
+    if (slot < SHARD_SAMPLE) {
+      db->sample[slot] = cursor->key;
+    }
+  }
+  db->writes++;
+  if (db->writes == db->next_rebalance) {
+    shard_rebalance(db);
+    db->next_rebalance += db->writes < SHARD_REBALANCE_INTERVAL ? db->writes : SHARD_REBALANCE_INTERVAL;
+  }
+}
+
+static const kvds_value *shard_read(kvds_db *_db, kvds_cursor *_cursor) {
+  shard_db *db = _db;
+  shard_cursor *cursor = _cursor;
+
+  int index = shard_route(db, cursor->key);
+  shard_begin(db, index, SHARD_READ, cursor, cursor->key);
+  return shard_call(db, index)->value;
+}
+
+static bool shard_remove(kvds_db *_db, kvds_cursor *_cursor) {
+  shard_db *db = _db;
+  shard_cursor *cursor = _cursor;
+
+  int index = shard_route(db, cursor->key);
+  shard_begin(db, index, SHARD_REMOVE, cursor, cursor->key);
+  return shard_call(db, index)->found;
+}
+
+static void shard_iterate(kvds_db *_db, kvds_cursor *_cursor, long long to, bool (*callback)(void *context, long long key, const kvds_value *value), void *context) {
+  shard_db *db = _db;
+  shard_cursor *cursor = _cursor;
+
+  // The callback runs on the workers' threads, but never on two at once, since we wait for each shard to finish before going on to the next
+  int first = shard_route(db, cursor->key);
+  for (int index = first; index < db->count && (index == first || db->bounds[index] <= to); index++) {
+    if (shard_upper(db, db->bounds, index) < db->bounds[index]) {
+      continue;
+    }
+    shard_request *request = shard_begin(db, index, SHARD_ITERATE, cursor, index == first ? cursor->key : db->bounds[index]);
+    request->iterate.to = to;
+    request->iterate.callback = callback;
+    request->iterate.context = context;
+    if (shard_call(db, index)->found) {
+      break; // The callback asked to stop
+    }
+  }
+}
+
+static void shard_bulk_load(kvds_db *_db, bool (*next)(void *context, long long *key, kvds_value *value), void *context) {
+  shard_db *db = _db;
+
+  // Buffer the whole stream, so that the bounds can split it evenly, and then let every shard load its part at the same time
+  shard_batch batch;
+  shard_batch_init(&batch);
+  long long key;
+  kvds_value value;
+  while (next(context, &key, &value)) {
+    shard_batch_add(&batch, key, &value);
+  }
+  if (batch.count > 0) {
+    shard_split(db, batch.keys, batch.count, db->bounds);
+  }
+
+  long long start = 0;
+  for (int i = 0; i < db->count; i++) {
+    long long end = start;
+    while (end < batch.count && batch.keys[end] <= shard_upper(db, db->bounds, i)) end++;
+    shard_request *request = shard_begin(db, i, SHARD_BULK_LOAD, NULL, 0);
+    request->bulk_load.batch = &batch;
+    request->bulk_load.position = start;
+    request->bulk_load.end = end;
+    shard_submit(db, i);
+    start = end;
+  }
+  for (int i = 0; i < db->count; i++) {
+    shard_wait(db, i);
+  }
+  shard_batch_release(&batch);
+  shard_reset_cursors(db);
+}
+
+REGISTER("sharded", "shard", "Split keys by range across worker threads, each with its own inner database (" SHARD_ALGO " by default)") = {
+  .create_db = shard_create_db,
+  .destroy_db = shard_destroy_db,
+  .create_cursor = shard_create_cursor,
+  .move_cursor = shard_move_cursor,
+  .destroy_cursor = shard_destroy_cursor,
+
+  .key = shard_key,
+  .exists = shard_exists,
+  .snap = shard_snap,
+
+  .write = shard_write,
+  .read = shard_read,
+  .remove = shard_remove,
+  .iterate = shard_iterate,
+  .bulk_load = shard_bulk_load,
+};
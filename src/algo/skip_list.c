@@ -0,0 +1,391 @@
+// SPDX-License-Identifier: MIT
+#include "../registry.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SKL_MAX_HEIGHT 32
+
+typedef struct skl_db {
+  struct skl_node *head[SKL_MAX_HEIGHT]; // lowest node on each level
+  struct skl_node *tail; // highest
+  int height; // number of levels in use
+  uint64_t random_state;
+  kvds_value_arena values;
+} skl_db;
+
+typedef struct skl_node {
+  long long key;
+  kvds_value value;
+
+  struct skl_node *prev; // lower, on the bottom level only
+  int height;
+  struct skl_node *next[]; // higher, one per level; allocated together with the node
+} skl_node;
+
+typedef struct skl_cursor {
+  long long key;
+  struct skl_node *best; // Either exact key or either node that would be next to the key
+} skl_cursor;
+
+#ifndef NDEBUG
+static void skl_assert_invariants(skl_db *db) {
+  skl_node *prev_node = NULL;
+  skl_node *node = db->head[0];
+  while (node != NULL) {
+    assert(node->prev == prev_node);
+    assert(node->height >= 1 && node->height <= db->height);
+    if (prev_node != NULL) {
+      assert(node->key > prev_node->key);
+    }
+    prev_node = node;
+    node = node->next[0];
+  }
+  assert(db->tail == prev_node);
+
+  for (int level = 1; level < db->height; level++) {
+    // Every level is a sorted sublist of the one below it
+    skl_node *below = db->head[level - 1];
+    for (skl_node *node = db->head[level]; node != NULL; node = node->next[level]) {
+      assert(node->height > level);
+      while (below != node) {
+        assert(below != NULL);
+        below = below->next[level - 1];
+      }
+    }
+  }
+  for (int level = db->height; level < SKL_MAX_HEIGHT; level++) {
+    assert(db->head[level] == NULL);
+  }
+}
+#else
+static void skl_assert_invariants(skl_db *db) {
+  // pass
+}
+#endif
+
+static kvds_db *skl_create_db(const kvds_options *options) {
+  skl_db *db = malloc(sizeof(skl_db));
+  for (int level = 0; level < SKL_MAX_HEIGHT; level++) {
+    db->head[level] = NULL;
+  }
+  db->tail = NULL;
+  db->height = 1;
+  db->random_state = 0x2545f4914f6cdd1dull;
+  kvds_value_arena_init(&db->values, options->allocator);
+
+  skl_assert_invariants(db);
+
+  return db;
+}
+
+static void skl_destroy_db(kvds_db *_db) {
+  skl_db *db = _db;
+  skl_node *node = db->head[0];
+  while (node != NULL) {
+    skl_node *next = node->next[0];
+    free(node);
+    node = next;
+  }
+  kvds_value_arena_release(&db->values);
+  free(db);
+}
+
+static int skl_random_height(skl_db *db) {
+  // xorshift64; each extra level is taken with probability 1/4
+  db->random_state ^= db->random_state << 13;
+  db->random_state ^= db->random_state >> 7;
+  db->random_state ^= db->random_state << 17;
+  uint64_t bits = db->random_state;
+  int height = 1;
+  while (height < SKL_MAX_HEIGHT && (bits & 3) == 0) {
+    height++;
+    bits >>= 2;
+  }
+  return height;
+}
+
+// Finds the last node lower than key on every level, or NULL if there is none (i.e. the head is after it)
+static void skl_node_locate_before(skl_db *db, long long key, skl_node **before) {
+  skl_node *node = NULL;
+  for (int level = db->height - 1; level >= 0; level--) {
+    skl_node *next = node == NULL ? db->head[level] : node->next[level];
+    while (next != NULL && next->key < key) {
+      node = next;
+      next = node->next[level];
+    }
+    before[level] = node;
+  }
+}
+
+static skl_node *skl_node_locate(skl_db *db, long long key) {
+  skl_node *before[SKL_MAX_HEIGHT];
+  skl_node_locate_before(db, key, before);
+
+  skl_node *after = before[0] == NULL ? db->head[0] : before[0]->next[0];
+  if (after != NULL && after->key == key) {
+    return after;
+  }
+  return before[0] != NULL ? before[0] : after;
+}
+
+static kvds_cursor *skl_create_cursor(kvds_db *_db, long long key) {
+  skl_db *db = _db;
+  skl_cursor *cursor = malloc(sizeof(skl_cursor));
+
+  cursor->key = key;
+  cursor->best = skl_node_locate(db, key);
+
+  return cursor;
+}
+
+static void skl_move_cursor(kvds_db *_db, kvds_cursor *_cursor, long long key) {
+  skl_db *db = _db;
+  skl_cursor *cursor = _cursor;
+
+  cursor->key = key;
+  cursor->best = skl_node_locate(db, key);
+}
+
+static void skl_destroy_cursor(kvds_db *_db, kvds_cursor *_cursor) {
+  skl_db *db = _db;
+  skl_cursor *cursor = _cursor;
+
+  free(cursor);
+}
+
+static long long skl_key(kvds_db *_db, kvds_cursor *_cursor) {
+  skl_db *db = _db;
+  skl_cursor *cursor = _cursor;
+
+  return cursor->key;
+}
+
+static bool skl_exists(kvds_db *_db, kvds_cursor *_cursor) {
+  skl_db *db = _db;
+  skl_cursor *cursor = _cursor;
+
+  return cursor->best != NULL && cursor->best->key == cursor->key;
+}
+
+static void skl_write(kvds_db *_db, kvds_cursor *_cursor, const kvds_value *value) {
+  skl_db *db = _db;
+  skl_cursor *cursor = _cursor;
+
+  if (cursor->best != NULL && cursor->best->key == cursor->key) { // Special case: already exists
+    kvds_value_replace(&db->values, &cursor->best->value, value);
+    return;
+  }
+
+  int height = skl_random_height(db);
+  skl_node *new_node = malloc(sizeof(skl_node) + height * sizeof(skl_node *));
+
+  kvds_value_store(&db->values, &new_node->value, value);
+  new_node->key = cursor->key;
+  new_node->height = height;
+
+  if (height > db->height) {
+    db->height = height;
+  }
+
+  skl_node *before[SKL_MAX_HEIGHT];
+  skl_node_locate_before(db, cursor->key, before);
+
+  for (int level = 0; level < height; level++) {
+    if (before[level] == NULL) {
+      new_node->next[level] = db->head[level];
+      db->head[level] = new_node;
+    } else {
+      new_node->next[level] = before[level]->next[level];
+      before[level]->next[level] = new_node;
+    }
+  }
+
+  new_node->prev = before[0];
+  if (new_node->next[0] != NULL) {
+    new_node->next[0]->prev = new_node;
+  } else {
+    db->tail = new_node;
+  }
+
+  cursor->best = new_node;
+
+  skl_assert_invariants(db);
+}
+
+static const kvds_value *skl_read(kvds_db *_db, kvds_cursor *_cursor) {
+  skl_db *db = _db;
+  skl_cursor *cursor = _cursor;
+
+  if (cursor->best != NULL && cursor->best->key == cursor->key) { // The node exists
+    return &cursor->best->value;
+  } else {
+    return NULL;
+  }
+}
+
+static bool skl_remove(kvds_db *_db, kvds_cursor *_cursor) {
+  skl_db *db = _db;
+  skl_cursor *cursor = _cursor;
+
+  if (cursor->best == NULL || cursor->best->key != cursor->key) {
+    return false;
+  }
+
+  skl_node *old_node = cursor->best;
+
+  skl_node *before[SKL_MAX_HEIGHT];
+  skl_node_locate_before(db, old_node->key, before);
+
+  for (int level = 0; level < old_node->height; level++) {
+    if (before[level] == NULL) {
+      assert(db->head[level] == old_node);
+      db->head[level] = old_node->next[level];
+    } else {
+      assert(before[level]->next[level] == old_node);
+      before[level]->next[level] = old_node->next[level];
+    }
+  }
+  while (db->height > 1 && db->head[db->height - 1] == NULL) {
+    db->height--;
+  }
+
+  if (old_node->next[0] != NULL) {
+    old_node->next[0]->prev = old_node->prev;
+  } else {
+    db->tail = old_node->prev;
+  }
+
+  cursor->best = old_node->next[0] != NULL ? old_node->next[0] : old_node->prev; // Either one is fine, just pick the non-NULL one
+
+  kvds_value_clear(&db->values, &old_node->value);
+  free(old_node);
+
+  skl_assert_invariants(db);
+
+  return true;
+}
+
+static void skl_snap(kvds_db *_db, kvds_cursor *_cursor, enum kvds_snap_direction dir) {
+  skl_db *db = _db;
+  skl_cursor *cursor = _cursor;
+
+  if (cursor->best == NULL) {
+    return; // Nothing in the database, nothing to find
+  }
+
+  switch (dir) {
+  case KVDS_SNAP_CLOSEST_LOW: {
+    if (cursor->best->key == cursor->key) {
+      // Already at closest
+    } else {
+      skl_node *left;
+      skl_node *right;
+      if (cursor->key < cursor->best->key) {
+        left = cursor->best->prev;
+        right = cursor->best;
+      } else {
+        left = cursor->best;
+        right = cursor->best->next[0];
+      }
+      if (left != NULL && right != NULL) { // Not past the edge
+        if ((unsigned long long)cursor->key - left->key <= (unsigned long long)right->key - cursor->key) {
+          cursor->best = left;
+        } else {
+          cursor->best = right;
+        }
+      } else {
+        // cursor->best already contains closest
+      }
+    }
+    cursor->key = cursor->best->key;
+  } break;
+  case KVDS_SNAP_HIGHER: {
+    if (cursor->key >= cursor->best->key) {
+      if (cursor->best->next[0] != NULL) {
+        cursor->best = cursor->best->next[0];
+      }
+    }
+    cursor->key = cursor->best->key;
+  } break;
+  case KVDS_SNAP_LOWER: {
+    if (cursor->key <= cursor->best->key) {
+      if (cursor->best->prev != NULL) {
+        cursor->best = cursor->best->prev;
+      }
+    }
+    cursor->key = cursor->best->key;
+  } break;
+  }
+}
+
+static void skl_iterate(kvds_db *_db, kvds_cursor *_cursor, long long to, bool (*callback)(void *context, long long key, const kvds_value *value), void *context) {
+  skl_db *db = _db;
+  skl_cursor *cursor = _cursor;
+
+  skl_node *node = cursor->best;
+  if (node != NULL && node->key < cursor->key) {
+    node = node->next[0]; // best is right before the key
+  }
+  for (; node != NULL && node->key <= to; node = node->next[0]) {
+    if (!callback(context, node->key, &node->value)) {
+      break;
+    }
+  }
+}
+
+static void skl_bulk_load(kvds_db *_db, bool (*next)(void *context, long long *key, kvds_value *value), void *context) {
+  skl_db *db = _db;
+  assert(db->head[0] == NULL);
+
+  skl_node *last[SKL_MAX_HEIGHT] = {NULL}; // The highest node on each level so far
+
+  long long key;
+  kvds_value value;
+  while (next(context, &key, &value)) {
+    assert(db->tail == NULL || db->tail->key < key);
+    int height = skl_random_height(db);
+    skl_node *node = malloc(sizeof(skl_node) + height * sizeof(skl_node *));
+    node->key = key;
+    kvds_value_store(&db->values, &node->value, &value);
+    node->height = height;
+    node->prev = db->tail;
+
+    if (height > db->height) {
+      db->height = height;
+    }
+    for (int level = 0; level < height; level++) {
+      node->next[level] = NULL;
+      if (last[level] != NULL) {
+        last[level]->next[level] = node;
+      } else {
+        db->head[level] = node;
+      }
+      last[level] = node;
+    }
+    db->tail = node;
+  }
+
+  skl_assert_invariants(db);
+}
+
+REGISTER("skiplist", "skl", "Store entries in a skip list") = {
+  .create_db = skl_create_db,
+  .destroy_db = skl_destroy_db,
+  .create_cursor = skl_create_cursor,
+  .move_cursor = skl_move_cursor,
+  .destroy_cursor = skl_destroy_cursor,
+
+  .key = skl_key,
+  .exists = skl_exists,
+  .snap = skl_snap,
+
+  .write = skl_write,
+  .read = skl_read,
+  .remove = skl_remove,
+  .iterate = skl_iterate,
+  .bulk_load = skl_bulk_load,
+};
@@ -0,0 +1,451 @@
+// SPDX-License-Identifier: MIT
+#include "../arena.h"
+#include "../registry.h"
+#include "../stats.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct spl_db {
+  struct spl_node *top;
+  kvds_arena nodes;
+  kvds_value_arena values;
+  unsigned long moves; // Cursor moves and snaps so far, for splay_interval
+  unsigned long splay_interval; // Splay on every n-th cursor move and snap only, and just search the tree on the others; writes and deletes always splay
+} spl_db;
+
+// No parent pointers: splaying is done top-down, so nothing ever needs to walk up
+typedef struct spl_node {
+  long long key;
+  kvds_value value;
+  struct spl_node *left;
+  struct spl_node *right;
+} spl_node;
+
+typedef struct spl_cursor {
+  long long key;
+  struct spl_node *node; // Node holding the key, or NULL if it doesn't exist
+  // Unlike the other trees' cursors, this doesn't point at where the key would go, as splaying moves nodes around under other cursors; nodes themselves stay put until deleted, though
+} spl_cursor;
+
+// Explicit stack for in-order traversals, as splay trees can get as tall as they are large; starts out on the caller's stack and only moves to the heap for tall trees
+typedef struct spl_stack {
+  spl_node **nodes;
+  int depth;
+  int capacity;
+  spl_node *local[64];
+} spl_stack;
+
+static void spl_stack_init(spl_stack *stack) {
+  stack->nodes = stack->local;
+  stack->depth = 0;
+  stack->capacity = sizeof stack->local / sizeof stack->local[0];
+}
+
+static void spl_stack_push(spl_stack *stack, spl_node *node) {
+  if (stack->depth == stack->capacity) {
+    stack->capacity *= 2;
+    if (stack->nodes == stack->local) {
+      stack->nodes = malloc(stack->capacity * sizeof(spl_node *));
+      memcpy(stack->nodes, stack->local, sizeof stack->local);
+    } else {
+      stack->nodes = realloc(stack->nodes, stack->capacity * sizeof(spl_node *));
+    }
+  }
+  stack->nodes[stack->depth++] = node;
+}
+
+static void spl_stack_release(spl_stack *stack) {
+  if (stack->nodes != stack->local) {
+    free(stack->nodes);
+  }
+}
+
+// Pushes node and its chain of left children, so that the top of the stack is the lowest node not visited yet
+static void spl_stack_push_left(spl_stack *stack, spl_node *node) {
+  for (; node != NULL; node = node->left) {
+    spl_stack_push(stack, node);
+  }
+}
+
+#ifndef NDEBUG
+static void spl_assert_invariants(spl_db *db) {
+  // Walked iteratively, since the tree can be a single long chain
+  spl_stack stack;
+  spl_stack_init(&stack);
+  spl_stack_push_left(&stack, db->top);
+  bool first = true;
+  long long previous;
+  while (stack.depth > 0) {
+    spl_node *node = stack.nodes[--stack.depth];
+    assert(first || previous < node->key);
+    first = false;
+    previous = node->key;
+    spl_stack_push_left(&stack, node->right);
+  }
+  spl_stack_release(&stack);
+}
+#else
+static void spl_assert_invariants(spl_db *db) {
+  // pass
+}
+#endif
+
+static kvds_db *spl_create_db(const kvds_options *options) {
+  spl_db *db = malloc(sizeof(spl_db));
+  db->top = NULL;
+  kvds_arena_init(&db->nodes, sizeof(spl_node), options->allocator);
+  kvds_arena_reserve(&db->nodes, options->capacity);
+  kvds_value_arena_init(&db->values, options->allocator);
+  db->moves = 0;
+  db->splay_interval = options->splay_interval > 0 ? options->splay_interval : 1;
+  return db;
+}
+
+static void spl_destroy_db(kvds_db *_db) {
+  spl_db *db = _db;
+  kvds_value_arena_release(&db->values);
+  kvds_arena_release(&db->nodes);
+  free(db);
+}
+
+// Top-down splay: brings the node holding key, or else the last node on the way to where it would be (its closest neighbour on one side), to the root of the subtree, and returns it
+// Nodes left of the path are gathered into one tree and nodes right of it into another while descending, two levels at a time, and both are hung under the new root at the end
+static spl_node *spl_splay(spl_node *root, long long key) {
+  spl_node header;
+  header.left = header.right = NULL;
+  spl_node *left_max = &header; // Highest node of the left tree, hung from header.right
+  spl_node *right_min = &header; // Lowest node of the right tree, hung from header.left
+
+  while (true) {
+    if (key < root->key) {
+      if (root->left == NULL) break;
+      if (key < root->left->key) { // Zig-zig: rotate right first
+        kvds_stats_count(KVDS_STAT_ROTATIONS, 1);
+        spl_node *child = root->left;
+        root->left = child->right;
+        child->right = root;
+        root = child;
+        if (root->left == NULL) break;
+      }
+      right_min->left = root; // Link right
+      right_min = root;
+      root = root->left;
+    } else if (key > root->key) {
+      if (root->right == NULL) break;
+      if (key > root->right->key) { // Zag-zag: rotate left first
+        kvds_stats_count(KVDS_STAT_ROTATIONS, 1);
+        spl_node *child = root->right;
+        root->right = child->left;
+        child->left = root;
+        root = child;
+        if (root->right == NULL) break;
+      }
+      left_max->right = root; // Link left
+      left_max = root;
+      root = root->right;
+    } else {
+      break;
+    }
+  }
+
+  left_max->right = root->left;
+  right_min->left = root->right;
+  root->left = header.right;
+  root->right = header.left;
+  return root;
+}
+
+// Finds the node holding key without changing the tree
+static spl_node *spl_node_search(spl_db *db, long long key) {
+  spl_node *node = db->top;
+  while (node != NULL && node->key != key) {
+    node = key < node->key ? node->left : node->right;
+  }
+  return node;
+}
+
+// Whether this cursor move or snap should splay, or only search the tree
+static bool spl_should_splay(spl_db *db) {
+  db->moves++;
+  return db->moves % db->splay_interval == 0;
+}
+
+// The node with the lowest key above key (or the highest key below it), or NULL if there is none, without changing the tree
+static spl_node *spl_node_search_neighbour(spl_db *db, long long key, bool higher) {
+  spl_node *best = NULL;
+  for (spl_node *node = db->top; node != NULL;) {
+    if (higher ? node->key > key : node->key < key) {
+      best = node;
+      node = higher ? node->left : node->right;
+    } else {
+      node = higher ? node->right : node->left;
+    }
+  }
+  return best;
+}
+
+// Same as spl_node_search_neighbour, but splays the neighbour up to the root (or just under it), so that walking the keys with snaps costs O(1) amortized per step
+static spl_node *spl_node_neighbour(spl_db *db, long long key, bool higher) {
+  if (db->top == NULL) {
+    return NULL;
+  }
+  if (!spl_should_splay(db)) {
+    return spl_node_search_neighbour(db, key, higher);
+  }
+  spl_node *root = db->top = spl_splay(db->top, key);
+  if (higher ? root->key > key : root->key < key) {
+    return root;
+  }
+  // The neighbour is the lowest (highest) node of the subtree on that side, which splaying it for a key outside all of its keys brings up
+  spl_node **side = higher ? &root->right : &root->left;
+  if (*side == NULL) {
+    return NULL;
+  }
+  *side = spl_splay(*side, key);
+  return *side;
+}
+
+static spl_node *spl_node_locate(spl_db *db, long long key) {
+  if (db->top == NULL) {
+    return NULL;
+  }
+  if (!spl_should_splay(db)) {
+    return spl_node_search(db, key);
+  }
+  db->top = spl_splay(db->top, key);
+  return db->top->key == key ? db->top : NULL;
+}
+
+static kvds_cursor *spl_create_cursor(kvds_db *_db, long long key) {
+  spl_db *db = _db;
+  spl_cursor *cursor = malloc(sizeof(spl_cursor));
+
+  cursor->key = key;
+  cursor->node = spl_node_locate(db, key);
+
+  return cursor;
+}
+
+static void spl_move_cursor(kvds_db *_db, kvds_cursor *_cursor, long long key) {
+  spl_db *db = _db;
+  spl_cursor *cursor = _cursor;
+
+  cursor->key = key;
+  cursor->node = spl_node_locate(db, key);
+}
+
+static void spl_destroy_cursor(kvds_db *_db, kvds_cursor *_cursor) {
+  spl_db *db = _db;
+  spl_cursor *cursor = _cursor;
+
+  free(cursor);
+}
+
+static long long spl_key(kvds_db *_db, kvds_cursor *_cursor) {
+  spl_db *db = _db;
+  spl_cursor *cursor = _cursor;
+
+  return cursor->key;
+}
+
+static bool spl_exists(kvds_db *_db, kvds_cursor *_cursor) {
+  spl_db *db = _db;
+  spl_cursor *cursor = _cursor;
+
+  return cursor->node != NULL;
+}
+
+static void spl_write(kvds_db *_db, kvds_cursor *_cursor, const kvds_value *value) {
+  spl_db *db = _db;
+  spl_cursor *cursor = _cursor;
+
+  if (cursor->node != NULL) { // Special case: already exists
+    kvds_value_replace(&db->values, &cursor->node->value, value);
+    return;
+  }
+
+  spl_node *new_node = kvds_arena_alloc(&db->nodes);
+
+  kvds_value_store(&db->values, &new_node->value, value);
+  new_node->key = cursor->key;
+
+  // Splay the key's neighbour up, and split the tree around it under the new node
+  if (db->top == NULL) {
+    new_node->left = NULL;
+    new_node->right = NULL;
+  } else {
+    spl_node *root = spl_splay(db->top, cursor->key);
+    assert(root->key != cursor->key);
+    if (cursor->key < root->key) {
+      new_node->left = root->left;
+      new_node->right = root;
+      root->left = NULL;
+    } else {
+      new_node->right = root->right;
+      new_node->left = root;
+      root->right = NULL;
+    }
+  }
+  db->top = new_node;
+
+  cursor->node = new_node;
+
+  spl_assert_invariants(db);
+}
+
+static const kvds_value *spl_read(kvds_db *_db, kvds_cursor *_cursor) {
+  spl_db *db = _db;
+  spl_cursor *cursor = _cursor;
+
+  if (cursor->node != NULL) {
+    return &cursor->node->value;
+  } else {
+    return NULL;
+  }
+}
+
+static bool spl_remove(kvds_db *_db, kvds_cursor *_cursor) {
+  spl_db *db = _db;
+  spl_cursor *cursor = _cursor;
+
+  if (cursor->node == NULL) {
+    return false;
+  }
+
+  spl_node *node = spl_splay(db->top, cursor->key);
+  assert(node == cursor->node);
+
+  if (node->left == NULL) {
+    db->top = node->right;
+  } else {
+    // Splaying the left subtree for a key above all of its keys brings its highest node up, which then has no right child to make room for the node's right subtree
+    db->top = spl_splay(node->left, cursor->key);
+    assert(db->top->right == NULL);
+    db->top->right = node->right;
+  }
+
+  kvds_value_clear(&db->values, &node->value);
+  kvds_arena_free(&db->nodes, node);
+
+  cursor->node = NULL;
+
+  spl_assert_invariants(db);
+
+  return true;
+}
+
+static void spl_snap(kvds_db *_db, kvds_cursor *_cursor, enum kvds_snap_direction dir) {
+  spl_db *db = _db;
+  spl_cursor *cursor = _cursor;
+
+  if (db->top == NULL) {
+    return; // Nothing in the database, nothing to find
+  }
+
+  spl_node *target = NULL;
+  switch (dir) {
+  case KVDS_SNAP_HIGHER: {
+    target = spl_node_neighbour(db, cursor->key, true);
+    if (target == NULL && cursor->node == NULL) {
+      target = spl_node_neighbour(db, cursor->key, false); // Past the end; go to the highest key instead
+    }
+  } break;
+  case KVDS_SNAP_LOWER: {
+    target = spl_node_neighbour(db, cursor->key, false);
+    if (target == NULL && cursor->node == NULL) {
+      target = spl_node_neighbour(db, cursor->key, true); // Past the start; go to the lowest key instead
+    }
+  } break;
+  case KVDS_SNAP_CLOSEST_LOW: {
+    if (cursor->node != NULL) {
+      break; // Already at closest
+    }
+    spl_node *left = spl_node_neighbour(db, cursor->key, false);
+    spl_node *right = spl_node_neighbour(db, cursor->key, true);
+    if (left != NULL && right != NULL) { // Not past the edge
+      if ((unsigned long long)cursor->key - left->key <= (unsigned long long)right->key - cursor->key) {
+        target = left;
+      } else {
+        target = right;
+      }
+    } else {
+      target = left != NULL ? left : right;
+    }
+  } break;
+  }
+
+  if (target != NULL) {
+    cursor->node = target;
+    cursor->key = target->key;
+  }
+}
+
+static void spl_iterate(kvds_db *_db, kvds_cursor *_cursor, long long to, bool (*callback)(void *context, long long key, const kvds_value *value), void *context) {
+  spl_db *db = _db;
+  spl_cursor *cursor = _cursor;
+
+  // Iterating doesn't splay either, so that a long range doesn't turn the tree into a chain
+  spl_stack stack;
+  spl_stack_init(&stack);
+
+  for (spl_node *node = db->top; node != NULL;) {
+    if (node->key >= cursor->key) {
+      spl_stack_push(&stack, node);
+      node = node->left;
+    } else {
+      node = node->right;
+    }
+  }
+
+  while (stack.depth > 0) {
+    spl_node *node = stack.nodes[--stack.depth];
+    if (node->key > to || !callback(context, node->key, &node->value)) {
+      break;
+    }
+    spl_stack_push_left(&stack, node->right);
+  }
+
+  spl_stack_release(&stack);
+}
+
+static void spl_shape(kvds_db *_db, long long *nodes, long long *height) {
+  spl_db *db = _db;
+
+  // Walked level by level, as the tree can be a single long chain; the queue ends up holding every node
+  spl_stack queue;
+  spl_stack_init(&queue);
+  if (db->top != NULL) spl_stack_push(&queue, db->top);
+  *height = 0;
+  for (int start = 0; start < queue.depth; (*height)++) {
+    int end = queue.depth;
+    for (int i = start; i < end; i++) {
+      if (queue.nodes[i]->left != NULL) spl_stack_push(&queue, queue.nodes[i]->left);
+      if (queue.nodes[i]->right != NULL) spl_stack_push(&queue, queue.nodes[i]->right);
+    }
+    start = end;
+  }
+  *nodes = queue.depth;
+  spl_stack_release(&queue);
+}
+
+REGISTER("splaytree", "spl", "Store entries in a top-down splay tree, which moves recently-used keys up to the root.") = {
+  .create_db = spl_create_db,
+  .destroy_db = spl_destroy_db,
+  .create_cursor = spl_create_cursor,
+  .move_cursor = spl_move_cursor,
+  .destroy_cursor = spl_destroy_cursor,
+
+  .key = spl_key,
+  .exists = spl_exists,
+  .snap = spl_snap,
+
+  .write = spl_write,
+  .read = spl_read,
+  .remove = spl_remove,
+  .iterate = spl_iterate,
+  .shape = spl_shape,
+};
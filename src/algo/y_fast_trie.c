@@ -0,0 +1,475 @@
+// SPDX-License-Identifier: MIT
+#include "../arena.h"
+#include "../hash_index.h"
+#include "../registry.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Keys are mapped to unsigned integers by flipping the sign bit, so that they sort the same way the keys do; the trie branches on their bits, most significant first
+#define YFT_KEY_BITS 64
+
+#ifndef YFT_BUCKET_KEYS
+#define YFT_BUCKET_KEYS 64 // Keys per bucket at most; a full bucket is split in half
+#endif
+
+typedef struct yft_entry {
+  long long key;
+  kvds_value value;
+} yft_entry;
+
+// Keys are split between buckets by ranges: a bucket holds the keys from its own low up to the next bucket's low
+typedef struct yft_bucket {
+  long long low; // Representative in the trie; fixed for the life of the bucket
+  int count;
+  struct yft_bucket *prev, *next;
+  long long keys[YFT_BUCKET_KEYS]; // Sorted
+  yft_entry *entries[YFT_BUCKET_KEYS]; // entries[i] holds keys[i]
+} yft_bucket;
+
+// A prefix of at least one representative; tracks the lowest and highest buckets whose representatives share it
+typedef struct yft_trie_node {
+  yft_bucket *min;
+  yft_bucket *max;
+} yft_trie_node;
+
+typedef struct yft_db {
+  kvds_hash_index levels[YFT_KEY_BITS + 1]; // levels[l] maps the top l bits of representatives to trie nodes; levels[YFT_KEY_BITS] maps whole representatives to their buckets
+  kvds_hash_index entries; // Maps keys to their entries
+  yft_bucket *first; // Covers LLONG_MIN, so that every key has a bucket; never removed, though it may be empty
+  kvds_arena buckets;
+  kvds_arena trie_nodes;
+  kvds_arena entry_slots;
+  kvds_value_arena values;
+} yft_db;
+
+typedef struct yft_cursor {
+  long long key;
+  yft_entry *entry; // Entry holding the key, or NULL if it doesn't exist
+} yft_cursor;
+
+static inline unsigned long long yft_unsigned(long long key) {
+  return (unsigned long long)key ^ (1ull << 63);
+}
+
+static inline unsigned long long yft_prefix(unsigned long long bits, int level) {
+  return level == 0 ? 0 : bits >> (YFT_KEY_BITS - level);
+}
+
+// Trie
+
+// Bucket whose range covers the key: binary search over the levels for the longest prefix shared with a representative, then one step to a neighbouring leaf
+static yft_bucket *yft_find_bucket(yft_db *db, long long key) {
+  unsigned long long bits = yft_unsigned(key);
+  int low = 0, high = YFT_KEY_BITS; // levels[0] is never empty, thanks to the first bucket
+  void *found = kvds_hash_index_get(&db->levels[0], 0);
+  while (low < high) {
+    int middle = (low + high + 1) / 2;
+    void *node = kvds_hash_index_get(&db->levels[middle], yft_prefix(bits, middle));
+    if (node != NULL) {
+      low = middle;
+      found = node;
+    } else {
+      high = middle - 1;
+    }
+  }
+  if (low == YFT_KEY_BITS) {
+    return found; // The key is a representative itself
+  }
+  // Only one side of the deepest matching node has representatives, and it is not the key's side
+  yft_trie_node *node = found;
+  bool right = (bits >> (YFT_KEY_BITS - 1 - low)) & 1;
+  return right ? node->max : node->min->prev;
+}
+
+// Adds the representative of a bucket that has already been linked in
+static void yft_trie_insert(yft_db *db, yft_bucket *bucket) {
+  unsigned long long bits = yft_unsigned(bucket->low);
+  for (int level = 0; level < YFT_KEY_BITS; level++) {
+    unsigned long long prefix = yft_prefix(bits, level);
+    yft_trie_node *node = kvds_hash_index_get(&db->levels[level], prefix);
+    if (node == NULL) {
+      node = kvds_arena_alloc(&db->trie_nodes);
+      node->min = node->max = bucket;
+      kvds_hash_index_put(&db->levels[level], prefix, node);
+    } else if (bucket->low < node->min->low) {
+      node->min = bucket;
+    } else if (bucket->low > node->max->low) {
+      node->max = bucket;
+    }
+  }
+  kvds_hash_index_put(&db->levels[YFT_KEY_BITS], bits, bucket);
+}
+
+// Drops the representative of a bucket that is still linked in, so that its neighbours can take its place
+static void yft_trie_remove(yft_db *db, yft_bucket *bucket) {
+  unsigned long long bits = yft_unsigned(bucket->low);
+  kvds_hash_index_remove(&db->levels[YFT_KEY_BITS], bits);
+  for (int level = YFT_KEY_BITS - 1; level >= 0; level--) {
+    unsigned long long prefix = yft_prefix(bits, level);
+    yft_trie_node *node = kvds_hash_index_get(&db->levels[level], prefix);
+    if (node->min == bucket && node->max == bucket) {
+      kvds_hash_index_remove(&db->levels[level], prefix);
+      kvds_arena_free(&db->trie_nodes, node);
+      continue;
+    }
+    // Representatives sharing a prefix are contiguous, so the neighbours of the one removed are the new ends
+    if (node->min == bucket) {
+      node->min = bucket->next;
+    }
+    if (node->max == bucket) {
+      node->max = bucket->prev;
+    }
+  }
+}
+
+#ifndef NDEBUG
+static void yft_assert_invariants(yft_db *db) {
+  assert(db->first->prev == NULL && db->first->low == LLONG_MIN);
+  size_t keys = 0;
+  size_t prefixes[YFT_KEY_BITS + 1] = {0};
+  for (yft_bucket *bucket = db->first; bucket != NULL; bucket = bucket->next) {
+    unsigned long long bits = yft_unsigned(bucket->low);
+    assert(bucket->count >= 0 && bucket->count <= YFT_BUCKET_KEYS);
+    assert(bucket->next == NULL || (bucket->next->prev == bucket && bucket->next->low > bucket->low));
+    assert(bucket->count > 0 || bucket == db->first);
+    assert(bucket->next == NULL || bucket->count == 0 || bucket->count + bucket->next->count > YFT_BUCKET_KEYS / 2); // Splitting the bucket after an empty first one may leave it half full
+    for (int i = 0; i < bucket->count; i++) {
+      assert(bucket->keys[i] >= bucket->low && (bucket->next == NULL || bucket->keys[i] < bucket->next->low));
+      assert(i == 0 || bucket->keys[i - 1] < bucket->keys[i]);
+      assert(bucket->entries[i]->key == bucket->keys[i]);
+      assert(kvds_hash_index_get(&db->entries, yft_unsigned(bucket->keys[i])) == bucket->entries[i]);
+    }
+    keys += bucket->count;
+
+    assert(kvds_hash_index_get(&db->levels[YFT_KEY_BITS], bits) == bucket);
+    assert(yft_find_bucket(db, bucket->low) == bucket);
+    for (int level = 0; level <= YFT_KEY_BITS; level++) {
+      if (bucket->prev == NULL || yft_prefix(yft_unsigned(bucket->prev->low), level) != yft_prefix(bits, level)) {
+        prefixes[level]++;
+      }
+    }
+    for (int level = 0; level < YFT_KEY_BITS; level++) {
+      yft_trie_node *node = kvds_hash_index_get(&db->levels[level], yft_prefix(bits, level));
+      assert(node != NULL);
+      assert(node->min->low <= bucket->low && bucket->low <= node->max->low);
+      assert(yft_prefix(yft_unsigned(node->min->low), level) == yft_prefix(bits, level));
+      assert(yft_prefix(yft_unsigned(node->max->low), level) == yft_prefix(bits, level));
+    }
+  }
+  assert(db->entries.count == keys);
+  for (int level = 0; level <= YFT_KEY_BITS; level++) {
+    assert(db->levels[level].count == prefixes[level]);
+  }
+}
+#else
+static void yft_assert_invariants(yft_db *db) {
+  // pass
+}
+#endif
+
+static kvds_db *yft_create_db(const kvds_options *options) {
+  yft_db *db = malloc(sizeof(yft_db));
+
+  for (int level = 0; level <= YFT_KEY_BITS; level++) {
+    kvds_hash_index_init(&db->levels[level], NULL);
+  }
+  kvds_hash_index_init(&db->entries, NULL);
+  kvds_hash_index_reserve(&db->entries, options->capacity);
+  kvds_arena_init(&db->buckets, sizeof(yft_bucket), options->allocator);
+  kvds_arena_init(&db->trie_nodes, sizeof(yft_trie_node), options->allocator);
+  kvds_arena_init(&db->entry_slots, sizeof(yft_entry), options->allocator);
+  kvds_arena_reserve(&db->entry_slots, options->capacity);
+  kvds_value_arena_init(&db->values, options->allocator);
+
+  db->first = kvds_arena_alloc(&db->buckets);
+  db->first->low = LLONG_MIN;
+  db->first->count = 0;
+  db->first->prev = db->first->next = NULL;
+  yft_trie_insert(db, db->first);
+
+  return db;
+}
+
+static void yft_destroy_db(kvds_db *_db) {
+  yft_db *db = _db;
+
+  kvds_value_arena_release(&db->values);
+  kvds_arena_release(&db->entry_slots);
+  kvds_arena_release(&db->trie_nodes);
+  kvds_arena_release(&db->buckets);
+  kvds_hash_index_release(&db->entries);
+  for (int level = 0; level <= YFT_KEY_BITS; level++) {
+    kvds_hash_index_release(&db->levels[level]);
+  }
+  free(db);
+}
+
+// Index of the first key in the bucket that is at least as high as the given one
+static int yft_bucket_lower_bound(yft_bucket *bucket, long long key) {
+  int low = 0, high = bucket->count;
+  while (low < high) {
+    int middle = (low + high) / 2;
+    if (bucket->keys[middle] < key) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+// Lowest entry with a key at least as high as the given one, or NULL if there is none
+static yft_entry *yft_seek_higher(yft_db *db, long long key) {
+  yft_bucket *bucket = yft_find_bucket(db, key);
+  int i = yft_bucket_lower_bound(bucket, key);
+  if (i < bucket->count) {
+    return bucket->entries[i];
+  }
+  for (bucket = bucket->next; bucket != NULL; bucket = bucket->next) {
+    if (bucket->count > 0) {
+      return bucket->entries[0];
+    }
+  }
+  return NULL;
+}
+
+// Highest entry with a key at most as high as the given one
+static yft_entry *yft_seek_lower(yft_db *db, long long key) {
+  yft_bucket *bucket = yft_find_bucket(db, key);
+  int i = yft_bucket_lower_bound(bucket, key);
+  if (i < bucket->count && bucket->keys[i] == key) {
+    return bucket->entries[i];
+  }
+  if (i > 0) {
+    return bucket->entries[i - 1];
+  }
+  for (bucket = bucket->prev; bucket != NULL; bucket = bucket->prev) {
+    if (bucket->count > 0) {
+      return bucket->entries[bucket->count - 1];
+    }
+  }
+  return NULL;
+}
+
+static kvds_cursor *yft_create_cursor(kvds_db *_db, long long key) {
+  yft_db *db = _db;
+  yft_cursor *cursor = malloc(sizeof(yft_cursor));
+
+  cursor->key = key;
+  cursor->entry = kvds_hash_index_get(&db->entries, yft_unsigned(key));
+
+  return cursor;
+}
+
+static void yft_move_cursor(kvds_db *_db, kvds_cursor *_cursor, long long key) {
+  yft_db *db = _db;
+  yft_cursor *cursor = _cursor;
+
+  cursor->key = key;
+  cursor->entry = kvds_hash_index_get(&db->entries, yft_unsigned(key)); // A single probe; the trie is only needed for keys that don't exist
+}
+
+static void yft_destroy_cursor(kvds_db *_db, kvds_cursor *_cursor) {
+  yft_db *db = _db;
+  yft_cursor *cursor = _cursor;
+
+  free(cursor);
+}
+
+static long long yft_key(kvds_db *_db, kvds_cursor *_cursor) {
+  yft_db *db = _db;
+  yft_cursor *cursor = _cursor;
+
+  return cursor->key;
+}
+
+static bool yft_exists(kvds_db *_db, kvds_cursor *_cursor) {
+  yft_db *db = _db;
+  yft_cursor *cursor = _cursor;
+
+  return cursor->entry != NULL;
+}
+
+// Moves the upper half of a full bucket into a new bucket right after it
+static void yft_bucket_split(yft_db *db, yft_bucket *bucket) {
+  yft_bucket *split = kvds_arena_alloc(&db->buckets);
+  int keep = bucket->count / 2;
+  split->count = bucket->count - keep;
+  memcpy(split->keys, &bucket->keys[keep], split->count * sizeof(long long));
+  memcpy(split->entries, &bucket->entries[keep], split->count * sizeof(yft_entry *));
+  split->low = split->keys[0];
+  bucket->count = keep;
+
+  split->prev = bucket;
+  split->next = bucket->next;
+  if (bucket->next != NULL) {
+    bucket->next->prev = split;
+  }
+  bucket->next = split;
+  yft_trie_insert(db, split);
+}
+
+// Moves all keys of a bucket into the one before it, and drops it
+static void yft_bucket_merge(yft_db *db, yft_bucket *bucket) {
+  yft_bucket *prev = bucket->prev;
+  memcpy(&prev->keys[prev->count], bucket->keys, bucket->count * sizeof(long long));
+  memcpy(&prev->entries[prev->count], bucket->entries, bucket->count * sizeof(yft_entry *));
+  prev->count += bucket->count;
+
+  yft_trie_remove(db, bucket);
+  prev->next = bucket->next;
+  if (bucket->next != NULL) {
+    bucket->next->prev = prev;
+  }
+  kvds_arena_free(&db->buckets, bucket);
+}
+
+static void yft_write(kvds_db *_db, kvds_cursor *_cursor, const kvds_value *value) {
+  yft_db *db = _db;
+  yft_cursor *cursor = _cursor;
+
+  if (cursor->entry != NULL) { // Special case: already exists
+    kvds_value_replace(&db->values, &cursor->entry->value, value);
+    return;
+  }
+
+  yft_entry *entry = kvds_arena_alloc(&db->entry_slots);
+  entry->key = cursor->key;
+  kvds_value_store(&db->values, &entry->value, value);
+  kvds_hash_index_put(&db->entries, yft_unsigned(entry->key), entry);
+
+  yft_bucket *bucket = yft_find_bucket(db, entry->key);
+  if (bucket->count == YFT_BUCKET_KEYS) {
+    yft_bucket_split(db, bucket);
+    if (entry->key >= bucket->next->low) {
+      bucket = bucket->next;
+    }
+  }
+  int i = yft_bucket_lower_bound(bucket, entry->key);
+  memmove(&bucket->keys[i + 1], &bucket->keys[i], (bucket->count - i) * sizeof(long long));
+  memmove(&bucket->entries[i + 1], &bucket->entries[i], (bucket->count - i) * sizeof(yft_entry *));
+  bucket->keys[i] = entry->key;
+  bucket->entries[i] = entry;
+  bucket->count++;
+  cursor->entry = entry;
+
+  yft_assert_invariants(db);
+}
+
+static const kvds_value *yft_read(kvds_db *_db, kvds_cursor *_cursor) {
+  yft_db *db = _db;
+  yft_cursor *cursor = _cursor;
+
+  return cursor->entry != NULL ? &cursor->entry->value : NULL;
+}
+
+static bool yft_remove(kvds_db *_db, kvds_cursor *_cursor) {
+  yft_db *db = _db;
+  yft_cursor *cursor = _cursor;
+
+  if (cursor->entry == NULL) {
+    return false;
+  }
+
+  yft_bucket *bucket = yft_find_bucket(db, cursor->key);
+  int i = yft_bucket_lower_bound(bucket, cursor->key);
+  assert(bucket->entries[i] == cursor->entry);
+  memmove(&bucket->keys[i], &bucket->keys[i + 1], (bucket->count - i - 1) * sizeof(long long));
+  memmove(&bucket->entries[i], &bucket->entries[i + 1], (bucket->count - i - 1) * sizeof(yft_entry *));
+  bucket->count--;
+
+  // Keep every two neighbouring buckets more than half full together, so that the number of representatives stays proportional to the number of keys
+  if (bucket->next != NULL && bucket->count + bucket->next->count <= YFT_BUCKET_KEYS / 2) {
+    yft_bucket_merge(db, bucket->next);
+  }
+  if (bucket->prev != NULL && (bucket->count == 0 || bucket->prev->count + bucket->count <= YFT_BUCKET_KEYS / 2)) {
+    yft_bucket_merge(db, bucket);
+  }
+
+  kvds_hash_index_remove(&db->entries, yft_unsigned(cursor->key));
+  kvds_value_clear(&db->values, &cursor->entry->value);
+  kvds_arena_free(&db->entry_slots, cursor->entry);
+  cursor->entry = NULL;
+
+  yft_assert_invariants(db);
+
+  return true;
+}
+
+static void yft_snap(kvds_db *_db, kvds_cursor *_cursor, enum kvds_snap_direction dir) {
+  yft_db *db = _db;
+  yft_cursor *cursor = _cursor;
+
+  if (db->entries.count == 0) {
+    return; // Nothing in the database, nothing to find
+  }
+
+  yft_entry *found = NULL;
+  switch (dir) {
+  case KVDS_SNAP_HIGHER: {
+    found = cursor->key < LLONG_MAX ? yft_seek_higher(db, cursor->key + 1) : NULL;
+    if (found == NULL) {
+      found = cursor->entry != NULL ? cursor->entry : yft_seek_lower(db, LLONG_MAX); // Past the highest key; stay on it
+    }
+  } break;
+  case KVDS_SNAP_LOWER: {
+    found = cursor->key > LLONG_MIN ? yft_seek_lower(db, cursor->key - 1) : NULL;
+    if (found == NULL) {
+      found = cursor->entry != NULL ? cursor->entry : yft_seek_higher(db, LLONG_MIN); // Past the lowest key; stay on it
+    }
+  } break;
+  case KVDS_SNAP_CLOSEST_LOW: {
+    if (cursor->entry != NULL) {
+      found = cursor->entry; // Already at closest
+    } else {
+      yft_entry *lower = yft_seek_lower(db, cursor->key);
+      yft_entry *higher = yft_seek_higher(db, cursor->key);
+      if (lower != NULL && higher != NULL) {
+        found = (unsigned long long)cursor->key - lower->key <= (unsigned long long)higher->key - cursor->key ? lower : higher;
+      } else {
+        found = lower != NULL ? lower : higher;
+      }
+    }
+  } break;
+  }
+
+  cursor->entry = found;
+  cursor->key = found->key;
+}
+
+static void yft_iterate(kvds_db *_db, kvds_cursor *_cursor, long long to, bool (*callback)(void *context, long long key, const kvds_value *value), void *context) {
+  yft_db *db = _db;
+  yft_cursor *cursor = _cursor;
+
+  yft_bucket *bucket = yft_find_bucket(db, cursor->key);
+  for (int i = yft_bucket_lower_bound(bucket, cursor->key); bucket != NULL; bucket = bucket->next, i = 0) {
+    for (; i < bucket->count; i++) {
+      if (bucket->keys[i] > to || !callback(context, bucket->keys[i], &bucket->entries[i]->value)) {
+        return;
+      }
+    }
+  }
+}
+
+REGISTER("yfast", "yft", "Store entries in a y-fast trie: hashed prefixes of bucket representatives over small sorted buckets") = {
+  .create_db = yft_create_db,
+  .destroy_db = yft_destroy_db,
+  .create_cursor = yft_create_cursor,
+  .move_cursor = yft_move_cursor,
+  .destroy_cursor = yft_destroy_cursor,
+
+  .key = yft_key,
+  .exists = yft_exists,
+  .snap = yft_snap,
+
+  .write = yft_write,
+  .read = yft_read,
+  .remove = yft_remove,
+  .iterate = yft_iterate,
+};
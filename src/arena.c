@@ -0,0 +1,222 @@
+// SPDX-License-Identifier: MIT
+#include "arena.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef struct kvds_arena_slab {
+  struct kvds_arena_slab *next;
+  char *slots;
+  uint64_t live[]; // One bit per slot
+} kvds_arena_slab;
+
+// Header of every slot of KVDS_ALLOCATOR_MALLOC, so that they can all be found again to be released
+typedef struct kvds_arena_chunk {
+  struct kvds_arena_chunk *prev;
+  struct kvds_arena_chunk *next;
+  char slot[] __attribute__((aligned(16)));
+} kvds_arena_chunk;
+
+#define KVDS_ARENA_BITS 64
+
+static inline kvds_arena_slab *kvds_arena_slab_of(void *slot) {
+  // Slabs are aligned to their size, so the header is always at the start of the aligned block
+  return (kvds_arena_slab *)((uintptr_t)slot & ~(uintptr_t)(KVDS_ARENA_SLAB_SIZE - 1));
+}
+
+static inline void kvds_arena_mark(kvds_arena *arena, void *slot, int live) {
+  kvds_arena_slab *slab = kvds_arena_slab_of(slot);
+  size_t index = ((char *)slot - slab->slots) / arena->slot_size;
+  if (live) {
+    slab->live[index / KVDS_ARENA_BITS] |= 1ull << (index % KVDS_ARENA_BITS);
+  } else {
+    slab->live[index / KVDS_ARENA_BITS] &= ~(1ull << (index % KVDS_ARENA_BITS));
+  }
+}
+
+static void *kvds_arena_map(size_t size, bool hugetlb) {
+  if (hugetlb) {
+    void *huge = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (huge != MAP_FAILED) {
+      return huge;
+    }
+    // No huge pages reserved; fall back to regular ones
+  }
+  // Map twice the size, so that we can trim it down to an aligned block
+  char *raw = mmap(NULL, size * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) {
+    return NULL;
+  }
+  char *aligned = (char *)(((uintptr_t)raw + size - 1) & ~(uintptr_t)(size - 1));
+  if (aligned != raw) munmap(raw, aligned - raw);
+  if (aligned + size != raw + size * 2) munmap(aligned + size, raw + size * 2 - (aligned + size));
+#ifdef MADV_HUGEPAGE
+  madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+  return aligned;
+}
+
+void kvds_arena_init(kvds_arena *arena, size_t slot_size, enum kvds_allocator allocator) {
+  if (allocator == KVDS_ALLOCATOR_DEFAULT) {
+#ifdef KVDS_ARENA_HUGETLB
+    allocator = KVDS_ALLOCATOR_HUGETLB;
+#else
+    allocator = KVDS_ALLOCATOR_SLABS;
+#endif
+  }
+  if (slot_size < sizeof(void *)) slot_size = sizeof(void *);
+  slot_size = (slot_size + 7) & ~(size_t)7;
+
+  // Solve for the number of slots that fit alongside their bitmap, then leave room to align the slots to a cache line
+  size_t usable = KVDS_ARENA_SLAB_SIZE - sizeof(kvds_arena_slab) - 64;
+  size_t slots = usable * 8 / (slot_size * 8 + 1);
+  while (sizeof(uint64_t) * ((slots + KVDS_ARENA_BITS - 1) / KVDS_ARENA_BITS) + slots * slot_size > usable) slots--;
+
+  *arena = (kvds_arena){
+    .slot_size = slot_size,
+    .slots_per_slab = slots,
+    .allocator = allocator,
+    .slabs = NULL,
+    .spare = NULL,
+    .chunks = NULL,
+    .free_list = NULL,
+    .bump = NULL,
+    .bump_end = NULL,
+  };
+}
+
+void kvds_arena_reserve(kvds_arena *arena, size_t slots) {
+  if (arena->allocator == KVDS_ALLOCATOR_MALLOC) {
+    return;
+  }
+  size_t available = (arena->bump_end - arena->bump) / arena->slot_size;
+  for (kvds_arena_slab *slab = arena->spare; slab != NULL; slab = slab->next) {
+    available += arena->slots_per_slab;
+  }
+  // Pre-faulting past what is free risks getting the process killed rather than failing, so stop while half of the memory is still free, even with other arenas reserving too; alloc maps the rest as needed
+  long free_pages = sysconf(_SC_AVPHYS_PAGES);
+  long total_pages = sysconf(_SC_PHYS_PAGES);
+  long page_size = sysconf(_SC_PAGESIZE);
+  size_t budget = 0;
+  if (page_size > 0 && free_pages > total_pages / 2) {
+    budget = (size_t)(free_pages - total_pages / 2) / ((size_t)KVDS_ARENA_SLAB_SIZE / page_size);
+  }
+  for (; available < slots && budget > 0; available += arena->slots_per_slab, budget--) {
+    kvds_arena_slab *slab = kvds_arena_map(KVDS_ARENA_SLAB_SIZE, arena->allocator == KVDS_ALLOCATOR_HUGETLB);
+    if (slab == NULL) {
+      return; // Not worth failing over; alloc will try again when the slab is actually needed
+    }
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(slab, KVDS_ARENA_SLAB_SIZE, MADV_POPULATE_WRITE) != 0 && errno != EINVAL) { // EINVAL: a kernel that can't populate, rather than one out of memory
+      munmap(slab, KVDS_ARENA_SLAB_SIZE);
+      return;
+    }
+#endif
+    slab->next = arena->spare;
+    arena->spare = slab;
+  }
+}
+
+void *kvds_arena_alloc(kvds_arena *arena) {
+  void *slot;
+  if (arena->allocator == KVDS_ALLOCATOR_MALLOC) {
+    kvds_arena_chunk *chunk = malloc(sizeof(kvds_arena_chunk) + arena->slot_size);
+    if (chunk == NULL) {
+      return NULL;
+    }
+    chunk->prev = NULL;
+    chunk->next = arena->chunks;
+    if (arena->chunks != NULL) {
+      arena->chunks->prev = chunk;
+    }
+    arena->chunks = chunk;
+    return chunk->slot;
+  }
+  if (arena->free_list != NULL) {
+    slot = arena->free_list;
+    arena->free_list = *(void **)slot;
+  } else {
+    if (arena->bump == arena->bump_end) {
+      kvds_arena_slab *slab = arena->spare;
+      if (slab != NULL) {
+        arena->spare = slab->next;
+      } else {
+        slab = kvds_arena_map(KVDS_ARENA_SLAB_SIZE, arena->allocator == KVDS_ALLOCATOR_HUGETLB);
+      }
+      if (slab == NULL) {
+        return NULL;
+      }
+      size_t bitmap_size = sizeof(uint64_t) * ((arena->slots_per_slab + KVDS_ARENA_BITS - 1) / KVDS_ARENA_BITS);
+      slab->next = arena->slabs;
+      slab->slots = (char *)(((uintptr_t)&slab->live[0] + bitmap_size + 63) & ~(uintptr_t)63);
+      // The bitmap is already zeroed, as fresh anonymous mappings are
+      arena->slabs = slab;
+      arena->bump = slab->slots;
+      arena->bump_end = slab->slots + arena->slots_per_slab * arena->slot_size;
+    }
+    slot = arena->bump;
+    arena->bump += arena->slot_size;
+  }
+  kvds_arena_mark(arena, slot, 1);
+  return slot;
+}
+
+void kvds_arena_free(kvds_arena *arena, void *slot) {
+  if (arena->allocator == KVDS_ALLOCATOR_MALLOC) {
+    kvds_arena_chunk *chunk = (kvds_arena_chunk *)((char *)slot - offsetof(kvds_arena_chunk, slot));
+    if (chunk->prev != NULL) {
+      chunk->prev->next = chunk->next;
+    } else {
+      arena->chunks = chunk->next;
+    }
+    if (chunk->next != NULL) {
+      chunk->next->prev = chunk->prev;
+    }
+    free(chunk);
+    return;
+  }
+  kvds_arena_mark(arena, slot, 0);
+  *(void **)slot = arena->free_list;
+  arena->free_list = slot;
+}
+
+void kvds_arena_foreach(kvds_arena *arena, void (*callback)(void *slot, void *context), void *context) {
+  for (kvds_arena_chunk *chunk = arena->chunks; chunk != NULL;) {
+    kvds_arena_chunk *next = chunk->next; // In case the callback frees it
+    callback(chunk->slot, context);
+    chunk = next;
+  }
+  for (kvds_arena_slab *slab = arena->slabs; slab != NULL; slab = slab->next) {
+    for (size_t word = 0; word * KVDS_ARENA_BITS < arena->slots_per_slab; word++) {
+      uint64_t bits = slab->live[word];
+      while (bits != 0) {
+        size_t index = word * KVDS_ARENA_BITS + __builtin_ctzll(bits);
+        bits &= bits - 1;
+        callback(slab->slots + index * arena->slot_size, context);
+      }
+    }
+  }
+}
+
+void kvds_arena_release(kvds_arena *arena) {
+  kvds_arena_slab *lists[] = {arena->slabs, arena->spare};
+  for (int i = 0; i < 2; i++) {
+    kvds_arena_slab *slab = lists[i];
+    while (slab != NULL) {
+      kvds_arena_slab *next = slab->next;
+      munmap(slab, KVDS_ARENA_SLAB_SIZE);
+      slab = next;
+    }
+  }
+  while (arena->chunks != NULL) {
+    kvds_arena_chunk *next = arena->chunks->next;
+    free(arena->chunks);
+    arena->chunks = next;
+  }
+  kvds_arena_init(arena, arena->slot_size, arena->allocator);
+}
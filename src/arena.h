@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: MIT
+#pragma once
+#include <stddef.h>
+
+// Fixed-size slot allocator for the nodes of a single database.
+// Slots are carved out of large, size-aligned slabs, and freed slots are kept on an intrusive free list, so nodes carry no malloc headers and destroying a database only needs to unmap its slabs.
+// Each slab also keeps a bitmap of live slots, so that the data owned by the nodes can be released without walking the data structure.
+// Slabs are advised to use transparent huge pages, unless the arena is told to try explicit huge pages first (the default when KVDS_ARENA_HUGETLB is defined), or to skip slabs altogether and malloc every slot.
+
+#define KVDS_ARENA_SLAB_SIZE (2ul << 20)
+
+enum kvds_allocator {
+  KVDS_ALLOCATOR_DEFAULT, // KVDS_ALLOCATOR_HUGETLB if KVDS_ARENA_HUGETLB is defined, KVDS_ALLOCATOR_SLABS otherwise
+  KVDS_ALLOCATOR_SLABS,
+  KVDS_ALLOCATOR_HUGETLB, // Slabs backed by explicitly-reserved huge pages, falling back to regular slabs when there are none
+  KVDS_ALLOCATOR_MALLOC, // Every slot malloc-ed on its own, for comparison or for memory checkers
+};
+
+typedef struct kvds_arena {
+  size_t slot_size;
+  size_t slots_per_slab;
+  enum kvds_allocator allocator; // Never KVDS_ALLOCATOR_DEFAULT
+  struct kvds_arena_slab *slabs; // Newest first
+  struct kvds_arena_slab *spare; // Mapped by kvds_arena_reserve, not used yet
+  struct kvds_arena_chunk *chunks; // Live slots of KVDS_ALLOCATOR_MALLOC
+  void *free_list; // Freed slots; each holds a pointer to the next one
+  char *bump; // Never-used slots left in the newest slab
+  char *bump_end;
+} kvds_arena;
+
+void kvds_arena_init(kvds_arena *arena, size_t slot_size, enum kvds_allocator allocator);
+void kvds_arena_reserve(kvds_arena *arena, size_t slots); // Maps and pre-faults enough slabs for that many more slots up front, so that allocating them later takes no system calls or page faults; stops short once less than half of the memory is left free, or on the first slab that can't be had
+void *kvds_arena_alloc(kvds_arena *arena);
+void kvds_arena_free(kvds_arena *arena, void *slot);
+void kvds_arena_foreach(kvds_arena *arena, void (*callback)(void *slot, void *context), void *context); // Visits live slots only, in memory order (or newest first, for KVDS_ALLOCATOR_MALLOC)
+void kvds_arena_release(kvds_arena *arena); // Frees all slots at once
@@ -0,0 +1,604 @@
+// SPDX-License-Identifier: MIT
+#include "ebr.h"
+#include "interface.h"
+#include "registry.h"
+#include "wal.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Drives the algorithms directly through their vtables, so that none of the parsing/stdio cost of bin/kvds ends up in the measurements.
+
+enum bench_op {
+  BENCH_MOVE, // Every request starts by moving the cursor to its key
+  BENCH_READ,
+  BENCH_WRITE,
+  BENCH_REMOVE,
+  BENCH_SNAP,
+  BENCH_OP_COUNT,
+};
+
+static const char *bench_op_names[BENCH_OP_COUNT] = {"move", "read", "write", "remove", "snap"};
+
+typedef struct bench_request {
+  long long key;
+  enum bench_op op;
+} bench_request;
+
+typedef struct bench_config {
+  long long requests;
+  long long keys;
+  uint64_t seed;
+  double zipf_exponent; // s for the zipf workload
+  kvds_options options; // Given to every database created
+} bench_config;
+
+typedef struct bench_workload {
+  const char *name;
+  const char *description;
+  void (*generate)(bench_config *config, bench_request *requests, long long **prefill, long long *prefill_count);
+} bench_workload;
+
+static const char bench_data[] = "0123456789abcdef\n";
+static const kvds_value bench_value = {.length = sizeof bench_data - 1, .kind = KVDS_VALUE_TRANSIENT, .pointer = bench_data}; // Copied into the database by every write
+
+// RNG: splitmix64, so that runs are reproducible for a given seed
+
+static uint64_t bench_random(uint64_t *state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+static long long bench_random_below(uint64_t *state, long long bound) {
+  return (long long)(bench_random(state) % (uint64_t)bound);
+}
+
+static enum bench_op bench_pick_op(uint64_t *state, int read, int write, int remove, int snap) {
+  int roll = bench_random_below(state, read + write + remove + snap);
+  if (roll < read) return BENCH_READ;
+  roll -= read;
+  if (roll < write) return BENCH_WRITE;
+  roll -= write;
+  if (roll < remove) return BENCH_REMOVE;
+  return BENCH_SNAP;
+}
+
+static long long *bench_shuffled_keys(bench_config *config, uint64_t *state) {
+  long long *keys = malloc(config->keys * sizeof(long long));
+  for (long long i = 0; i < config->keys; i++) keys[i] = i;
+  for (long long i = config->keys - 1; i > 0; i--) { // Fisher-Yates
+    long long j = bench_random_below(state, i + 1);
+    long long tmp = keys[i];
+    keys[i] = keys[j];
+    keys[j] = tmp;
+  }
+  return keys;
+}
+
+// Workloads
+
+static void bench_gen_sequential(bench_config *config, bench_request *requests, long long **prefill, long long *prefill_count) {
+  uint64_t state = config->seed;
+  for (long long i = 0; i < config->requests; i++) {
+    requests[i].key = i % config->keys;
+    requests[i].op = i < config->keys ? BENCH_WRITE : bench_pick_op(&state, 70, 20, 0, 10);
+  }
+  *prefill = NULL;
+  *prefill_count = 0;
+}
+
+static void bench_gen_uniform(bench_config *config, bench_request *requests, long long **prefill, long long *prefill_count) {
+  uint64_t state = config->seed;
+  for (long long i = 0; i < config->requests; i++) {
+    requests[i].key = bench_random_below(&state, config->keys);
+    requests[i].op = bench_pick_op(&state, 60, 20, 10, 10);
+  }
+  *prefill = bench_shuffled_keys(config, &state);
+  *prefill_count = config->keys;
+}
+
+static void bench_gen_zipf(bench_config *config, bench_request *requests, long long **prefill, long long *prefill_count) {
+  // Zipf: P(rank i) ~ 1/i^s. Sampled by binary search over the precomputed CDF, and the ranks are scattered over the keyspace so that hot keys don't cluster.
+  uint64_t state = config->seed;
+  double *cdf = malloc(config->keys * sizeof(double));
+  double total = 0;
+  for (long long i = 0; i < config->keys; i++) {
+    total += pow(i + 1, -config->zipf_exponent);
+    cdf[i] = total;
+  }
+  long long *scatter = bench_shuffled_keys(config, &state);
+  for (long long i = 0; i < config->requests; i++) {
+    double target = (bench_random(&state) >> 11) * (1.0 / (1ull << 53)) * total;
+    long long low = 0, high = config->keys - 1;
+    while (low < high) {
+      long long middle = low + (high - low) / 2;
+      if (cdf[middle] < target) {
+        low = middle + 1;
+      } else {
+        high = middle;
+      }
+    }
+    requests[i].key = scatter[low];
+    requests[i].op = bench_pick_op(&state, 80, 15, 0, 5);
+  }
+  free(cdf);
+  free(scatter);
+  *prefill = bench_shuffled_keys(config, &state);
+  *prefill_count = config->keys;
+}
+
+static void bench_gen_window(bench_config *config, bench_request *requests, long long **prefill, long long *prefill_count) {
+  // A window of `keys` live keys sliding upwards: insert at the head, expire at the tail, read in between
+  uint64_t state = config->seed;
+  long long tail = 0;
+  long long head = config->keys;
+  for (long long i = 0; i < config->requests; i++) {
+    switch (i % 4) {
+    case 0:
+      requests[i].key = head++;
+      requests[i].op = BENCH_WRITE;
+      break;
+    case 1:
+      requests[i].key = tail++;
+      requests[i].op = BENCH_REMOVE;
+      break;
+    default:
+      requests[i].key = tail + bench_random_below(&state, head - tail);
+      requests[i].op = bench_pick_op(&state, 80, 0, 0, 20);
+      break;
+    }
+  }
+  *prefill = malloc(config->keys * sizeof(long long));
+  for (long long i = 0; i < config->keys; i++) (*prefill)[i] = i;
+  *prefill_count = config->keys;
+}
+
+static void bench_gen_delete(bench_config *config, bench_request *requests, long long **prefill, long long *prefill_count) {
+  uint64_t state = config->seed;
+  for (long long i = 0; i < config->requests; i++) {
+    requests[i].key = bench_random_below(&state, config->keys);
+    requests[i].op = bench_pick_op(&state, 10, 30, 60, 0);
+  }
+  *prefill = bench_shuffled_keys(config, &state);
+  *prefill_count = config->keys;
+}
+
+static void bench_gen_snap(bench_config *config, bench_request *requests, long long **prefill, long long *prefill_count) {
+  // Only even keys exist, so that half of the snaps start from a key that doesn't
+  uint64_t state = config->seed;
+  for (long long i = 0; i < config->requests; i++) {
+    requests[i].key = bench_random_below(&state, 2 * config->keys);
+    requests[i].op = bench_pick_op(&state, 10, 5, 5, 80);
+  }
+  *prefill = bench_shuffled_keys(config, &state);
+  for (long long i = 0; i < config->keys; i++) (*prefill)[i] *= 2;
+  *prefill_count = config->keys;
+}
+
+static bench_workload bench_workloads[] = {
+  {"sequential", "Write keys in ascending order, then read them again in order", bench_gen_sequential},
+  {"uniform", "Uniformly random keys; mostly reads", bench_gen_uniform},
+  {"zipf", "Zipf-distributed keys (s = 1 unless set with -z); mostly reads", bench_gen_zipf},
+  {"window", "Sliding window: insert at the top, delete at the bottom, read in between", bench_gen_window},
+  {"delete", "Uniformly random keys; mostly deletes", bench_gen_delete},
+  {"snap", "Uniformly random keys, half of them missing; mostly snaps to the next key", bench_gen_snap},
+};
+
+#define BENCH_WORKLOADS_COUNT (sizeof bench_workloads / sizeof bench_workloads[0])
+
+// Measurement
+
+static inline long long bench_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+static int bench_compare_latency(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static uint32_t bench_percentile(uint32_t *sorted, long long count, int per_mille) {
+  long long i = count * per_mille / 1000;
+  return sorted[i < count ? i : count - 1];
+}
+
+static void bench_run(struct kvds_database_algo *algo, const char *algo_name, bench_workload *workload, bench_config *config) {
+  bench_request *requests = malloc(config->requests * sizeof(bench_request));
+  long long *prefill;
+  long long prefill_count;
+  workload->generate(config, requests, &prefill, &prefill_count);
+
+  uint32_t *latencies[BENCH_OP_COUNT];
+  long long counts[BENCH_OP_COUNT] = {0};
+  long long totals[BENCH_OP_COUNT] = {0};
+  for (int op = 0; op < BENCH_OP_COUNT; op++) {
+    latencies[op] = malloc(config->requests * sizeof(uint32_t));
+  }
+
+  kvds_db *db = algo->create_db(&config->options);
+  kvds_cursor *cursor = algo->create_cursor(db, 0);
+
+  for (long long i = 0; i < prefill_count; i++) {
+    algo->move_cursor(db, cursor, prefill[i]);
+    algo->write(db, cursor, &bench_value);
+  }
+  free(prefill);
+
+  long long started = bench_now();
+  for (long long i = 0; i < config->requests; i++) {
+    long long t0 = bench_now();
+    algo->move_cursor(db, cursor, requests[i].key);
+    long long t1 = bench_now();
+    switch (requests[i].op) {
+    case BENCH_READ:
+      algo->read(db, cursor);
+      break;
+    case BENCH_WRITE:
+      algo->write(db, cursor, &bench_value);
+      break;
+    case BENCH_REMOVE:
+      algo->remove(db, cursor);
+      break;
+    case BENCH_SNAP:
+      algo->snap(db, cursor, KVDS_SNAP_HIGHER);
+      break;
+    default:
+      break;
+    }
+    long long t2 = bench_now();
+
+    enum bench_op op = requests[i].op;
+    latencies[BENCH_MOVE][counts[BENCH_MOVE]++] = t1 - t0;
+    latencies[op][counts[op]++] = t2 - t1;
+    totals[BENCH_MOVE] += t1 - t0;
+    totals[op] += t2 - t1;
+  }
+  long long elapsed = bench_now() - started;
+
+  algo->destroy_cursor(db, cursor);
+  algo->destroy_db(db);
+
+  printf("%-12s %-12s %-8s %10.0f %10s\n", algo_name, workload->name, "total", config->requests * 1e9 / elapsed, "");
+  for (int op = 0; op < BENCH_OP_COUNT; op++) {
+    if (counts[op] == 0) {
+      free(latencies[op]);
+      continue;
+    }
+    qsort(latencies[op], counts[op], sizeof(uint32_t), bench_compare_latency);
+    printf("%-12s %-12s %-8s %10.0f %10lld %8u %8u %8u\n", algo_name, workload->name, bench_op_names[op],
+      counts[op] * 1e9 / (totals[op] > 0 ? totals[op] : 1), counts[op],
+      bench_percentile(latencies[op], counts[op], 500),
+      bench_percentile(latencies[op], counts[op], 990),
+      bench_percentile(latencies[op], counts[op], 999));
+    free(latencies[op]);
+  }
+  fflush(stdout);
+
+  free(requests);
+}
+
+// Same as a write-only uniform workload, but with every write also appended to a write-ahead log, which gets committed once per group of writes
+static void bench_wal(struct kvds_database_algo *algo, const char *algo_name, const char *path, const char *sync_name, long long group, bench_config *config) {
+  enum kvds_wal_sync sync;
+  kvds_wal_parse_sync(sync_name, &sync);
+  long long requests = config->requests;
+  if (sync == KVDS_WAL_SYNC_ALWAYS && requests > 10000) {
+    requests = 10000; // One fdatasync per write; don't wait on the disk all day
+  }
+
+  unlink(path);
+  kvds_wal *wal = kvds_wal_open(path, sync, 0, NULL, NULL);
+  if (wal == NULL) {
+    fprintf(stderr, "Error: Could not open %s\n", path);
+    return;
+  }
+
+  uint32_t *latencies = malloc(requests * sizeof(uint32_t));
+  uint64_t random_state = config->seed;
+  kvds_db *db = algo->create_db(&config->options);
+  kvds_cursor *cursor = algo->create_cursor(db, 0);
+
+  long long started = bench_now();
+  for (long long i = 0; i < requests; i++) {
+    long long key = bench_random_below(&random_state, config->keys);
+    long long t0 = bench_now();
+    algo->move_cursor(db, cursor, key);
+    algo->write(db, cursor, &bench_value);
+    kvds_wal_append(wal, KVDS_WAL_WRITE, key, bench_data, bench_value.length);
+    if ((i + 1) % group == 0) {
+      kvds_wal_flush_point(wal, true);
+    }
+    latencies[i] = bench_now() - t0;
+  }
+  kvds_wal_commit(wal);
+  long long elapsed = bench_now() - started;
+  long long commits = wal->commits;
+
+  kvds_wal_close(wal);
+  unlink(path);
+  algo->destroy_cursor(db, cursor);
+  algo->destroy_db(db);
+
+  char workload_name[32];
+  snprintf(workload_name, sizeof workload_name, "wal-%s", sync_name);
+  qsort(latencies, requests, sizeof(uint32_t), bench_compare_latency);
+  printf("%-12s %-12s %-8s %10.0f %10lld %8u %8u %8u\n", algo_name, workload_name, "write",
+    requests * 1e9 / elapsed, requests,
+    bench_percentile(latencies, requests, 500),
+    bench_percentile(latencies, requests, 990),
+    bench_percentile(latencies, requests, 999));
+  printf("%-12s %-12s %-8s %10.0f %10lld\n", algo_name, workload_name, "commit", commits * 1e9 / elapsed, commits);
+  fflush(stdout);
+
+  free(latencies);
+}
+
+// Reader threads doing random reads while a single writer thread keeps updating and deleting random keys, for algorithms that allow concurrent readers
+
+#define BENCH_READER_BATCH 64 // Reads per critical section
+
+typedef struct bench_thread {
+  struct kvds_database_algo *algo;
+  kvds_db *db;
+  long long keys;
+  long long requests; // Readers only
+  uint64_t seed;
+  bool stop; // Writer only; set once all readers are done
+  long long operations;
+  long long checksum; // Keeps the reads from being optimized away
+  long long elapsed;
+} bench_thread;
+
+static void *bench_reader_run(void *_thread) {
+  bench_thread *thread = _thread;
+  struct kvds_database_algo *algo = thread->algo;
+  uint64_t random_state = thread->seed;
+
+  kvds_ebr_enter();
+  kvds_cursor *cursor = algo->create_cursor(thread->db, 0);
+  kvds_ebr_exit();
+
+  long long started = bench_now();
+  for (long long i = 0; i < thread->requests; i += BENCH_READER_BATCH) {
+    kvds_ebr_enter(); // Every read moves the cursor first, so it never carries over a node from the last batch
+    for (long long j = i; j < i + BENCH_READER_BATCH && j < thread->requests; j++) {
+      algo->move_cursor(thread->db, cursor, bench_random_below(&random_state, thread->keys));
+      const kvds_value *value = algo->read(thread->db, cursor);
+      if (value != NULL) {
+        thread->checksum += kvds_value_data(value)[value->length - 1];
+      }
+      thread->operations++;
+    }
+    kvds_ebr_exit();
+  }
+  thread->elapsed = bench_now() - started;
+
+  algo->destroy_cursor(thread->db, cursor);
+  return NULL;
+}
+
+static void *bench_writer_run(void *_thread) {
+  bench_thread *thread = _thread;
+  struct kvds_database_algo *algo = thread->algo;
+  uint64_t random_state = thread->seed;
+  kvds_cursor *cursor = algo->create_cursor(thread->db, 0);
+
+  long long started = bench_now();
+  while (!__atomic_load_n(&thread->stop, __ATOMIC_RELAXED)) {
+    algo->move_cursor(thread->db, cursor, bench_random_below(&random_state, thread->keys));
+    if (bench_pick_op(&random_state, 0, 80, 20, 0) == BENCH_WRITE) {
+      algo->write(thread->db, cursor, &bench_value);
+    } else {
+      algo->remove(thread->db, cursor);
+    }
+    thread->operations++;
+  }
+  thread->elapsed = bench_now() - started;
+
+  algo->destroy_cursor(thread->db, cursor);
+  return NULL;
+}
+
+static void bench_readers(struct kvds_database_algo *algo, const char *algo_name, int readers, bench_config *config) {
+  uint64_t random_state = config->seed;
+  kvds_options options = config->options;
+  options.concurrent_readers = true;
+  kvds_db *db = algo->create_db(&options);
+  kvds_cursor *cursor = algo->create_cursor(db, 0);
+  long long *prefill = bench_shuffled_keys(config, &random_state);
+  for (long long i = 0; i < config->keys; i++) {
+    algo->move_cursor(db, cursor, prefill[i]);
+    algo->write(db, cursor, &bench_value);
+  }
+  free(prefill);
+  algo->destroy_cursor(db, cursor);
+
+  bench_thread *threads = calloc(readers + 1, sizeof(bench_thread));
+  pthread_t *handles = malloc((readers + 1) * sizeof(pthread_t));
+  for (int i = 0; i <= readers; i++) {
+    threads[i] = (bench_thread){
+      .algo = algo,
+      .db = db,
+      .keys = config->keys,
+      .requests = config->requests,
+      .seed = bench_random(&random_state),
+    };
+  }
+  // threads[0] is the writer
+  pthread_create(&handles[0], NULL, bench_writer_run, &threads[0]);
+  long long started = bench_now();
+  for (int i = 1; i <= readers; i++) {
+    pthread_create(&handles[i], NULL, bench_reader_run, &threads[i]);
+  }
+  long long reads = 0;
+  for (int i = 1; i <= readers; i++) {
+    pthread_join(handles[i], NULL);
+    reads += threads[i].operations;
+  }
+  long long elapsed = bench_now() - started;
+  __atomic_store_n(&threads[0].stop, true, __ATOMIC_RELAXED);
+  pthread_join(handles[0], NULL);
+
+  algo->destroy_db(db);
+
+  char workload_name[32];
+  snprintf(workload_name, sizeof workload_name, "readers-%d", readers);
+  printf("%-12s %-12s %-8s %10.0f %10lld\n", algo_name, workload_name, "read", reads * 1e9 / elapsed, reads);
+  printf("%-12s %-12s %-8s %10.0f %10lld\n", algo_name, workload_name, "write", threads[0].operations * 1e9 / threads[0].elapsed, threads[0].operations);
+  fflush(stdout);
+
+  free(threads);
+  free(handles);
+}
+
+static void print_usage(char **argv) {
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr, "  %s [-n requests] [-k keys] [-s seed] [-w workload,...] [-z zipf-exponent] [-o name=value...] [algorithm...]\n", argv[0]);
+  fprintf(stderr, "  %s -l log-path [-g group] [-n requests] [-k keys] [-s seed] [algorithm...]\n", argv[0]);
+  fprintf(stderr, "  %s -t threads [-n requests] [-k keys] [-s seed] [algorithm...]\n\n", argv[0]);
+  fprintf(stderr, "Defaults: -n 200000 -k 10000 -s 1 -z 1, all workloads, algorithms lst and scg.\n");
+  fprintf(stderr, "With -l, measures writes through a write-ahead log at log-path under each fsync policy instead, committing every -g writes (default 64).\n");
+  fprintf(stderr, "With -t, measures 1, 2, 4, ... up to threads reader threads doing -n random reads each, while one writer thread keeps updating and deleting random keys; only for algorithms that allow concurrent readers.\n\n");
+  fprintf(stderr, "Any of the database options below can be given with -o, once for each:\n");
+  kvds_options_print_usage(stderr);
+  fprintf(stderr, "\nAvailable workloads:\n");
+  for (unsigned long i = 0; i < BENCH_WORKLOADS_COUNT; i++) {
+    fprintf(stderr, "  %s - %s\n", bench_workloads[i].name, bench_workloads[i].description);
+  }
+  fprintf(stderr, "\nAvailable algorithms: see `kvds help`.\n");
+}
+
+int main(int argc, char **argv) {
+  bench_config config = {
+    .requests = 200000,
+    .keys = 10000,
+    .seed = 1,
+    .zipf_exponent = 1,
+  };
+  char *workloads = NULL;
+  char *wal_path = NULL;
+  long long wal_group = 64;
+  int reader_threads = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:k:s:w:z:o:l:g:t:h")) != -1) {
+    switch (opt) {
+    case 'n':
+      config.requests = strtoll(optarg, NULL, 10);
+      break;
+    case 'k':
+      config.keys = strtoll(optarg, NULL, 10);
+      break;
+    case 's':
+      config.seed = strtoull(optarg, NULL, 10);
+      break;
+    case 'w':
+      workloads = optarg;
+      break;
+    case 'z':
+      config.zipf_exponent = strtod(optarg, NULL);
+      if (!(config.zipf_exponent > 0)) {
+        fprintf(stderr, "Error: -z must be positive.\n");
+        return 2;
+      }
+      break;
+    case 'o':
+      if (!kvds_options_parse(optarg, &config.options)) {
+        fprintf(stderr, "Error: Invalid option: %s\n", optarg);
+        return 2;
+      }
+      break;
+    case 'l':
+      wal_path = optarg;
+      break;
+    case 'g':
+      wal_group = strtoll(optarg, NULL, 10);
+      break;
+    case 't':
+      reader_threads = strtol(optarg, NULL, 10);
+      if (reader_threads <= 0) {
+        fprintf(stderr, "Error: -t must be positive.\n");
+        return 2;
+      }
+      break;
+    case 'h':
+      print_usage(argv);
+      return 0;
+    default:
+      print_usage(argv);
+      return 2;
+    }
+  }
+  if (config.requests <= 0 || config.keys <= 0 || wal_group <= 0) {
+    fprintf(stderr, "Error: -n, -k, and -g must be positive.\n");
+    return 2;
+  }
+
+  char *default_algos[] = {"lst", "scg"};
+  char **algo_names = optind < argc ? &argv[optind] : default_algos;
+  int algos_count = optind < argc ? argc - optind : 2;
+
+  for (int i = 0; i < algos_count; i++) {
+    if (kvds_get_algo(algo_names[i]) == NULL) {
+      fprintf(stderr, "Error: No such algorithm: %s\n", algo_names[i]);
+      return 2;
+    }
+    if (reader_threads > 0 && !kvds_get_algo(algo_names[i])->concurrent_readers) {
+      fprintf(stderr, "Error: %s does not allow concurrent readers.\n", algo_names[i]);
+      return 2;
+    }
+  }
+
+#ifndef NDEBUG
+  fprintf(stderr, "Warning: assertions are enabled; invariant checks will dominate the results. Build with -DNDEBUG for meaningful numbers.\n");
+#endif
+
+  printf("%-12s %-12s %-8s %10s %10s %8s %8s %8s\n", "algorithm", "workload", "op", "ops/s", "count", "p50(ns)", "p99(ns)", "p999(ns)");
+  if (wal_path != NULL) {
+    const char *syncs[] = {"always", "group", "none"};
+    for (unsigned long s = 0; s < sizeof syncs / sizeof syncs[0]; s++) {
+      for (int i = 0; i < algos_count; i++) {
+        bench_wal(kvds_get_algo(algo_names[i]), algo_names[i], wal_path, syncs[s], wal_group, &config);
+      }
+    }
+    return 0;
+  }
+  if (reader_threads > 0) {
+    for (int readers = 1;; readers = readers * 2 < reader_threads ? readers * 2 : reader_threads) {
+      for (int i = 0; i < algos_count; i++) {
+        bench_readers(kvds_get_algo(algo_names[i]), algo_names[i], readers, &config);
+      }
+      if (readers == reader_threads) break;
+    }
+    return 0;
+  }
+  for (unsigned long w = 0; w < BENCH_WORKLOADS_COUNT; w++) {
+    if (workloads != NULL) { // Only run the workloads listed in -w
+      unsigned long name_len = strlen(bench_workloads[w].name);
+      bool listed = false;
+      for (char *item = workloads; item != NULL; item = strchr(item, ',')) {
+        if (item[0] == ',') item++;
+        if (strncmp(item, bench_workloads[w].name, name_len) == 0 && (item[name_len] == ',' || item[name_len] == '\0')) {
+          listed = true;
+        }
+      }
+      if (!listed) continue;
+    }
+    for (int i = 0; i < algos_count; i++) {
+      bench_run(kvds_get_algo(algo_names[i]), algo_names[i], &bench_workloads[w], &config);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,351 @@
+// SPDX-License-Identifier: MIT
+#include "binary.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define KVDS_BINARY_READ_SIZE (1024 * 1024) // Grown as needed to fit a whole request
+#define KVDS_BINARY_WRITE_SIZE (1024 * 1024)
+#define KVDS_BINARY_IOVECS 1024
+#define KVDS_BINARY_REFERENCE 4096 // Values at least this long are written straight from the database instead of being copied
+#define KVDS_BINARY_VARINT_MAX 10
+
+typedef struct kvds_binary_output {
+  int fd;
+  char *buffer;
+  size_t used;
+  size_t pending; // Start of the bytes in buffer not yet covered by an iovec
+  struct iovec iovecs[KVDS_BINARY_IOVECS];
+  int iovec_count;
+  bool references; // Whether any iovec points into the database, and hence must be written before it changes
+} kvds_binary_output;
+
+static bool kvds_binary_write_all(kvds_binary_output *output) {
+  struct iovec *iovec = output->iovecs;
+  int count = output->iovec_count;
+  while (count > 0) {
+    ssize_t written = writev(output->fd, iovec, count);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    // Skip past whatever made it out, in case of a partial write
+    while (count > 0 && (size_t)written >= iovec->iov_len) {
+      written -= iovec->iov_len;
+      iovec++;
+      count--;
+    }
+    if (count > 0) {
+      iovec->iov_base = (char *)iovec->iov_base + written;
+      iovec->iov_len -= written;
+    }
+  }
+  return true;
+}
+
+static void kvds_binary_seal(kvds_binary_output *output) {
+  if (output->used > output->pending) {
+    output->iovecs[output->iovec_count++] = (struct iovec){.iov_base = output->buffer + output->pending, .iov_len = output->used - output->pending};
+    output->pending = output->used;
+  }
+}
+
+static bool kvds_binary_flush(kvds_binary_output *output) {
+  kvds_binary_seal(output);
+  bool written = kvds_binary_write_all(output);
+  output->used = 0;
+  output->pending = 0;
+  output->iovec_count = 0;
+  output->references = false;
+  return written;
+}
+
+static bool kvds_binary_put(kvds_binary_output *output, const char *bytes, size_t length) {
+  if (length >= KVDS_BINARY_REFERENCE) {
+    if (output->iovec_count + 2 > KVDS_BINARY_IOVECS && !kvds_binary_flush(output)) {
+      return false;
+    }
+    kvds_binary_seal(output);
+    output->iovecs[output->iovec_count++] = (struct iovec){.iov_base = (char *)bytes, .iov_len = length};
+    output->references = true;
+    return true;
+  }
+  if ((output->used + length > KVDS_BINARY_WRITE_SIZE || output->iovec_count + 1 >= KVDS_BINARY_IOVECS) && !kvds_binary_flush(output)) {
+    return false;
+  }
+  memcpy(output->buffer + output->used, bytes, length);
+  output->used += length;
+  return true;
+}
+
+static bool kvds_binary_put_varint(kvds_binary_output *output, unsigned long long value) {
+  char bytes[KVDS_BINARY_VARINT_MAX];
+  size_t length = 0;
+  do {
+    bytes[length] = value & 0x7f;
+    value >>= 7;
+    if (value != 0) {
+      bytes[length] |= 0x80;
+    }
+    length++;
+  } while (value != 0);
+  return kvds_binary_put(output, bytes, length);
+}
+
+static bool kvds_binary_put_key(kvds_binary_output *output, long long key) {
+  return kvds_binary_put_varint(output, ((unsigned long long)key << 1) ^ (unsigned long long)(key >> 63));
+}
+
+static bool kvds_binary_put_byte(kvds_binary_output *output, char byte) {
+  return kvds_binary_put(output, &byte, 1);
+}
+
+// Returns the number of bytes taken, or 0 if the varint doesn't end before end (or is too long to be one)
+static size_t kvds_binary_take_varint(const unsigned char *bytes, const unsigned char *end, unsigned long long *value) {
+  *value = 0;
+  for (size_t i = 0; i < KVDS_BINARY_VARINT_MAX && bytes + i < end; i++) {
+    *value |= (unsigned long long)(bytes[i] & 0x7f) << (7 * i);
+    if (!(bytes[i] & 0x80)) {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+static long long kvds_binary_unzigzag(unsigned long long value) {
+  return (long long)(value >> 1) ^ -(long long)(value & 1);
+}
+
+typedef struct kvds_binary_scan_context {
+  kvds_binary_output *output;
+  unsigned long long remaining; // 0 for no limit
+  bool failed;
+} kvds_binary_scan_context;
+
+static bool kvds_binary_scan_put(void *_context, long long key, const kvds_value *value) {
+  kvds_binary_scan_context *context = _context;
+  if (!kvds_binary_put_byte(context->output, '+') || !kvds_binary_put_key(context->output, key) || !kvds_binary_put_varint(context->output, value->length) || !kvds_binary_put(context->output, kvds_value_data(value), value->length)) {
+    context->failed = true;
+    return false;
+  }
+  return context->remaining == 0 || --context->remaining != 0;
+}
+
+// Executes a single request from the start of bytes
+// Returns the request's size, 0 if it isn't all there yet, or -1 once the session should stop (with *result saying why)
+static ssize_t kvds_binary_execute(struct kvds_command_state *state, kvds_binary_output *output, const unsigned char *bytes, const unsigned char *end, kvds_error *result) {
+  const unsigned char *at = bytes + 1;
+  kvds_error error = KVDS_OK;
+  bool written = true;
+
+#define TAKE_VARINT(name)                                          \
+  unsigned long long name;                                         \
+  do {                                                             \
+    size_t taken = kvds_binary_take_varint(at, end, &name);        \
+    if (taken == 0) {                                              \
+      if (end - at >= KVDS_BINARY_VARINT_MAX) {                    \
+        *result = KVDS_MALFORMED;                                  \
+        return -1;                                                 \
+      }                                                            \
+      return 0;                                                    \
+    }                                                              \
+    at += taken;                                                   \
+  } while (0)
+
+  switch (bytes[0]) {
+  case 's': {
+    TAKE_VARINT(key);
+    kvds_command_select(state, kvds_binary_unzigzag(key));
+    break;
+  }
+  case 'k':
+    if (!state->algo->key) {
+      error = KVDS_UNIMPLEMENTED;
+      break;
+    }
+    written = kvds_binary_put_byte(output, 'k') && kvds_binary_put_key(output, state->algo->key(state->db, state->cursor));
+    break;
+  case 'e':
+    if (!state->algo->exists) {
+      error = KVDS_UNIMPLEMENTED;
+      break;
+    }
+    written = kvds_binary_put_byte(output, state->algo->exists(state->db, state->cursor) ? 'y' : 'n');
+    break;
+  case 'r': {
+    if (!state->algo->read) {
+      error = KVDS_UNIMPLEMENTED;
+      break;
+    }
+    const kvds_value *stored = state->algo->read(state->db, state->cursor);
+    if (stored == NULL) {
+      written = kvds_binary_put_byte(output, '-');
+    } else {
+      written = kvds_binary_put_byte(output, 'v') && kvds_binary_put_varint(output, stored->length) && kvds_binary_put(output, kvds_value_data(stored), stored->length);
+    }
+    break;
+  }
+  case 'w': {
+    TAKE_VARINT(length);
+    if (length > UINT32_MAX) {
+      *result = KVDS_MALFORMED;
+      return -1;
+    }
+    if ((unsigned long long)(end - at) < length) {
+      return 0;
+    }
+    if (output->references && !kvds_binary_flush(output)) { // The write might free a value we still have to send
+      *result = KVDS_IO_ERROR;
+      return -1;
+    }
+    kvds_value value = kvds_value_wrap((const char *)at, length); // Copied by the database before the read buffer is reused
+    at += length;
+    error = kvds_command_write(state, &value);
+    break;
+  }
+  case 'd':
+    if (output->references && !kvds_binary_flush(output)) {
+      *result = KVDS_IO_ERROR;
+      return -1;
+    }
+    error = kvds_command_delete(state);
+    break;
+  case 'p':
+  case 'n':
+  case 'c':
+    if (!state->algo->snap) {
+      error = KVDS_UNIMPLEMENTED;
+      break;
+    }
+    state->algo->snap(state->db, state->cursor, bytes[0] == 'p' ? KVDS_SNAP_LOWER : bytes[0] == 'n' ? KVDS_SNAP_HIGHER : KVDS_SNAP_CLOSEST_LOW);
+    break;
+  case 'S': {
+    TAKE_VARINT(from);
+    TAKE_VARINT(to);
+    TAKE_VARINT(limit);
+    if (!state->algo->iterate && !(state->algo->exists && state->algo->read && state->algo->snap)) {
+      error = KVDS_UNIMPLEMENTED;
+      break;
+    }
+    if (kvds_binary_unzigzag(limit) < 0) {
+      error = KVDS_INVALID_ARGUMENT;
+      break;
+    }
+    kvds_binary_scan_context context = {
+      .output = output,
+      .remaining = kvds_binary_unzigzag(limit),
+      .failed = false,
+    };
+    kvds_iterate(state, kvds_binary_unzigzag(from), kvds_binary_unzigzag(to), kvds_binary_scan_put, &context);
+    written = !context.failed && kvds_binary_put_byte(output, '.');
+    break;
+  }
+  case 'R':
+    written = kvds_binary_put_byte(output, '#') && kvds_binary_put_varint(output, kvds_command_rank(state));
+    break;
+  case 'N': {
+    TAKE_VARINT(index);
+    kvds_command_nth(state, kvds_binary_unzigzag(index));
+    break;
+  }
+  case 'C': {
+    TAKE_VARINT(from);
+    TAKE_VARINT(to);
+    written = kvds_binary_put_byte(output, '#') && kvds_binary_put_varint(output, kvds_command_count(state, kvds_binary_unzigzag(from), kvds_binary_unzigzag(to)));
+    break;
+  }
+  case 'q':
+    *result = KVDS_QUIT;
+    return -1;
+  default:
+    kvds_binary_put_byte(output, 'E');
+    kvds_binary_put_varint(output, KVDS_INVALID);
+    *result = KVDS_INVALID;
+    return -1;
+  }
+
+#undef TAKE_VARINT
+
+  if (error != KVDS_OK) {
+    written = kvds_binary_put_byte(output, 'E') && kvds_binary_put_varint(output, error);
+  }
+  if (!written) {
+    *result = KVDS_IO_ERROR;
+    return -1;
+  }
+  return at - bytes;
+}
+
+kvds_error kvds_serve_binary(struct kvds_command_state *state, int input_fd, int output_fd) {
+  size_t capacity = KVDS_BINARY_READ_SIZE;
+  unsigned char *input = malloc(capacity);
+  size_t filled = 0;
+
+  kvds_binary_output *output = malloc(sizeof(kvds_binary_output));
+  output->fd = output_fd;
+  output->buffer = malloc(KVDS_BINARY_WRITE_SIZE);
+  output->used = 0;
+  output->pending = 0;
+  output->iovec_count = 0;
+  output->references = false;
+
+  kvds_error result = KVDS_OK;
+  while (true) {
+    if (filled == capacity) { // A single request bigger than the buffer
+      capacity *= 2;
+      input = realloc(input, capacity);
+    }
+    ssize_t got = read(input_fd, input + filled, capacity - filled);
+    if (got == -1 && errno == EINTR) {
+      continue;
+    }
+    if (got == -1) {
+      result = KVDS_IO_ERROR;
+      break;
+    }
+    if (got == 0) {
+      if (filled != 0) {
+        result = KVDS_MALFORMED; // Ended mid-request
+      }
+      break;
+    }
+    filled += got;
+
+    size_t offset = 0;
+    while (offset < filled) {
+      ssize_t taken = kvds_binary_execute(state, output, input + offset, input + filled, &result);
+      if (taken <= 0) {
+        break;
+      }
+      offset += taken;
+    }
+    if (result != KVDS_OK) {
+      break;
+    }
+    // Keep the incomplete request at the end for the next read
+    memmove(input, input + offset, filled - offset);
+    filled -= offset;
+
+    struct pollfd fd = {.fd = input_fd, .events = POLLIN};
+    result = kvds_flush_wal(state, poll(&fd, 1, 0) != 1);
+    if (result != KVDS_OK) {
+      break;
+    }
+    if (!kvds_binary_flush(output)) {
+      result = KVDS_IO_ERROR;
+      break;
+    }
+  }
+
+  kvds_binary_flush(output); // Whatever was answered before stopping
+  free(output->buffer);
+  free(output);
+  free(input);
+  return result == KVDS_QUIT ? KVDS_OK : result;
+}
@@ -0,0 +1,19 @@
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "commands.h"
+
+// Binary protocol, for feeding kvds from other programs without paying for text parsing and formatting.
+// Requests are a one-byte opcode followed by its operands; keys and other integers are zigzag-encoded LEB128 varints, and values are a varint length followed by that many bytes:
+//   's' key - select         'k' - key            'e' - exists         'r' - read
+//   'w' length bytes - write 'd' - delete         'p' - prev           'n' - next
+//   'c' - closest            'S' from to limit - scan (limit 0 for no limit, negative ones fail)
+//   'R' - rank               'N' index - nth      'C' from to - count
+//   'q' - quit
+// Only k, e, r, S, R, C, and failing requests get a response:
+//   'k' key                  'y' / 'n' - exists   'v' length bytes / '-' - read
+//   '+' key length bytes for each scanned key, then '.'
+//   '#' count - rank and count (a plain varint, as counts are never negative)
+//   'E' code - error (a varint kvds_error); an unknown opcode ends the session, since the rest of the stream can't be framed anymore
+// Requests are handled in batches of whatever a single read() returns, and the responses to a batch are written with a single writev().
+
+kvds_error kvds_serve_binary(struct kvds_command_state *state, int input_fd, int output_fd); // Serves requests until end of input or quit
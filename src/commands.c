@@ -1,13 +1,17 @@
 // SPDX-License-Identifier: MIT
 #include "commands.h"
 #include "interface.h"
+#include "overlay.h"
+#include "registry.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "wal.h"
+#include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static const kvds_error KVDS_INVALID = 1;
-static const kvds_error KVDS_UNIMPLEMENTED = 2;
-
 char *kvds_describe_error(kvds_error error) {
   if (error == KVDS_OK) {
     return "";
@@ -18,18 +22,59 @@ char *kvds_describe_error(kvds_error error) {
   if (error == KVDS_UNIMPLEMENTED) {
     return "Unimplemented command";
   }
+  if (error == KVDS_IO_ERROR) {
+    return "Could not read file";
+  }
+  if (error == KVDS_MALFORMED) {
+    return "Malformed input";
+  }
+  if (error == KVDS_UNSORTED) {
+    return "Input is not sorted";
+  }
+  if (error == KVDS_WRITE_ERROR) {
+    return "Could not write file";
+  }
   if (error == KVDS_QUIT) {
     return "Quit";
   }
+  if (error == KVDS_INVALID_ARGUMENT) {
+    return "Invalid argument";
+  }
   return "Unknown Error";
 }
 
-typedef struct kvds_command_state {
-  struct kvds_database_algo *algo;
-  kvds_db *db;
+// Same as strtoll(text, end, 10) (including skipping leading whitespace and saturating on overflow), minus the locale and errno handling that make strtoll show up in profiles
+static long long kvds_parse_integer(char *text, char **end) {
+  char *at = text;
+  while (at[0] == ' ' || (at[0] >= '\t' && at[0] <= '\r')) {
+    at++;
+  }
+  bool negative = at[0] == '-';
+  if (at[0] == '-' || at[0] == '+') {
+    at++;
+  }
+  if (!(at[0] >= '0' && at[0] <= '9')) {
+    *end = text;
+    return 0;
+  }
 
-  kvds_cursor *cursor;
-} kvds_command_state;
+  unsigned long long limit = negative ? (unsigned long long)LLONG_MAX + 1 : LLONG_MAX;
+  unsigned long long value = 0;
+  bool overflow = false;
+  for (; at[0] >= '0' && at[0] <= '9'; at++) {
+    unsigned digit = at[0] - '0';
+    if (value > (limit - digit) / 10) {
+      overflow = true;
+    } else {
+      value = value * 10 + digit;
+    }
+  }
+  *end = at;
+  if (overflow) {
+    return negative ? LLONG_MIN : LLONG_MAX;
+  }
+  return negative ? (long long)(0 - value) : (long long)value;
+}
 
 struct kvds_command_state *kvds_create_command_state(struct kvds_database_algo *algo, void *db) {
   kvds_command_state *state = malloc(sizeof(kvds_command_state));
@@ -37,15 +82,538 @@ struct kvds_command_state *kvds_create_command_state(struct kvds_database_algo *
     .algo = algo,
     .db = db,
     .cursor = algo->create_cursor(db, 0),
+    .wal = NULL,
+    .changes = 0,
   };
   return state;
 }
 
 void kvds_destroy_command_state(struct kvds_command_state *state) {
   state->algo->destroy_cursor(state->db, state->cursor);
+  if (state->wal != NULL) {
+    kvds_wal_close(state->wal);
+  }
   free(state);
 }
 
+typedef struct kvds_scan_context {
+  long long remaining; // Negative for no limit
+  FILE *output;
+} kvds_scan_context;
+
+static bool kvds_scan_print(void *_context, long long key, const kvds_value *value) {
+  kvds_scan_context *context = _context;
+  fprintf(context->output, "%lld ", key);
+  fwrite(kvds_value_data(value), 1, value->length, context->output);
+  context->remaining--;
+  return context->remaining != 0;
+}
+
+void kvds_iterate(struct kvds_command_state *state, long long from, long long to, bool (*callback)(void *context, long long key, const kvds_value *value), void *context) {
+  kvds_cursor *cursor = state->algo->create_cursor(state->db, from);
+  kvds_algo_iterate(state->algo, state->db, cursor, to, callback, context);
+  state->algo->destroy_cursor(state->db, cursor);
+}
+
+static void kvds_scan(struct kvds_command_state *state, long long from, long long to, long long limit, FILE *output) {
+  kvds_scan_context context = {
+    .remaining = limit,
+    .output = output,
+  };
+  kvds_iterate(state, from, to, kvds_scan_print, &context);
+}
+
+long long kvds_command_rank(struct kvds_command_state *state) {
+  if (state->algo->rank) {
+    return state->algo->rank(state->db, state->cursor);
+  }
+  long long key = state->algo->key(state->db, state->cursor);
+  if (key == LLONG_MIN) {
+    return 0;
+  }
+  // Fall back to counting every key below
+  return kvds_algo_count_walk(state->algo, state->db, LLONG_MIN, key - 1, -1, NULL);
+}
+
+void kvds_command_nth(struct kvds_command_state *state, long long index) {
+  if (state->algo->nth) {
+    state->algo->nth(state->db, state->cursor, index);
+    return;
+  }
+  // Fall back to counting keys from the lowest one; stopping early or running out both leave us on the right key
+  long long last;
+  if (kvds_algo_count_walk(state->algo, state->db, LLONG_MIN, LLONG_MAX, index < 0 ? 1 : index < LLONG_MAX ? index + 1 : -1, &last) > 0) {
+    kvds_command_select(state, last);
+  }
+}
+
+long long kvds_command_count(struct kvds_command_state *state, long long from, long long to) {
+  if (from > to) {
+    return 0;
+  }
+  if (state->algo->count) {
+    return state->algo->count(state->db, from, to);
+  }
+  return kvds_algo_count_walk(state->algo, state->db, from, to, -1, NULL);
+}
+
+static bool kvds_is_empty(struct kvds_command_state *state) {
+  kvds_cursor *cursor = state->algo->create_cursor(state->db, 0);
+  if (!state->algo->exists(state->db, cursor)) {
+    state->algo->snap(state->db, cursor, KVDS_SNAP_HIGHER);
+  }
+  bool empty = !state->algo->exists(state->db, cursor);
+  state->algo->destroy_cursor(state->db, cursor);
+  return empty;
+}
+
+typedef struct kvds_fill_log_context {
+  kvds_wal *wal;
+  bool (*next)(void *context, long long *key, kvds_value *value);
+  void *context;
+  bool failed;
+} kvds_fill_log_context;
+
+static bool kvds_fill_log_next(void *_context, long long *key, kvds_value *value) {
+  kvds_fill_log_context *context = _context;
+  if (!context->next(context->context, key, value)) {
+    return false;
+  }
+  if (!kvds_wal_append(context->wal, KVDS_WAL_WRITE, *key, kvds_value_data(value), value->length)) {
+    context->failed = true; // Cut the stream short, keeping only the entries that made it into the log
+    return false;
+  }
+  return true;
+}
+
+// Writes a sorted stream of entries into the database, building the structure directly if we can
+static kvds_error kvds_fill(struct kvds_command_state *state, bool (*next)(void *context, long long *key, kvds_value *value), void *context) {
+  kvds_fill_log_context log_context = {
+    .wal = state->wal,
+    .next = next,
+    .context = context,
+    .failed = false,
+  };
+  if (state->wal != NULL) { // Log entries as they go by
+    next = kvds_fill_log_next;
+    context = &log_context;
+  }
+
+  if (state->algo->bulk_load && kvds_is_empty(state)) {
+    state->algo->bulk_load(state->db, next, context);
+  } else {
+    kvds_cursor *cursor = state->algo->create_cursor(state->db, 0);
+    long long key;
+    kvds_value value;
+    while (next(context, &key, &value)) {
+      state->algo->move_cursor(state->db, cursor, key);
+      state->algo->write(state->db, cursor, &value);
+    }
+    state->algo->destroy_cursor(state->db, cursor);
+  }
+  state->changes++;
+  // Re-locate the command cursor, as it may be pointing into what used to be an empty database
+  state->algo->move_cursor(state->db, state->cursor, state->algo->key(state->db, state->cursor));
+  return log_context.failed ? KVDS_WRITE_ERROR : KVDS_OK;
+}
+
+typedef struct kvds_load_context {
+  FILE *input;
+  char *line;
+  size_t line_capacity;
+} kvds_load_context;
+
+// Reads the next non-empty "<key> <data...>" line; returns 1 on success, 0 at the end of the input, and -1 if the line is malformed
+// The data is the rest of the line after the key, the same as it would be for "select <key> write <data...>"
+static int kvds_load_read_line(kvds_load_context *context, long long *key, char **data) {
+  while (getline(&context->line, &context->line_capacity, context->input) != -1) {
+    char *line = context->line;
+    while (line[0] == ' ') line++;
+    if (line[0] == '\n' || line[0] == '\0') {
+      continue;
+    }
+
+    char *end;
+    *key = kvds_parse_integer(line, &end);
+    if (end == line) {
+      return -1;
+    }
+    while (end[0] != '\0' && (end[0] == ' ' || end[0] == '\n')) {
+      end++;
+    }
+    *data = end;
+    return 1;
+  }
+  return 0;
+}
+
+static bool kvds_load_next(void *_context, long long *key, kvds_value *value) {
+  kvds_load_context *context = _context;
+  char *line_data;
+  if (kvds_load_read_line(context, key, &line_data) != 1) {
+    return false;
+  }
+  *value = kvds_value_wrap(line_data, strlen(line_data)); // Copied by the database before the line buffer gets reused
+  return true;
+}
+
+static kvds_error kvds_load(struct kvds_command_state *state, const char *path) {
+  kvds_load_context context = {
+    .input = fopen(path, "r"),
+    .line = NULL,
+    .line_capacity = 0,
+  };
+  if (context.input == NULL) {
+    return KVDS_IO_ERROR;
+  }
+  if (fseek(context.input, 0, SEEK_SET) != 0) { // Has to be read twice, so pipes and the like can't be loaded
+    fclose(context.input);
+    return KVDS_IO_ERROR;
+  }
+
+  // First pass: validate everything before touching the database, so that a bad file loads nothing
+  kvds_error error = KVDS_OK;
+  bool first = true;
+  long long last_key = 0;
+  long long key;
+  char *data;
+  int status;
+  while ((status = kvds_load_read_line(&context, &key, &data)) == 1) {
+    if (!first && key <= last_key) {
+      error = KVDS_UNSORTED;
+      break;
+    }
+    last_key = key;
+    first = false;
+  }
+  if (status == -1) {
+    error = KVDS_MALFORMED;
+  }
+  if (error == KVDS_OK && ferror(context.input)) {
+    error = KVDS_IO_ERROR;
+  }
+
+  // Second pass: actually write the entries
+  if (error == KVDS_OK && fseek(context.input, 0, SEEK_SET) != 0) {
+    error = KVDS_IO_ERROR;
+  }
+  if (error == KVDS_OK) {
+    error = kvds_fill(state, kvds_load_next, &context);
+  }
+
+  free(context.line);
+  fclose(context.input);
+  return error;
+}
+
+typedef struct kvds_open_context {
+  kvds_snapshot *snapshot;
+  uint64_t position;
+  bool malformed;
+} kvds_open_context;
+
+static bool kvds_open_next(void *_context, long long *key, kvds_value *value) {
+  kvds_open_context *context = _context;
+  if (context->position == context->snapshot->count) {
+    return false;
+  }
+  if (!kvds_snapshot_entry(context->snapshot, context->position, key, value)) {
+    context->malformed = true; // Stop at the first broken entry, keeping what came before it
+    return false;
+  }
+  context->position++;
+  return true;
+}
+
+kvds_error kvds_open_snapshot(struct kvds_command_state *state, const char *path) {
+  if (!state->algo->write || !state->algo->move_cursor || !state->algo->exists || !state->algo->snap) {
+    return KVDS_UNIMPLEMENTED;
+  }
+  kvds_open_context context = {
+    .snapshot = kvds_snapshot_open(path),
+    .position = 0,
+    .malformed = false,
+  };
+  if (context.snapshot == NULL) {
+    return KVDS_IO_ERROR;
+  }
+  // Values too long to be inlined are not copied; the database borrows them from the mapping instead
+  kvds_error error = kvds_fill(state, kvds_open_next, &context);
+  if (error != KVDS_OK) {
+    return error;
+  }
+  return context.malformed ? KVDS_MALFORMED : KVDS_OK;
+}
+
+kvds_error kvds_serve_snapshot(struct kvds_command_state *state, const char *path) {
+  assert(state->wal == NULL);
+  if (!state->algo->iterate || !kvds_is_empty(state)) {
+    return kvds_open_snapshot(state, path); // Can't be merged with the snapshot, so build it up instead
+  }
+  kvds_snapshot *snapshot = kvds_snapshot_open(path);
+  if (snapshot == NULL) {
+    return KVDS_IO_ERROR;
+  }
+  state->algo->destroy_cursor(state->db, state->cursor);
+  state->db = kvds_overlay_create(state->algo, state->db, snapshot);
+  state->algo = &kvds_overlay_algo;
+  state->cursor = state->algo->create_cursor(state->db, 0);
+  return KVDS_OK;
+}
+
+static void kvds_wal_apply(void *_state, enum kvds_wal_record_type type, long long key, const char *data, size_t data_len) {
+  kvds_command_state *state = _state;
+  state->algo->move_cursor(state->db, state->cursor, key);
+  if (type == KVDS_WAL_WRITE) {
+    kvds_value value = kvds_value_wrap(data, data_len);
+    state->algo->write(state->db, state->cursor, &value);
+  } else {
+    state->algo->remove(state->db, state->cursor);
+  }
+}
+
+kvds_error kvds_open_wal(struct kvds_command_state *state, const char *path, enum kvds_wal_sync sync, long long budget_us) {
+  if (!state->algo->write || !state->algo->remove || !state->algo->move_cursor) {
+    return KVDS_UNIMPLEMENTED;
+  }
+  // Replay first, and only then start logging, so that replayed records don't get logged twice
+  kvds_wal *wal = kvds_wal_open(path, sync, budget_us, kvds_wal_apply, state);
+  if (wal == NULL) {
+    return KVDS_IO_ERROR;
+  }
+  state->algo->move_cursor(state->db, state->cursor, 0);
+  state->wal = wal;
+  return KVDS_OK;
+}
+
+kvds_error kvds_flush_wal(struct kvds_command_state *state, bool idle) {
+  if (state->wal != NULL && !kvds_wal_flush_point(state->wal, idle)) {
+    return KVDS_WRITE_ERROR;
+  }
+  return KVDS_OK;
+}
+
+static void kvds_save_iterate(void *state, bool (*callback)(void *context, long long key, const kvds_value *value), void *context) {
+  kvds_iterate(state, LLONG_MIN, LLONG_MAX, callback, context);
+}
+
+// Takes the next space-separated token from args, e.g. a path
+static char *kvds_take_token(char **args) {
+  unsigned long token_len = 0;
+  while ((*args)[token_len] != '\0' && (*args)[token_len] != ' ' && (*args)[token_len] != '\n') {
+    token_len++;
+  }
+  char *token = strndup(*args, token_len);
+  *args = &(*args)[token_len];
+  return token;
+}
+
+void kvds_command_select(struct kvds_command_state *state, long long key) {
+  if (!state->algo->move_cursor) {
+    state->algo->destroy_cursor(state->db, state->cursor);
+    state->cursor = state->algo->create_cursor(state->db, key);
+  } else {
+    state->algo->move_cursor(state->db, state->cursor, key);
+  }
+}
+
+kvds_error kvds_command_write(struct kvds_command_state *state, const kvds_value *value) {
+  if (!state->algo->write) {
+    return KVDS_UNIMPLEMENTED;
+  }
+  // Logged first, so that a change that couldn't be logged is never seen either
+  if (state->wal != NULL && !kvds_wal_append(state->wal, KVDS_WAL_WRITE, state->algo->key(state->db, state->cursor), kvds_value_data(value), value->length)) {
+    return KVDS_WRITE_ERROR;
+  }
+  state->algo->write(state->db, state->cursor, value);
+  state->changes++;
+  return KVDS_OK;
+}
+
+kvds_error kvds_command_delete(struct kvds_command_state *state) {
+  if (!state->algo->remove) {
+    return KVDS_UNIMPLEMENTED;
+  }
+  // Same as for writes; deleting keys that don't exist isn't logged
+  if (state->wal != NULL && state->algo->exists(state->db, state->cursor) && !kvds_wal_append(state->wal, KVDS_WAL_DELETE, state->algo->key(state->db, state->cursor), NULL, 0)) {
+    return KVDS_WRITE_ERROR;
+  }
+  state->algo->remove(state->db, state->cursor);
+  state->changes++;
+  return KVDS_OK;
+}
+
+enum kvds_command {
+  KVDS_COMMAND_UNKNOWN,
+  KVDS_COMMAND_SELECT,
+  KVDS_COMMAND_KEY,
+  KVDS_COMMAND_EXISTS,
+  KVDS_COMMAND_READ,
+  KVDS_COMMAND_WRITE,
+  KVDS_COMMAND_DELETE,
+  KVDS_COMMAND_PREV,
+  KVDS_COMMAND_NEXT,
+  KVDS_COMMAND_CLOSEST,
+  KVDS_COMMAND_SCAN,
+  KVDS_COMMAND_RANK,
+  KVDS_COMMAND_NTH,
+  KVDS_COMMAND_COUNT,
+  KVDS_COMMAND_LOAD,
+  KVDS_COMMAND_SAVE,
+  KVDS_COMMAND_OPEN,
+  KVDS_COMMAND_STATS,
+  KVDS_COMMAND_COMMENT,
+  KVDS_COMMAND_HELP,
+  KVDS_COMMAND_QUIT,
+};
+_Static_assert(KVDS_COMMAND_QUIT < KVDS_STATS_COMMANDS, "Not enough room for timing every kind of command");
+
+static const char *kvds_command_names[] = {
+  [KVDS_COMMAND_SELECT] = "select",
+  [KVDS_COMMAND_KEY] = "key",
+  [KVDS_COMMAND_EXISTS] = "exists",
+  [KVDS_COMMAND_READ] = "read",
+  [KVDS_COMMAND_WRITE] = "write",
+  [KVDS_COMMAND_DELETE] = "delete",
+  [KVDS_COMMAND_PREV] = "prev",
+  [KVDS_COMMAND_NEXT] = "next",
+  [KVDS_COMMAND_CLOSEST] = "closest",
+  [KVDS_COMMAND_SCAN] = "scan",
+  [KVDS_COMMAND_RANK] = "rank",
+  [KVDS_COMMAND_NTH] = "nth",
+  [KVDS_COMMAND_COUNT] = "count",
+  [KVDS_COMMAND_LOAD] = "load",
+  [KVDS_COMMAND_SAVE] = "save",
+  [KVDS_COMMAND_OPEN] = "open",
+  [KVDS_COMMAND_STATS] = "stats",
+  [KVDS_COMMAND_COMMENT] = "#",
+  [KVDS_COMMAND_HELP] = "help",
+  [KVDS_COMMAND_QUIT] = "quit",
+};
+
+// Switches on the first byte, then checks the length before comparing anything, so each token costs at most a few comparisons
+static enum kvds_command kvds_lookup_command(const char *token, unsigned long token_len) {
+#define MATCH(name, command)                                                          \
+  if (token_len == sizeof(name) - 1 && memcmp(token, name, sizeof(name) - 1) == 0) { \
+    return command;                                                                   \
+  }
+
+  switch (token[0]) {
+  case 's':
+    MATCH("s", KVDS_COMMAND_SELECT);
+    MATCH("select", KVDS_COMMAND_SELECT);
+    MATCH("scan", KVDS_COMMAND_SCAN);
+    MATCH("save", KVDS_COMMAND_SAVE);
+    MATCH("stats", KVDS_COMMAND_STATS);
+    break;
+  case 'k':
+    MATCH("k", KVDS_COMMAND_KEY);
+    MATCH("key", KVDS_COMMAND_KEY);
+    break;
+  case 'e':
+    MATCH("e", KVDS_COMMAND_EXISTS);
+    MATCH("exists", KVDS_COMMAND_EXISTS);
+    break;
+  case 'r':
+    MATCH("r", KVDS_COMMAND_READ);
+    MATCH("read", KVDS_COMMAND_READ);
+    MATCH("rank", KVDS_COMMAND_RANK);
+    break;
+  case 'w':
+    MATCH("w", KVDS_COMMAND_WRITE);
+    MATCH("write", KVDS_COMMAND_WRITE);
+    break;
+  case 'd':
+    MATCH("d", KVDS_COMMAND_DELETE);
+    MATCH("delete", KVDS_COMMAND_DELETE);
+    break;
+  case 'p':
+    MATCH("p", KVDS_COMMAND_PREV);
+    MATCH("prev", KVDS_COMMAND_PREV);
+    break;
+  case '<':
+    MATCH("<", KVDS_COMMAND_PREV);
+    break;
+  case 'n':
+    MATCH("n", KVDS_COMMAND_NEXT);
+    MATCH("next", KVDS_COMMAND_NEXT);
+    MATCH("nth", KVDS_COMMAND_NTH);
+    break;
+  case '>':
+    MATCH(">", KVDS_COMMAND_NEXT);
+    break;
+  case 'c':
+    MATCH("c", KVDS_COMMAND_CLOSEST);
+    MATCH("closest", KVDS_COMMAND_CLOSEST);
+    MATCH("count", KVDS_COMMAND_COUNT);
+    break;
+  case 'l':
+    MATCH("load", KVDS_COMMAND_LOAD);
+    break;
+  case 'o':
+    MATCH("open", KVDS_COMMAND_OPEN);
+    break;
+  case '#':
+    MATCH("#", KVDS_COMMAND_COMMENT);
+    break;
+  case 'h':
+    MATCH("help", KVDS_COMMAND_HELP);
+    break;
+  case '?':
+    MATCH("?", KVDS_COMMAND_HELP);
+    break;
+  case 'q':
+    MATCH("q", KVDS_COMMAND_QUIT);
+    MATCH("quit", KVDS_COMMAND_QUIT);
+    break;
+  }
+  return KVDS_COMMAND_UNKNOWN;
+
+#undef MATCH
+}
+
+#ifndef KVDS_NO_STATS
+// Prints the non-empty buckets of a histogram as "<limit:count", with the limit in the given unit
+static void kvds_print_histogram(FILE *output, const unsigned long long *buckets, const char *unit) {
+  for (int i = 0; i < KVDS_STATS_BUCKETS; i++) {
+    if (buckets[i] == 0) {
+      continue;
+    }
+    if (i == KVDS_STATS_BUCKETS - 1) {
+      fprintf(output, " >=%llu%s:%llu", 1ull << (i - 1), unit, buckets[i]);
+    } else {
+      fprintf(output, " <%llu%s:%llu", 1ull << i, unit, buckets[i]);
+    }
+  }
+  fprintf(output, "\n");
+}
+#endif
+
+static void kvds_print_stats(struct kvds_command_state *state, FILE *output) {
+  if (state->algo->shape) {
+    long long nodes, height;
+    state->algo->shape(state->db, &nodes, &height);
+    fprintf(output, "nodes %lld\n", nodes);
+    if (height >= 0) {
+      fprintf(output, "height %lld\n", height);
+    }
+  }
+#ifndef KVDS_NO_STATS
+  kvds_stats stats;
+  kvds_stats_collect(&stats);
+  fprintf(output, "node-visits %llu\n", stats.counters[KVDS_STAT_NODE_VISITS]);
+  fprintf(output, "rotations %llu\n", stats.counters[KVDS_STAT_ROTATIONS]);
+  fprintf(output, "rebuilds %llu", stats.counters[KVDS_STAT_REBUILDS]);
+  kvds_print_histogram(output, stats.rebuild_sizes, "");
+  for (int kind = 0; kind < KVDS_STATS_COMMANDS; kind++) {
+    if (stats.commands[kind] > 0) {
+      fprintf(output, "%s %llu", kvds_command_names[kind], stats.commands[kind]);
+      kvds_print_histogram(output, stats.command_latencies[kind], "ns"); // Empty unless timing
+    }
+  }
+#endif
+}
+
 kvds_error kvds_execute_command(struct kvds_command_state *state, char *command, FILE *output) {
   while (command[0] != '\0') {
 
@@ -65,26 +633,26 @@ kvds_error kvds_execute_command(struct kvds_command_state *state, char *command,
       args++;
     }
 
-#define ISCMD(cmd) (command_len == strlen(cmd) && strncmp(command, cmd, command_len) == 0)
-
-    if (ISCMD("select") || ISCMD("s")) {
+    long long started = kvds_stats_clock();
+    enum kvds_command kind = kvds_lookup_command(command, command_len);
+    switch (kind) {
+    case KVDS_COMMAND_SELECT: {
       char *end;
-      long long key = strtoll(args, &end, 10);
+      long long key = kvds_parse_integer(args, &end);
       args = end;
-      if (!state->algo->move_cursor) {
-        state->algo->destroy_cursor(state->db, state->cursor);
-        state->algo->create_cursor(state->db, key);
-      } else {
-        state->algo->move_cursor(state->db, state->cursor, key);
-      }
-    } else if (ISCMD("key") || ISCMD("k")) {
+      kvds_command_select(state, key);
+      break;
+    }
+    case KVDS_COMMAND_KEY: {
       if (!state->algo->key) {
         return KVDS_UNIMPLEMENTED;
       }
       long long key = state->algo->key(state->db, state->cursor);
 
       fprintf(output, "%lld\n", key);
-    } else if (ISCMD("exists") || ISCMD("e")) {
+      break;
+    }
+    case KVDS_COMMAND_EXISTS: {
       if (!state->algo->exists) {
         return KVDS_UNIMPLEMENTED;
       }
@@ -95,54 +663,137 @@ kvds_error kvds_execute_command(struct kvds_command_state *state, char *command,
       } else {
         fprintf(output, "no\n");
       }
-    } else if (ISCMD("read") || ISCMD("r")) {
+      break;
+    }
+    case KVDS_COMMAND_READ: {
       if (!state->algo->read) {
         return KVDS_UNIMPLEMENTED;
       }
-      char *stored = state->algo->read(state->db, state->cursor);
+      const kvds_value *stored = state->algo->read(state->db, state->cursor);
       if (stored == NULL) {
-        printf("(nil)\n");
+        fprintf(output, "(nil)\n");
       } else {
-        fprintf(output, "%s", stored);
-      }
-    } else if (ISCMD("write") || ISCMD("w")) {
-      if (!state->algo->write) {
-        return KVDS_UNIMPLEMENTED;
+        fwrite(kvds_value_data(stored), 1, stored->length, output);
       }
+      break;
+    }
+    case KVDS_COMMAND_WRITE: {
       unsigned long args_len = strlen(args);
 
-      char *copy = malloc(args_len + 1);
-      strncpy(copy, args, args_len + 1);
+      kvds_value value = kvds_value_wrap(args, args_len); // The database copies it, inline if it's short enough
 
       args = &args[args_len];
 
-      char *old_stored = state->algo->write(state->db, state->cursor, copy);
-      free(old_stored);
+      kvds_error error = kvds_command_write(state, &value);
+      if (error != KVDS_OK) {
+        return error;
+      }
       // fprintf(output, "Stored %lu bytes\n", args_len);
-    } else if (ISCMD("delete") || ISCMD("d")) {
-      if (!state->algo->remove) {
-        return KVDS_UNIMPLEMENTED;
+      break;
+    }
+    case KVDS_COMMAND_DELETE: {
+      kvds_error error = kvds_command_delete(state);
+      if (error != KVDS_OK) {
+        return error;
       }
-      char *old_stored = state->algo->remove(state->db, state->cursor);
-      free(old_stored);
-    } else if (ISCMD("prev") || ISCMD("p") || ISCMD("<")) {
+      break;
+    }
+    case KVDS_COMMAND_PREV:
       if (!state->algo->snap) {
         return KVDS_UNIMPLEMENTED;
       }
       state->algo->snap(state->db, state->cursor, KVDS_SNAP_LOWER);
-    } else if (ISCMD("next") || ISCMD("n") || ISCMD(">")) {
+      break;
+    case KVDS_COMMAND_NEXT:
       if (!state->algo->snap) {
         return KVDS_UNIMPLEMENTED;
       }
       state->algo->snap(state->db, state->cursor, KVDS_SNAP_HIGHER);
-    } else if (ISCMD("closest") || ISCMD("c")) {
+      break;
+    case KVDS_COMMAND_CLOSEST:
       if (!state->algo->snap) {
         return KVDS_UNIMPLEMENTED;
       }
       state->algo->snap(state->db, state->cursor, KVDS_SNAP_CLOSEST_LOW);
-    } else if (ISCMD("#")) {
+      break;
+    case KVDS_COMMAND_SCAN: {
+      char *end;
+      long long from = kvds_parse_integer(args, &end);
+      args = end;
+      long long to = kvds_parse_integer(args, &end);
+      args = end;
+      long long limit = kvds_parse_integer(args, &end);
+      if (end == args) { // The limit is optional; anything else is the next command
+        limit = -1; // No limit
+      } else if (limit <= 0) {
+        return KVDS_INVALID_ARGUMENT;
+      }
+      args = end;
+
+      if (!state->algo->iterate && !(state->algo->exists && state->algo->read && state->algo->snap)) {
+        return KVDS_UNIMPLEMENTED;
+      }
+      kvds_scan(state, from, to, limit, output);
+      break;
+    }
+    case KVDS_COMMAND_RANK:
+      fprintf(output, "%lld\n", kvds_command_rank(state));
+      break;
+    case KVDS_COMMAND_NTH: {
+      char *end;
+      long long index = kvds_parse_integer(args, &end);
+      args = end;
+      kvds_command_nth(state, index);
+      break;
+    }
+    case KVDS_COMMAND_COUNT: {
+      char *end;
+      long long from = kvds_parse_integer(args, &end);
+      args = end;
+      long long to = kvds_parse_integer(args, &end);
+      args = end;
+      fprintf(output, "%lld\n", kvds_command_count(state, from, to));
+      break;
+    }
+    case KVDS_COMMAND_LOAD: {
+      if (!state->algo->write || !state->algo->move_cursor || !state->algo->exists || !state->algo->snap) {
+        return KVDS_UNIMPLEMENTED;
+      }
+      char *path = kvds_take_token(&args);
+      kvds_error error = kvds_load(state, path);
+      free(path);
+      if (error != KVDS_OK) {
+        return error;
+      }
+      break;
+    }
+    case KVDS_COMMAND_SAVE: {
+      if (!state->algo->iterate && !(state->algo->exists && state->algo->read && state->algo->snap)) {
+        return KVDS_UNIMPLEMENTED;
+      }
+      char *path = kvds_take_token(&args);
+      bool saved = kvds_snapshot_save(path, kvds_save_iterate, state);
+      free(path);
+      if (!saved) {
+        return KVDS_IO_ERROR;
+      }
+      break;
+    }
+    case KVDS_COMMAND_OPEN: {
+      char *path = kvds_take_token(&args);
+      kvds_error error = kvds_open_snapshot(state, path);
+      free(path);
+      if (error != KVDS_OK) {
+        return error;
+      }
+      break;
+    }
+    case KVDS_COMMAND_STATS:
+      kvds_print_stats(state, output);
+      break;
+    case KVDS_COMMAND_COMMENT:
       return KVDS_OK; // The whole line was processed
-    } else if (ISCMD("help") || ISCMD("?")) {
+    case KVDS_COMMAND_HELP:
       fprintf(output,
         "Available commands: \n"
         "  select, s [key] - Move the cursor to key\n"
@@ -154,15 +805,23 @@ kvds_error kvds_execute_command(struct kvds_command_state *state, char *command,
         "  prev, p, < - Move cursor left\n"
         "  next, n, > - Move cursor right\n"
         "  closest, c - Move cursor to closest\n"
+        "  scan [from] [to] [limit] - Print up to limit keys and their data between from and to\n"
+        "  rank - Print the number of keys below the cursor\n"
+        "  nth [index] - Move the cursor to the index-th key, counting from 0\n"
+        "  count [from] [to] - Print the number of keys between from and to\n"
+        "  load [file] - Load lines of \"key data...\" sorted by key from a file\n"
+        "  save [file] - Save a binary snapshot of the database\n"
+        "  open [file] - Load a binary snapshot, memory-mapping it\n"
+        "  stats - Print the size of the database, and counts of what it has been doing\n"
         "  # - Comment\n"
         "  help, ? - Print this message\n");
-    } else if (ISCMD("quit") || ISCMD("q")) {
+      break;
+    case KVDS_COMMAND_QUIT:
       return KVDS_QUIT;
-    } else {
+    case KVDS_COMMAND_UNKNOWN:
       return KVDS_INVALID;
     }
-
-#undef ISCMD
+    kvds_stats_command(kind, started); // Only commands that succeed are counted
 
     command = args;
   }
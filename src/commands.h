@@ -1,14 +1,47 @@
 // SPDX-License-Identifier: MIT
 #pragma once
 #include "interface.h"
+#include "wal.h"
+#include <stdbool.h>
 #include <stdio.h>
 
 typedef int kvds_error;
 static const kvds_error KVDS_QUIT = -1;
 static const kvds_error KVDS_OK = 0;
+static const kvds_error KVDS_INVALID = 1;
+static const kvds_error KVDS_UNIMPLEMENTED = 2;
+static const kvds_error KVDS_IO_ERROR = 3;
+static const kvds_error KVDS_MALFORMED = 4;
+static const kvds_error KVDS_UNSORTED = 5;
+static const kvds_error KVDS_WRITE_ERROR = 6;
+static const kvds_error KVDS_INVALID_ARGUMENT = 7;
 
 char *kvds_describe_error(kvds_error error);
 
+typedef struct kvds_command_state {
+  struct kvds_database_algo *algo;
+  kvds_db *db;
+
+  kvds_cursor *cursor;
+
+  kvds_wal *wal; // NULL unless writes are being logged
+
+  unsigned long long changes; // Bumped by every command that changes the database, as that might invalidate other cursors on it
+} kvds_command_state;
+
 struct kvds_command_state *kvds_create_command_state(struct kvds_database_algo *algo, void *db);
 void kvds_destroy_command_state(struct kvds_command_state *state);
 kvds_error kvds_execute_command(struct kvds_command_state *state, char *command, FILE *output);
+
+// Building blocks of the commands, for other front-ends; writes and deletes go through the write-ahead log, if any
+void kvds_command_select(struct kvds_command_state *state, long long key);
+kvds_error kvds_command_write(struct kvds_command_state *state, const kvds_value *value);
+kvds_error kvds_command_delete(struct kvds_command_state *state);
+long long kvds_command_rank(struct kvds_command_state *state); // Number of keys below the cursor
+void kvds_command_nth(struct kvds_command_state *state, long long index); // Moves the cursor to the index-th lowest key
+long long kvds_command_count(struct kvds_command_state *state, long long from, long long to); // Number of keys between from and to, inclusive
+void kvds_iterate(struct kvds_command_state *state, long long from, long long to, bool (*callback)(void *context, long long key, const kvds_value *value), void *context); // Calls callback for each key between from and to, without moving the command cursor
+kvds_error kvds_open_snapshot(struct kvds_command_state *state, const char *path); // Writes the snapshot's entries into the database
+kvds_error kvds_serve_snapshot(struct kvds_command_state *state, const char *path); // Puts the still-empty database on top of the snapshot instead (see overlay.h), replacing the state's algo and db; only valid before any other state shares the database, or a log is opened
+kvds_error kvds_open_wal(struct kvds_command_state *state, const char *path, enum kvds_wal_sync sync, long long budget_us); // Replays the log into the database, then logs every change made through the state into it
+kvds_error kvds_flush_wal(struct kvds_command_state *state, bool idle); // Call between commands; idle means no more input is immediately available
@@ -0,0 +1,156 @@
+// SPDX-License-Identifier: MIT
+#include "ebr.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define KVDS_EBR_BATCH 32 // Retirements per attempt to advance the epoch; so that a lone writer doesn't pay for a fence and a CAS on every change
+
+// Every thread that has ever entered a critical section owns a record, found again through a thread-local pointer
+// Records are never freed, only handed over to new threads once their owner has exited
+typedef struct kvds_ebr_record {
+  unsigned long long state; // (epoch << 1) | 1 while in a critical section, 0 outside of one
+  int depth; // Only touched by the owner
+  bool owned;
+  struct kvds_ebr_record *next;
+} kvds_ebr_record;
+
+typedef struct kvds_ebr_retired {
+  void *pointer;
+  void (*reclaim)(void *context, void *pointer);
+  unsigned long long epoch;
+} kvds_ebr_retired;
+
+static unsigned long long kvds_ebr_epoch = 0;
+static kvds_ebr_record *kvds_ebr_records = NULL;
+static _Thread_local kvds_ebr_record *kvds_ebr_self = NULL;
+
+static pthread_once_t kvds_ebr_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t kvds_ebr_key;
+
+static void kvds_ebr_disown(void *_record) {
+  kvds_ebr_record *record = _record;
+  __atomic_store_n(&record->state, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&record->owned, false, __ATOMIC_RELEASE);
+}
+
+static void kvds_ebr_create_key() {
+  pthread_key_create(&kvds_ebr_key, kvds_ebr_disown);
+}
+
+static kvds_ebr_record *kvds_ebr_claim() {
+  kvds_ebr_record *record;
+  // Adopt a record left behind by an exited thread if there is one, so that threads coming and going don't grow the list forever
+  for (record = __atomic_load_n(&kvds_ebr_records, __ATOMIC_ACQUIRE); record != NULL; record = record->next) {
+    bool owned = false;
+    if (!__atomic_load_n(&record->owned, __ATOMIC_RELAXED) && __atomic_compare_exchange_n(&record->owned, &owned, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+  if (record == NULL) {
+    record = malloc(sizeof(kvds_ebr_record));
+    record->state = 0;
+    record->owned = true;
+    record->next = __atomic_load_n(&kvds_ebr_records, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&kvds_ebr_records, &record->next, record, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+      // record->next was updated to the new head; retry
+    }
+  }
+  record->depth = 0;
+
+  pthread_once(&kvds_ebr_key_once, kvds_ebr_create_key);
+  pthread_setspecific(kvds_ebr_key, record); // Just for the destructor
+  return record;
+}
+
+void kvds_ebr_enter() {
+  kvds_ebr_record *self = kvds_ebr_self;
+  if (self == NULL) {
+    self = kvds_ebr_self = kvds_ebr_claim();
+  }
+  if (self->depth++ > 0) {
+    return;
+  }
+  unsigned long long epoch = __atomic_load_n(&kvds_ebr_epoch, __ATOMIC_RELAXED);
+  __atomic_store_n(&self->state, (epoch << 1) | 1, __ATOMIC_RELAXED);
+  // The announcement has to be visible before we read any links; pairs with the fence in kvds_ebr_try_advance
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void kvds_ebr_exit() {
+  kvds_ebr_record *self = kvds_ebr_self;
+  if (--self->depth > 0) {
+    return;
+  }
+  __atomic_store_n(&self->state, 0, __ATOMIC_RELEASE);
+}
+
+// Advances the epoch if every reader in a critical section has already seen the current one; returns the (possibly new) epoch
+static unsigned long long kvds_ebr_try_advance() {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  unsigned long long epoch = __atomic_load_n(&kvds_ebr_epoch, __ATOMIC_SEQ_CST);
+  for (kvds_ebr_record *record = __atomic_load_n(&kvds_ebr_records, __ATOMIC_ACQUIRE); record != NULL; record = record->next) {
+    unsigned long long state = __atomic_load_n(&record->state, __ATOMIC_ACQUIRE);
+    if ((state & 1) && (state >> 1) != epoch) {
+      return epoch; // Still in an older epoch
+    }
+  }
+  if (__atomic_compare_exchange_n(&kvds_ebr_epoch, &epoch, epoch + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+    return epoch + 1;
+  }
+  return epoch; // Someone else advanced it; epoch now holds their value
+}
+
+void kvds_ebr_limbo_init(kvds_ebr_limbo *limbo, void *context) {
+  limbo->retired = NULL;
+  limbo->count = 0;
+  limbo->capacity = 0;
+  limbo->since_advance = 0;
+  limbo->generation = 0;
+  limbo->context = context;
+}
+
+void kvds_ebr_limbo_release(kvds_ebr_limbo *limbo) {
+  for (size_t i = 0; i < limbo->count; i++) {
+    limbo->retired[i].reclaim(limbo->context, limbo->retired[i].pointer);
+  }
+  free(limbo->retired);
+  limbo->retired = NULL;
+  limbo->count = 0;
+  limbo->capacity = 0;
+}
+
+void kvds_ebr_retire(kvds_ebr_limbo *limbo, void *pointer, void (*reclaim)(void *context, void *pointer)) {
+  if (limbo->count == limbo->capacity) {
+    limbo->capacity = limbo->capacity == 0 ? 64 : limbo->capacity * 2;
+    limbo->retired = realloc(limbo->retired, limbo->capacity * sizeof(kvds_ebr_retired));
+  }
+  // Bumped before the epoch is read, so that a reader that doesn't see the new generation entered early enough to keep the node from being reclaimed
+  __atomic_store_n(&limbo->generation, limbo->generation + 1, __ATOMIC_SEQ_CST);
+  // Read after the unlink, so that any reader entering in a later epoch can no longer reach it
+  limbo->retired[limbo->count++] = (kvds_ebr_retired){
+    .pointer = pointer,
+    .reclaim = reclaim,
+    .epoch = __atomic_load_n(&kvds_ebr_epoch, __ATOMIC_SEQ_CST),
+  };
+  limbo->since_advance++;
+}
+
+void kvds_ebr_collect(kvds_ebr_limbo *limbo) {
+  if (limbo->since_advance < KVDS_EBR_BATCH) {
+    return;
+  }
+  limbo->since_advance = 0;
+  unsigned long long epoch = kvds_ebr_try_advance();
+  size_t reclaimed = 0;
+  while (reclaimed < limbo->count && limbo->retired[reclaimed].epoch + 2 <= epoch) {
+    limbo->retired[reclaimed].reclaim(limbo->context, limbo->retired[reclaimed].pointer);
+    reclaimed++;
+  }
+  if (reclaimed > 0) {
+    limbo->count -= reclaimed;
+    for (size_t i = 0; i < limbo->count; i++) {
+      limbo->retired[i] = limbo->retired[reclaimed + i];
+    }
+  }
+}
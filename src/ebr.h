@@ -0,0 +1,34 @@
+// SPDX-License-Identifier: MIT
+#pragma once
+#include <stddef.h>
+
+// Epoch-based reclamation, for databases that let reader threads walk them while a single writer thread changes them.
+// Readers wrap their accesses in kvds_ebr_enter() / kvds_ebr_exit(); anything they reach in between (including the nodes a cursor points at) stays allocated until they exit. Cursors therefore have to be moved again before being used in a later critical section.
+// The writer never changes a node readers might be looking at in a way they could observe half-done: it links in fully-built nodes with KVDS_PUBLISH, and instead of freeing the nodes it unlinks, it retires them into the database's limbo list. Retired nodes get reclaimed once the global epoch has advanced twice past their retirement, by which point every reader that could have seen them has left its critical section.
+
+// Reader-visible links are read and written through these, so that a reader that sees a new node also sees everything written into it before it was published
+#define KVDS_LOAD(place) __atomic_load_n(&(place), __ATOMIC_ACQUIRE)
+#define KVDS_PUBLISH(place, value) __atomic_store_n(&(place), (value), __ATOMIC_RELEASE)
+
+void kvds_ebr_enter(); // May be nested
+void kvds_ebr_exit();
+
+typedef struct kvds_ebr_limbo {
+  struct kvds_ebr_retired *retired; // Oldest first
+  size_t count;
+  size_t capacity;
+  size_t since_advance; // Retired since the last attempt to advance the epoch
+  unsigned long long generation; // Bumped on every retirement
+  void *context; // Passed to every reclaim callback
+} kvds_ebr_limbo;
+
+void kvds_ebr_limbo_init(kvds_ebr_limbo *limbo, void *context);
+void kvds_ebr_limbo_release(kvds_ebr_limbo *limbo); // Reclaims everything at once; only valid once no readers are left
+
+void kvds_ebr_retire(kvds_ebr_limbo *limbo, void *pointer, void (*reclaim)(void *context, void *pointer)); // Call only after pointer has been unlinked
+void kvds_ebr_collect(kvds_ebr_limbo *limbo); // Tries to advance the epoch, and reclaims whatever is old enough; call when done changing the structure, never in the middle of walking retired nodes
+
+// Read inside a critical section; if it still matches the generation read when a node was reached (possibly in an earlier critical section), nothing has been retired since, so the node is still linked in and safe to start from
+static inline unsigned long long kvds_ebr_generation(kvds_ebr_limbo *limbo) {
+  return __atomic_load_n(&limbo->generation, __ATOMIC_SEQ_CST);
+}
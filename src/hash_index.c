@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: MIT
+#include "hash_index.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define KVDS_HASH_INDEX_MIN_CAPACITY 8
+
+// Returns NULL if there isn't the memory for it
+static kvds_hash_index_table *kvds_hash_index_table_create(size_t capacity) {
+  if (capacity > (SIZE_MAX - sizeof(kvds_hash_index_table)) / sizeof(kvds_hash_index_slot)) {
+    return NULL;
+  }
+  kvds_hash_index_table *table = calloc(1, sizeof(kvds_hash_index_table) + capacity * sizeof(kvds_hash_index_slot));
+  if (table == NULL) {
+    return NULL;
+  }
+  table->mask = capacity - 1;
+  table->shift = 64 - __builtin_ctzll(capacity);
+  return table;
+}
+
+static void kvds_hash_index_reclaim_table(void *context, void *table) {
+  free(table);
+}
+
+void kvds_hash_index_init(kvds_hash_index *index, kvds_ebr_limbo *limbo) {
+  index->table = kvds_hash_index_table_create(KVDS_HASH_INDEX_MIN_CAPACITY);
+  if (index->table == NULL) {
+    abort(); // Nothing else is going to fit either
+  }
+  index->count = 0;
+  index->min_capacity = KVDS_HASH_INDEX_MIN_CAPACITY;
+  index->limbo = limbo;
+}
+
+void kvds_hash_index_release(kvds_hash_index *index) {
+  free(index->table);
+  index->table = NULL;
+  index->count = 0;
+}
+
+// Rehashes everything into a new table, published with a single store; readers still probing the old one keep seeing it unchanged
+// Returns false, leaving the old table in place, if there isn't the memory for the new one
+static bool kvds_hash_index_resize(kvds_hash_index *index, size_t capacity) {
+  kvds_hash_index_table *old = index->table;
+  kvds_hash_index_table *resized = kvds_hash_index_table_create(capacity);
+  if (resized == NULL) {
+    return false;
+  }
+  for (size_t i = 0; i <= old->mask; i++) {
+    if (old->slots[i].value != NULL) {
+      size_t j = kvds_hash_index_home(resized, old->slots[i].key);
+      while (resized->slots[j].value != NULL) {
+        j = (j + 1) & resized->mask;
+      }
+      resized->slots[j] = old->slots[i];
+    }
+  }
+  KVDS_PUBLISH(index->table, resized);
+  if (index->limbo != NULL) {
+    kvds_ebr_retire(index->limbo, old, kvds_hash_index_reclaim_table);
+  } else {
+    free(old);
+  }
+  return true;
+}
+
+void kvds_hash_index_reserve(kvds_hash_index *index, size_t count) {
+  size_t capacity = KVDS_HASH_INDEX_MIN_CAPACITY;
+  while (capacity < count * 2) {
+    capacity *= 2;
+  }
+  if (capacity > index->table->mask + 1 && !kvds_hash_index_resize(index, capacity)) {
+    return; // Not worth failing over; put will try again as the keys come
+  }
+  if (capacity > index->min_capacity) {
+    index->min_capacity = capacity;
+  }
+}
+
+// Stores the key before the value, so that a reader that sees the value also sees the key; a reader can still see the new key next to an older value, which is why readers check what they get
+static inline void kvds_hash_index_store(kvds_hash_index_slot *slot, unsigned long long key, void *value) {
+  __atomic_store_n(&slot->key, key, __ATOMIC_RELAXED);
+  KVDS_PUBLISH(slot->value, value);
+}
+
+void kvds_hash_index_put(kvds_hash_index *index, unsigned long long key, void *value) {
+  assert(value != NULL && kvds_hash_index_get(index, key) == NULL);
+  if ((index->count + 1) * 2 > index->table->mask + 1 && !kvds_hash_index_resize(index, (index->table->mask + 1) * 2) && index->count + 1 > index->table->mask) {
+    abort(); // Out of memory, and the table has to keep an empty slot for probes to stop at
+  }
+  kvds_hash_index_table *table = index->table;
+  size_t i = kvds_hash_index_home(table, key);
+  while (table->slots[i].value != NULL) {
+    i = (i + 1) & table->mask;
+  }
+  kvds_hash_index_store(&table->slots[i], key, value);
+  index->count++;
+}
+
+void kvds_hash_index_set(kvds_hash_index *index, unsigned long long key, void *value) {
+  assert(value != NULL);
+  kvds_hash_index_table *table = index->table;
+  size_t i = kvds_hash_index_home(table, key);
+  while (table->slots[i].key != key || table->slots[i].value == NULL) {
+    assert(table->slots[i].value != NULL);
+    i = (i + 1) & table->mask;
+  }
+  KVDS_PUBLISH(table->slots[i].value, value);
+}
+
+void kvds_hash_index_remove(kvds_hash_index *index, unsigned long long key) {
+  kvds_hash_index_table *table = index->table;
+  size_t hole = kvds_hash_index_home(table, key);
+  while (table->slots[hole].key != key || table->slots[hole].value == NULL) {
+    assert(table->slots[hole].value != NULL);
+    hole = (hole + 1) & table->mask;
+  }
+  // Shift later slots of the same run back into the hole, unless that would move them before their home
+  for (size_t i = (hole + 1) & table->mask; table->slots[i].value != NULL; i = (i + 1) & table->mask) {
+    size_t home = kvds_hash_index_home(table, table->slots[i].key);
+    if (((i - home) & table->mask) >= ((i - hole) & table->mask)) {
+      kvds_hash_index_store(&table->slots[hole], table->slots[i].key, table->slots[i].value);
+      hole = i;
+    }
+  }
+  KVDS_PUBLISH(table->slots[hole].value, NULL);
+  index->count--;
+
+  if (index->count * 8 < table->mask + 1 && table->mask + 1 > index->min_capacity) {
+    kvds_hash_index_resize(index, (table->mask + 1) / 2); // If there isn't the memory for it, staying large is just as good
+  }
+}
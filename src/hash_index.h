@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "ebr.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Open-addressing hash table from keys to nodes, which ordered algorithms can keep next to their structure so that moving a cursor to an existing key takes a single probe.
+// Slots are probed linearly from a Fibonacci hash of the key, and removals shift the rest of the run back instead of leaving tombstones; the table is kept between 1/8 and 1/2 full.
+// Algorithms with concurrent readers pass their limbo, so that tables replaced by a resize are retired rather than freed. Readers may then race with the writer: they can miss a key that is there, or get the node of another key, so they have to check the key of the node they get back and fall back to their ordered search otherwise. The writer has to update the index before retiring a node it points at.
+
+typedef struct kvds_hash_index_slot {
+  unsigned long long key;
+  void *value; // NULL if the slot is empty
+} kvds_hash_index_slot;
+
+typedef struct kvds_hash_index_table {
+  size_t mask; // Capacity - 1; the capacity is a power of two
+  int shift; // 64 - log2(capacity)
+  kvds_hash_index_slot slots[];
+} kvds_hash_index_table;
+
+typedef struct kvds_hash_index {
+  kvds_hash_index_table *table;
+  size_t count;
+  size_t min_capacity; // Removals never shrink the table below this
+  kvds_ebr_limbo *limbo; // Where replaced tables go; NULL to free them right away
+} kvds_hash_index;
+
+void kvds_hash_index_init(kvds_hash_index *index, kvds_ebr_limbo *limbo);
+void kvds_hash_index_release(kvds_hash_index *index); // Only valid once no readers are left
+void kvds_hash_index_reserve(kvds_hash_index *index, size_t count); // Grows the table to hold count keys without resizing, and keeps it at least that large from then on; does nothing if there isn't the memory for it
+
+void kvds_hash_index_put(kvds_hash_index *index, unsigned long long key, void *value); // The key must not be in the index yet; value must not be NULL
+void kvds_hash_index_set(kvds_hash_index *index, unsigned long long key, void *value); // The key must be in the index already
+void kvds_hash_index_remove(kvds_hash_index *index, unsigned long long key); // The key must be in the index
+
+static inline size_t kvds_hash_index_home(kvds_hash_index_table *table, unsigned long long key) {
+  return (size_t)((key * 0x9e3779b97f4a7c15ull) >> table->shift); // Fibonacci hashing; spreads out runs of consecutive keys
+}
+
+// Value stored for the key, or NULL if there is none
+static inline void *kvds_hash_index_get(kvds_hash_index *index, unsigned long long key) {
+  kvds_hash_index_table *table = KVDS_LOAD(index->table);
+  for (size_t i = kvds_hash_index_home(table, key);; i = (i + 1) & table->mask) {
+    void *value = KVDS_LOAD(table->slots[i].value);
+    if (value == NULL || __atomic_load_n(&table->slots[i].key, __ATOMIC_RELAXED) == key) {
+      return value;
+    }
+  }
+}
@@ -1,5 +1,7 @@
 // SPDX-License-Identifier: MIT
 #pragma once
+#include "options.h"
+#include "value.h"
 #include <stdbool.h>
 
 enum kvds_snap_direction {
@@ -12,8 +14,8 @@ typedef void kvds_db;
 typedef void kvds_cursor;
 
 struct kvds_database_algo {
-  kvds_db *(*create_db)(); // NOTE: may need options
-  void (*destroy_db)(kvds_db *db, void (*free_data)(char *data)); // Ownership: may assume all cursors are freed ---- but what about char *data-s?
+  kvds_db *(*create_db)(const kvds_options *options); // Ownership: options borrowed for the duration of the call
+  void (*destroy_db)(kvds_db *db); // Ownership: may assume all cursors are freed; frees all stored values
 
   kvds_cursor *(*create_cursor)(kvds_db *db, long long key); // Ownership: cursor borrows DB
   void (*move_cursor)(kvds_db *db, kvds_cursor *cursor, long long key);
@@ -23,7 +25,23 @@ struct kvds_database_algo {
   bool (*exists)(kvds_db *db, kvds_cursor *cursor);
   void (*snap)(kvds_db *db, kvds_cursor *cursor, enum kvds_snap_direction dir);
 
-  char *(*write)(kvds_db *db, kvds_cursor *cursor, char *data); // Ownership: data owned to the db, returned value owned by caller
-  char *(*read)(kvds_db *db, kvds_cursor *cursor); // Ownership: returned value borrowed by caller
-  char *(*remove)(kvds_db *db, kvds_cursor *cursor); // Ownership: returned value owned by caller
+  void (*write)(kvds_db *db, kvds_cursor *cursor, const kvds_value *value); // Ownership: the db stores its own copy of the value (or keeps referencing it, if it's borrowed), and frees the one it replaces
+  const kvds_value *(*read)(kvds_db *db, kvds_cursor *cursor); // Ownership: returned value borrowed by caller until the next write or remove; NULL if the key doesn't exist
+  bool (*remove)(kvds_db *db, kvds_cursor *cursor); // Ownership: the db frees the removed value; returns whether the key existed
+
+  // Optional: calls callback for each existing key from the cursor's key up to `to` (inclusive) in ascending order, until it returns false. Does not move the cursor.
+  void (*iterate)(kvds_db *db, kvds_cursor *cursor, long long to, bool (*callback)(void *context, long long key, const kvds_value *value), void *context); // Ownership: value borrowed by callback
+  // Optional: fills an empty database with the entries returned by next, until it returns false. Keys must be strictly ascending; the caller is responsible for validating that. Cursors must be moved afterwards.
+  void (*bulk_load)(kvds_db *db, bool (*next)(void *context, long long *key, kvds_value *value), void *context); // Ownership: same as write; a transient value is only valid until next is called again
+
+  // Optional: order statistics, for algorithms that can find them without visiting every key in between
+  long long (*rank)(kvds_db *db, kvds_cursor *cursor); // Number of existing keys lower than the cursor's key
+  void (*nth)(kvds_db *db, kvds_cursor *cursor, long long index); // Moves the cursor to the index-th lowest existing key, counting from 0; indices past either end move it to the lowest or highest key, and an empty database leaves it where it is
+  long long (*count)(kvds_db *db, long long from, long long to); // Number of existing keys between from and to (inclusive); 0 if from > to
+
+  // Optional: the size and shape of the structure, for the stats command; may walk all of it
+  void (*shape)(kvds_db *db, long long *nodes, long long *height); // Height counts the nodes on the longest path down from the top, or is -1 for structures that aren't trees
+
+  // Optional: whether other threads may create, move, and use cursors for reading (everything but write, remove, bulk_load, and the order statistics) while a single thread writes, as long as they do so between kvds_ebr_enter and kvds_ebr_exit (see ebr.h), and the database was created with options->concurrent_readers set
+  bool concurrent_readers;
 };
@@ -1,18 +1,40 @@
 // SPDX-License-Identifier: MIT
+#include "binary.h"
 #include "commands.h"
 #include "interface.h"
 #include "registry.h"
+#include "server.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "wal.h"
 #include <limits.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+// Whether reading more input would block; input already buffered by stdio is not seen, which only makes us commit early
+static bool input_idle(FILE *input) {
+  struct pollfd fd = {.fd = fileno(input), .events = POLLIN};
+  return poll(&fd, 1, 0) != 1;
+}
+
 void print_usage(char **argv) {
   fprintf(stderr, "Usage:\n");
-  fprintf(stderr, "  %s [algorithm]\n\n", argv[0]);
-  fprintf(stderr, "Available algorithms:");
+  fprintf(stderr, "  %s [algorithm] [name=value...] [--snapshot path] [--wal path [--fsync always|group|none] [--group-commit-us microseconds]] [--binary | --listen path] [--time-commands]\n\n", argv[0]);
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  --snapshot path - Start from a snapshot previously written with the save command\n");
+  fprintf(stderr, "  --wal path - Replay the write-ahead log at path, then log every write and delete to it\n");
+  fprintf(stderr, "  --fsync policy - Sync the log after every change (always), after every group of changes (group, default), or never (none)\n");
+  fprintf(stderr, "  --group-commit-us microseconds - Let changes wait up to this long for more input to join their group (default 0, one group per line)\n");
+  fprintf(stderr, "  --binary - Speak the binary protocol on stdin/stdout instead of text commands (see README)\n");
+  fprintf(stderr, "  --listen path - Serve text commands to any number of clients over a Unix domain socket at path, until interrupted\n");
+  fprintf(stderr, "  --time-commands - Keep a latency histogram of each kind of text command, for the stats command, next to their counts\n\n");
+  fprintf(stderr, "Database options:\n");
+  kvds_options_print_usage(stderr);
+  fprintf(stderr, "\nAvailable algorithms:");
   struct kvds_registry_entry *last_entry = NULL;
   for (struct kvds_registry_entry *entry = kvds_get_algos_list(); entry != NULL; entry = entry->next) {
     if (last_entry != NULL && entry->algo == last_entry->algo) { // List multiple name of an algorithm on the same line
@@ -33,16 +55,79 @@ int main(int argc, char **argv) {
 #else
   char *algo_name = "scapegoat";
 #endif
-  if (argc == 2) {
-    if (strcmp(argv[1], "help") == 0 || strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0) {
+  char *snapshot_path = NULL;
+  char *wal_path = NULL;
+  enum kvds_wal_sync wal_sync = KVDS_WAL_SYNC_GROUP;
+  long long group_commit_us = 0;
+  bool binary = false;
+  char *listen_path = NULL;
+  kvds_options options = {0};
+  bool algo_given = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "help") == 0 || strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
       print_usage(argv);
       return 0;
+    } else if (strcmp(argv[i], "--snapshot") == 0) {
+      if (i + 1 == argc) {
+        fprintf(stderr, "Error: Missing path after --snapshot.\n");
+        print_usage(argv);
+        return 2;
+      }
+      snapshot_path = argv[++i];
+    } else if (strcmp(argv[i], "--wal") == 0) {
+      if (i + 1 == argc) {
+        fprintf(stderr, "Error: Missing path after --wal.\n");
+        print_usage(argv);
+        return 2;
+      }
+      wal_path = argv[++i];
+    } else if (strcmp(argv[i], "--fsync") == 0) {
+      if (i + 1 == argc || !kvds_wal_parse_sync(argv[i + 1], &wal_sync)) {
+        fprintf(stderr, "Error: Expected always, group, or none after --fsync.\n");
+        print_usage(argv);
+        return 2;
+      }
+      i++;
+    } else if (strcmp(argv[i], "--group-commit-us") == 0) {
+      char *end = NULL;
+      if (i + 1 < argc) {
+        group_commit_us = strtoll(argv[i + 1], &end, 10);
+      }
+      if (end == NULL || end == argv[i + 1] || end[0] != '\0' || group_commit_us < 0) {
+        fprintf(stderr, "Error: Expected a number of microseconds after --group-commit-us.\n");
+        print_usage(argv);
+        return 2;
+      }
+      i++;
+    } else if (strcmp(argv[i], "--time-commands") == 0) {
+      kvds_stats_timing = true;
+    } else if (strcmp(argv[i], "--binary") == 0) {
+      binary = true;
+    } else if (strcmp(argv[i], "--listen") == 0) {
+      if (i + 1 == argc) {
+        fprintf(stderr, "Error: Missing path after --listen.\n");
+        print_usage(argv);
+        return 2;
+      }
+      listen_path = argv[++i];
+    } else if (argv[i][0] != '-' && strchr(argv[i], '=') != NULL) {
+      if (!kvds_options_parse(argv[i], &options)) {
+        fprintf(stderr, "Error: Invalid option: %s\n", argv[i]);
+        print_usage(argv);
+        return 2;
+      }
+    } else if (!algo_given) {
+      algo_name = argv[i];
+      algo_given = true;
+    } else {
+      fprintf(stderr, "Error: Too many arguments.\n");
+      print_usage(argv);
+      return 2;
     }
-
-    algo_name = argv[1];
   }
-  if (argc > 2) {
-    fprintf(stderr, "Error: Too many arguments.\n");
+
+  if (binary && listen_path != NULL) {
+    fprintf(stderr, "Error: --binary and --listen can't be used together.\n");
     print_usage(argv);
     return 2;
   }
@@ -55,9 +140,9 @@ int main(int argc, char **argv) {
     return 2;
   }
 
-  bool interactive = isatty(fileno(stdin));
+  bool interactive = !binary && listen_path == NULL && isatty(fileno(stdin));
 
-  kvds_db *db = algo->create_db();
+  kvds_db *db = algo->create_db(&options);
 
   if (db == NULL) {
     fprintf(stderr, "Error: Failed to create database");
@@ -72,14 +157,55 @@ int main(int argc, char **argv) {
 
   int exit_code = 0;
 
-  char line[1024];
-  while (true) {
+  if (snapshot_path != NULL) {
+    int err = kvds_serve_snapshot(state, snapshot_path);
+    if (err != KVDS_OK) {
+      fprintf(stderr, "Error: Failed to open snapshot %s: %s\n", snapshot_path, kvds_describe_error(err));
+      kvds_destroy_command_state(state);
+      algo->destroy_db(db);
+      kvds_snapshot_close_all();
+      return 2;
+    }
+    algo = state->algo; // Now the snapshot with the database on top
+    db = state->db;
+  }
+
+  if (wal_path != NULL) {
+    int err = kvds_open_wal(state, wal_path, wal_sync, group_commit_us);
+    if (err != KVDS_OK) {
+      fprintf(stderr, "Error: Failed to open write-ahead log %s: %s\n", wal_path, kvds_describe_error(err));
+      kvds_destroy_command_state(state);
+      algo->destroy_db(db);
+      kvds_snapshot_close_all();
+      return 2;
+    }
+  }
+
+  if (binary) {
+    int err = kvds_serve_binary(state, fileno(stdin), fileno(stdout));
+    if (err != KVDS_OK) {
+      fprintf(stderr, "Error: %s\n", kvds_describe_error(err));
+      exit_code = 2;
+    }
+  }
+
+  if (listen_path != NULL) {
+    int err = kvds_serve_socket(state, listen_path);
+    if (err != KVDS_OK) {
+      fprintf(stderr, "Error: Failed to serve on %s: %s\n", listen_path, kvds_describe_error(err));
+      exit_code = 2;
+    }
+  }
+
+  char *line = NULL;
+  size_t line_capacity = 0;
+  while (!binary && listen_path == NULL) {
     if (interactive) {
       fflush(stdout);
       fprintf(stderr, "> ");
     }
 
-    if (fgets(line, sizeof line / sizeof line[0], stdin)) {
+    if (getline(&line, &line_capacity, stdin) != -1) {
       int err = kvds_execute_command(state, line, stdout);
       if (err != KVDS_OK) {
         fprintf(stderr, "Error: %s\n", kvds_describe_error(err));
@@ -90,6 +216,13 @@ int main(int argc, char **argv) {
       } else {
         exit_code = 0;
       }
+      // Only worth checking for more input if we are allowed to wait for it
+      err = kvds_flush_wal(state, group_commit_us == 0 || input_idle(stdin));
+      if (err != KVDS_OK) {
+        fprintf(stderr, "Error: %s\n", kvds_describe_error(err));
+        exit_code = 2;
+        break;
+      }
     }
     if (ferror(stdin)) {
       fprintf(stderr, "Read error: %d", ferror(stdin));
@@ -101,8 +234,10 @@ int main(int argc, char **argv) {
     }
   }
 
+  free(line);
   kvds_destroy_command_state(state);
-  algo->destroy_db(db, (void *)&free);
+  algo->destroy_db(db);
+  kvds_snapshot_close_all(); // Only now that nothing borrows values from them anymore
 
   return exit_code;
 }
@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: MIT
+#include "options.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define KVDS_OPTIONS_KEY_BYTES 32 // Less memory than any algorithm takes per key, for telling apart capacities that could never fit
+
+// Keys that could fit into the machine's memory at all, or 1e18 if that is unknown
+static double kvds_options_max_capacity() {
+  long pages = sysconf(_SC_PHYS_PAGES);
+  long page_size = sysconf(_SC_PAGESIZE);
+  return pages > 0 && page_size > 0 ? (double)pages * page_size / KVDS_OPTIONS_KEY_BYTES : 1e18;
+}
+
+// Parses all of text as a number, which may be written in exponent notation (e.g. 1e7)
+static bool kvds_options_parse_number(const char *text, double *number) {
+  char *end = NULL;
+  *number = strtod(text, &end);
+  return end != text && end[0] == '\0' && isfinite(*number);
+}
+
+bool kvds_options_parse(const char *option, kvds_options *options) {
+  const char *value = strchr(option, '=');
+  if (value == NULL) {
+    return false;
+  }
+  size_t name_length = value - option;
+  value++;
+  double number;
+  if (name_length == 5 && strncmp(option, "alpha", 5) == 0) {
+    if (!kvds_options_parse_number(value, &number) || !(number >= 0.5 && number < 1)) {
+      return false;
+    }
+    options->alpha = number;
+  } else if (name_length == 14 && strncmp(option, "splay_interval", 14) == 0) {
+    if (!kvds_options_parse_number(value, &number) || !(number >= 1 && number <= 1e9) || number != (long long)number) {
+      return false;
+    }
+    options->splay_interval = (long long)number;
+  } else if (name_length == 8 && strncmp(option, "capacity", 8) == 0) {
+    if (!kvds_options_parse_number(value, &number) || number < 0 || number > kvds_options_max_capacity()) {
+      return false;
+    }
+    options->capacity = (long long)number;
+  } else if (name_length == 9 && strncmp(option, "allocator", 9) == 0) {
+    if (strcmp(value, "slabs") == 0) {
+      options->allocator = KVDS_ALLOCATOR_SLABS;
+    } else if (strcmp(value, "hugetlb") == 0) {
+      options->allocator = KVDS_ALLOCATOR_HUGETLB;
+    } else if (strcmp(value, "malloc") == 0) {
+      options->allocator = KVDS_ALLOCATOR_MALLOC;
+    } else {
+      return false;
+    }
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void kvds_options_print_usage(FILE *output) {
+  fprintf(output, "  alpha=fraction - Rebuild scapegoat tree subtrees once one side holds more than this fraction of their nodes, between 0.5 and 1 (default 0.625)\n");
+  fprintf(output, "  splay_interval=n - Only splay splay trees on every n-th cursor move or snap, and just search them on the others (default 1)\n");
+  fprintf(output, "  capacity=keys - Size arenas and indexes for this many keys up front, e.g. capacity=1e7 (default 0, grow as needed); has to fit into memory\n");
+  fprintf(output, "  allocator=slabs|hugetlb|malloc - Allocate nodes from slabs with transparent huge pages, from slabs with explicit huge pages (falling back to slabs), or with a malloc each\n");
+}
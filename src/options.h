@@ -0,0 +1,18 @@
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "arena.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+// Options for creating a database, given as name=value arguments after the algorithm's name.
+// A zeroed field means the algorithm's default; algorithms that have no use for an option ignore it, and wrapping algorithms (shard, lsm, inv) pass them on to the ones they wrap.
+typedef struct kvds_options {
+  double alpha; // Weight balance of scapegoat trees: a subtree gets rebuilt once one side holds more than alpha of its nodes; between 0.5 and 1
+  long long splay_interval; // Splay trees only splay on every this-many-th cursor move or snap, and just search the tree on the others
+  long long capacity; // Number of keys expected, so that arenas and indexes can be sized for them up front
+  enum kvds_allocator allocator; // Where arenas get their slots from
+  bool concurrent_readers; // Whether other threads are going to read while one writes (see interface.h); algorithms only pay for allowing that, by copying nodes instead of changing them in place, when it's set
+} kvds_options;
+
+bool kvds_options_parse(const char *option, kvds_options *options); // Parses a single name=value option into options; returns false if the name is unknown or the value invalid
+void kvds_options_print_usage(FILE *output);
@@ -0,0 +1,321 @@
+// SPDX-License-Identifier: MIT
+#include "overlay.h"
+#include "hash_index.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+
+typedef struct kvds_overlay_db {
+  kvds_snapshot *snapshot;
+  struct kvds_database_algo *algo; // Of the database on top
+  kvds_db *top;
+  kvds_cursor *probe; // Top cursor for looking around, so that cursors can stay where they are
+  // Entries of the snapshot that are only to be looked up on top anymore, by index; each one links to an index further along its run of shadowed entries, upwards (ahead) and downwards (behind)
+  // The links form a union-find forest, flattened as it is followed, so that skipping over a run costs O(log n) amortized however long it is
+  kvds_hash_index ahead;
+  kvds_hash_index behind;
+} kvds_overlay_db;
+
+typedef struct kvds_overlay_cursor {
+  long long key;
+  kvds_cursor *top; // Always at key
+  kvds_value value; // Last value read from the snapshot
+} kvds_overlay_cursor;
+
+// Snapshot side
+
+// Index of the first snapshot key at least as high as key, or count if there is none
+static uint64_t kvds_overlay_lower_bound(kvds_snapshot *snapshot, long long key) {
+  uint64_t low = 0;
+  uint64_t high = snapshot->count;
+  while (low < high) {
+    uint64_t middle = low + (high - low) / 2;
+    if (snapshot->keys[middle] < key) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+// Links are stored as the index they point at plus 2, as they can point one past either end, and a hash index value can't be NULL
+static void *kvds_overlay_link(int64_t i) {
+  return (void *)(uintptr_t)(i + 2);
+}
+static int64_t kvds_overlay_link_target(void *link) {
+  return (int64_t)(uintptr_t)link - 2;
+}
+
+static bool kvds_overlay_shadowed(kvds_overlay_db *db, int64_t i) {
+  return kvds_hash_index_get(&db->ahead, i) != NULL;
+}
+
+// First index from i on, upwards (or downwards), that isn't shadowed, or one past the end; points every link passed on the way straight at it
+static int64_t kvds_overlay_skip(kvds_overlay_db *db, int64_t i, bool higher) {
+  kvds_hash_index *links = higher ? &db->ahead : &db->behind;
+  int64_t end = i;
+  for (void *link; (link = kvds_hash_index_get(links, end)) != NULL;) {
+    end = kvds_overlay_link_target(link);
+  }
+  while (i != end) {
+    int64_t next = kvds_overlay_link_target(kvds_hash_index_get(links, i));
+    kvds_hash_index_set(links, i, kvds_overlay_link(end));
+    i = next;
+  }
+  return end;
+}
+
+// Whether entry i of the snapshot is still part of the database; broken entries never are
+static bool kvds_overlay_visible(kvds_overlay_db *db, uint64_t i, long long *key, kvds_value *value) {
+  return !kvds_overlay_shadowed(db, i) && kvds_snapshot_entry(db->snapshot, i, key, value);
+}
+
+static bool kvds_overlay_base_find(kvds_overlay_db *db, long long key, kvds_value *value) {
+  uint64_t i = kvds_overlay_lower_bound(db->snapshot, key);
+  long long found;
+  return kvds_overlay_visible(db, i, &found, value) && found == key;
+}
+
+// Nearest visible snapshot key above (or below) key; jumps over runs of shadowed keys, and only steps over broken entries one by one
+static bool kvds_overlay_base_neighbour(kvds_overlay_db *db, long long key, bool higher, long long *result) {
+  kvds_value value;
+  int64_t count = db->snapshot->count;
+  int64_t i = kvds_overlay_lower_bound(db->snapshot, key);
+  if (higher) {
+    for (i = kvds_overlay_skip(db, i, true); i < count; i = kvds_overlay_skip(db, i + 1, true)) {
+      if (kvds_snapshot_entry(db->snapshot, i, result, &value) && *result > key) {
+        return true;
+      }
+    }
+  } else {
+    for (i = kvds_overlay_skip(db, i - 1, false); i >= 0; i = kvds_overlay_skip(db, i - 1, false)) {
+      if (kvds_snapshot_entry(db->snapshot, i, result, &value) && *result < key) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Stops the snapshot from showing key, if it has it
+static void kvds_overlay_shadow(kvds_overlay_db *db, long long key) {
+  uint64_t i = kvds_overlay_lower_bound(db->snapshot, key);
+  if (i < db->snapshot->count && db->snapshot->keys[i] == key && !kvds_overlay_shadowed(db, i)) {
+    // Runs next to it join up through these as they get followed
+    kvds_hash_index_put(&db->ahead, i, kvds_overlay_link(i + 1));
+    kvds_hash_index_put(&db->behind, i, kvds_overlay_link((int64_t)i - 1));
+  }
+}
+
+// Top side
+
+static bool kvds_overlay_top_neighbour(kvds_overlay_db *db, long long key, bool higher, long long *result) {
+  db->algo->move_cursor(db->top, db->probe, key);
+  db->algo->snap(db->top, db->probe, higher ? KVDS_SNAP_HIGHER : KVDS_SNAP_LOWER);
+  *result = db->algo->key(db->top, db->probe);
+  return (higher ? *result > key : *result < key) && db->algo->exists(db->top, db->probe); // Snapping past the edge doesn't go anywhere past key
+}
+
+// Nearest existing key above (or below) key, from either side
+static bool kvds_overlay_neighbour(kvds_overlay_db *db, long long key, bool higher, long long *result) {
+  long long base, top;
+  bool has_base = kvds_overlay_base_neighbour(db, key, higher, &base);
+  bool has_top = kvds_overlay_top_neighbour(db, key, higher, &top);
+  if (!has_base && !has_top) {
+    return false;
+  }
+  *result = !has_top || (has_base && (higher ? base < top : base > top)) ? base : top;
+  return true;
+}
+
+kvds_db *kvds_overlay_create(struct kvds_database_algo *algo, kvds_db *top, kvds_snapshot *snapshot) {
+  assert(algo->iterate != NULL);
+  kvds_overlay_db *db = malloc(sizeof(kvds_overlay_db));
+  db->snapshot = snapshot;
+  db->algo = algo;
+  db->top = top;
+  db->probe = algo->create_cursor(top, 0);
+  kvds_hash_index_init(&db->ahead, NULL);
+  kvds_hash_index_init(&db->behind, NULL);
+  return db;
+}
+
+static kvds_db *kvds_overlay_create_db(const kvds_options *options) {
+  return NULL; // Only ever made by kvds_overlay_create
+}
+
+static void kvds_overlay_destroy_db(kvds_db *_db) {
+  kvds_overlay_db *db = _db;
+  db->algo->destroy_cursor(db->top, db->probe);
+  db->algo->destroy_db(db->top);
+  kvds_hash_index_release(&db->ahead);
+  kvds_hash_index_release(&db->behind);
+  free(db);
+}
+
+static kvds_cursor *kvds_overlay_create_cursor(kvds_db *_db, long long key) {
+  kvds_overlay_db *db = _db;
+  kvds_overlay_cursor *cursor = malloc(sizeof(kvds_overlay_cursor));
+  cursor->key = key;
+  cursor->top = db->algo->create_cursor(db->top, key);
+  return cursor;
+}
+
+static void kvds_overlay_move_cursor(kvds_db *_db, kvds_cursor *_cursor, long long key) {
+  kvds_overlay_db *db = _db;
+  kvds_overlay_cursor *cursor = _cursor;
+  cursor->key = key;
+  db->algo->move_cursor(db->top, cursor->top, key);
+}
+
+static void kvds_overlay_destroy_cursor(kvds_db *_db, kvds_cursor *_cursor) {
+  kvds_overlay_db *db = _db;
+  kvds_overlay_cursor *cursor = _cursor;
+  db->algo->destroy_cursor(db->top, cursor->top);
+  free(cursor);
+}
+
+static long long kvds_overlay_key(kvds_db *_db, kvds_cursor *_cursor) {
+  kvds_overlay_cursor *cursor = _cursor;
+  return cursor->key;
+}
+
+static bool kvds_overlay_exists(kvds_db *_db, kvds_cursor *_cursor) {
+  kvds_overlay_db *db = _db;
+  kvds_overlay_cursor *cursor = _cursor;
+  return db->algo->exists(db->top, cursor->top) || kvds_overlay_base_find(db, cursor->key, &cursor->value);
+}
+
+static void kvds_overlay_snap(kvds_db *_db, kvds_cursor *_cursor, enum kvds_snap_direction dir) {
+  kvds_overlay_db *db = _db;
+  kvds_overlay_cursor *cursor = _cursor;
+  bool exists = kvds_overlay_exists(db, cursor);
+  long long lower, higher;
+  long long target = cursor->key;
+  switch (dir) {
+  case KVDS_SNAP_HIGHER:
+    if (kvds_overlay_neighbour(db, cursor->key, true, &higher)) {
+      target = higher;
+    } else if (!exists && kvds_overlay_neighbour(db, cursor->key, false, &lower)) {
+      target = lower; // The highest key, as there is nothing above
+    }
+    break;
+  case KVDS_SNAP_LOWER:
+    if (kvds_overlay_neighbour(db, cursor->key, false, &lower)) {
+      target = lower;
+    } else if (!exists && kvds_overlay_neighbour(db, cursor->key, true, &higher)) {
+      target = higher; // The lowest key, as there is nothing below
+    }
+    break;
+  case KVDS_SNAP_CLOSEST_LOW: {
+    if (exists) {
+      break; // Already at closest
+    }
+    bool has_lower = kvds_overlay_neighbour(db, cursor->key, false, &lower);
+    bool has_higher = kvds_overlay_neighbour(db, cursor->key, true, &higher);
+    if (has_lower && (!has_higher || (unsigned long long)cursor->key - lower <= (unsigned long long)higher - cursor->key)) {
+      target = lower;
+    } else if (has_higher) {
+      target = higher;
+    }
+    break;
+  }
+  }
+  kvds_overlay_move_cursor(db, cursor, target);
+}
+
+static void kvds_overlay_write(kvds_db *_db, kvds_cursor *_cursor, const kvds_value *value) {
+  kvds_overlay_db *db = _db;
+  kvds_overlay_cursor *cursor = _cursor;
+  db->algo->write(db->top, cursor->top, value);
+  kvds_overlay_shadow(db, cursor->key);
+}
+
+static const kvds_value *kvds_overlay_read(kvds_db *_db, kvds_cursor *_cursor) {
+  kvds_overlay_db *db = _db;
+  kvds_overlay_cursor *cursor = _cursor;
+  const kvds_value *value = db->algo->read(db->top, cursor->top);
+  if (value == NULL && kvds_overlay_base_find(db, cursor->key, &cursor->value)) {
+    value = &cursor->value; // Borrowed from the mapping
+  }
+  return value;
+}
+
+static bool kvds_overlay_remove(kvds_db *_db, kvds_cursor *_cursor) {
+  kvds_overlay_db *db = _db;
+  kvds_overlay_cursor *cursor = _cursor;
+  bool existed = kvds_overlay_exists(db, cursor);
+  db->algo->remove(db->top, cursor->top);
+  kvds_overlay_shadow(db, cursor->key);
+  return existed;
+}
+
+typedef struct kvds_overlay_iterate_context {
+  kvds_overlay_db *db;
+  uint64_t position; // Next snapshot entry to pass on
+  bool (*callback)(void *context, long long key, const kvds_value *value);
+  void *context;
+  bool stopped;
+} kvds_overlay_iterate_context;
+
+// Passes on the visible snapshot entries up to limit (inclusive); shadowed ones come from the top instead
+static bool kvds_overlay_iterate_base(kvds_overlay_iterate_context *context, long long limit) {
+  kvds_snapshot *snapshot = context->db->snapshot;
+  for (context->position = kvds_overlay_skip(context->db, context->position, true); !context->stopped && context->position < snapshot->count && snapshot->keys[context->position] <= limit; context->position = kvds_overlay_skip(context->db, context->position + 1, true)) {
+    long long key;
+    kvds_value value;
+    if (kvds_snapshot_entry(snapshot, context->position, &key, &value)) {
+      context->stopped = !context->callback(context->context, key, &value);
+    }
+  }
+  return !context->stopped;
+}
+
+static bool kvds_overlay_iterate_top(void *_context, long long key, const kvds_value *value) {
+  kvds_overlay_iterate_context *context = _context;
+  if (key > LLONG_MIN && !kvds_overlay_iterate_base(context, key - 1)) {
+    return false;
+  }
+  context->stopped = !context->callback(context->context, key, value);
+  return !context->stopped;
+}
+
+static void kvds_overlay_iterate(kvds_db *_db, kvds_cursor *_cursor, long long to, bool (*callback)(void *context, long long key, const kvds_value *value), void *context) {
+  kvds_overlay_db *db = _db;
+  kvds_overlay_cursor *cursor = _cursor;
+  kvds_overlay_iterate_context merge = {
+    .db = db,
+    .position = kvds_overlay_lower_bound(db->snapshot, cursor->key),
+    .callback = callback,
+    .context = context,
+    .stopped = false,
+  };
+  db->algo->iterate(db->top, cursor->top, to, kvds_overlay_iterate_top, &merge);
+  kvds_overlay_iterate_base(&merge, to);
+}
+
+static void kvds_overlay_shape(kvds_db *_db, long long *nodes, long long *height) {
+  kvds_overlay_db *db = _db;
+  *nodes = 0;
+  *height = -1;
+  if (db->algo->shape) { // Only the top has a shape; the snapshot is a flat array
+    db->algo->shape(db->top, nodes, height);
+  }
+}
+
+struct kvds_database_algo kvds_overlay_algo = {
+  .create_db = kvds_overlay_create_db,
+  .destroy_db = kvds_overlay_destroy_db,
+  .create_cursor = kvds_overlay_create_cursor,
+  .move_cursor = kvds_overlay_move_cursor,
+  .destroy_cursor = kvds_overlay_destroy_cursor,
+  .key = kvds_overlay_key,
+  .exists = kvds_overlay_exists,
+  .snap = kvds_overlay_snap,
+  .write = kvds_overlay_write,
+  .read = kvds_overlay_read,
+  .remove = kvds_overlay_remove,
+  .iterate = kvds_overlay_iterate,
+  .shape = kvds_overlay_shape,
+};
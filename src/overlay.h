@@ -0,0 +1,14 @@
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "interface.h"
+#include "snapshot.h"
+
+// A database made of an open snapshot, read in place from its mapping, with another database on top of it holding everything written since.
+// Opening a snapshot this way only costs the page faults of the entries that get looked at, however big it is; keys only make it into the database on top as they get written.
+// Entries of the snapshot whose keys have been written or removed since are marked as shadowed, so that lookups know to skip them; the snapshot itself is never changed.
+// Runs of shadowed entries are linked up union-find style, so that moving past a run of k of them costs O(log n) amortized rather than O(k); broken entries are still stepped over one by one.
+// Order statistics are left to the fallbacks in commands.c, which count through iterate.
+
+extern struct kvds_database_algo kvds_overlay_algo;
+
+kvds_db *kvds_overlay_create(struct kvds_database_algo *algo, kvds_db *db, kvds_snapshot *snapshot); // Ownership: the overlay takes over db, which must be empty and have iterate; the snapshot stays mapped until kvds_snapshot_close_all
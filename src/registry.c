@@ -22,3 +22,58 @@ struct kvds_database_algo *kvds_get_algo(const char *name) {
 struct kvds_registry_entry *kvds_get_algos_list() {
   return registry_entries;
 }
+
+void kvds_algo_iterate(struct kvds_database_algo *algo, kvds_db *db, kvds_cursor *cursor, long long to, bool (*callback)(void *context, long long key, const kvds_value *value), void *context) {
+  if (algo->iterate != NULL) {
+    algo->iterate(db, cursor, to, callback, context);
+    return;
+  }
+  long long from = algo->key(db, cursor);
+  kvds_cursor *walker = algo->create_cursor(db, from);
+  if (!algo->exists(db, walker)) {
+    algo->snap(db, walker, KVDS_SNAP_HIGHER);
+  }
+  long long last = from;
+  bool first = true;
+  while (algo->exists(db, walker)) {
+    long long key = algo->key(db, walker);
+    if (key < from || key > to || (!first && key <= last)) {
+      break; // Past either end; snapping past the highest key stays on it
+    }
+    if (!callback(context, key, algo->read(db, walker))) {
+      break;
+    }
+    last = key;
+    first = false;
+    algo->snap(db, walker, KVDS_SNAP_HIGHER);
+  }
+  algo->destroy_cursor(db, walker);
+}
+
+typedef struct kvds_algo_count_context {
+  long long count;
+  long long stop_after; // Negative for no limit
+  long long last;
+} kvds_algo_count_context;
+
+static bool kvds_algo_count_one(void *_context, long long key, const kvds_value *value) {
+  kvds_algo_count_context *context = _context;
+  context->count++;
+  context->last = key;
+  return context->count != context->stop_after;
+}
+
+long long kvds_algo_count_walk(struct kvds_database_algo *algo, kvds_db *db, long long from, long long to, long long stop_after, long long *last) {
+  kvds_algo_count_context context = {
+    .count = 0,
+    .stop_after = stop_after,
+    .last = 0,
+  };
+  kvds_cursor *walker = algo->create_cursor(db, from);
+  kvds_algo_iterate(algo, db, walker, to, kvds_algo_count_one, &context);
+  algo->destroy_cursor(db, walker);
+  if (last != NULL && context.count > 0) {
+    *last = context.last;
+  }
+  return context.count;
+}
@@ -27,3 +27,9 @@ struct kvds_registry_entry {
 void kvds_register_algo_entry(struct kvds_registry_entry *entry);
 struct kvds_database_algo *kvds_get_algo(const char *name);
 struct kvds_registry_entry *kvds_get_algos_list();
+
+// Calls callback for each key from the cursor's key up to to, in order, until it returns false; goes through algo->iterate, or walks a separate cursor up with snap for algorithms without it
+void kvds_algo_iterate(struct kvds_database_algo *algo, kvds_db *db, kvds_cursor *cursor, long long to, bool (*callback)(void *context, long long key, const kvds_value *value), void *context);
+// Counts the keys from from to to by visiting them with kvds_algo_iterate, stopping after stop_after of them unless it is negative; the last key visited goes into *last, if given and there was one
+// This is what rank, nth, and count fall back to for algorithms without order statistics
+long long kvds_algo_count_walk(struct kvds_database_algo *algo, kvds_db *db, long long from, long long to, long long stop_after, long long *last);
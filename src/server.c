@@ -0,0 +1,304 @@
+// SPDX-License-Identifier: MIT
+#define _GNU_SOURCE // For fopencookie and accept4
+#include "server.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define KVDS_SERVER_EVENTS 64
+#define KVDS_SERVER_READ_SIZE (64 * 1024) // Per client, per round; so that one busy client can't starve the others
+
+typedef struct kvds_client {
+  int fd;
+  struct kvds_command_state *state;
+
+  long long key; // Where the cursor was left at the end of the client's last batch
+  unsigned long long generation; // The server's generation at that point; if it has moved on, the cursor may be dangling
+
+  char *input;
+  size_t input_used;
+  size_t input_capacity;
+
+  char *output;
+  size_t output_used;
+  size_t output_sent;
+  size_t output_capacity;
+  FILE *output_file; // Appends to output
+
+  bool closing; // Quit or hung up; closed once the output is sent
+  uint32_t events; // What the client is registered for in the epoll set
+
+  struct kvds_client *prev;
+  struct kvds_client *next;
+} kvds_client;
+
+typedef struct kvds_server {
+  struct kvds_command_state *state;
+  int epoll_fd;
+  int listen_fd;
+  unsigned long long generation; // Bumped after every batch that changed the database
+  kvds_client *clients; // All connected clients, so that they can be closed when stopping
+} kvds_server;
+
+static volatile sig_atomic_t kvds_server_stopping = 0;
+
+static void kvds_server_stop(int signal) {
+  kvds_server_stopping = 1;
+}
+
+static ssize_t kvds_client_append(void *_client, const char *bytes, size_t size) {
+  kvds_client *client = _client;
+  if (client->output_used + size > client->output_capacity) {
+    client->output_capacity = client->output_capacity * 2 > client->output_used + size ? client->output_capacity * 2 : client->output_used + size;
+    client->output = realloc(client->output, client->output_capacity);
+  }
+  memcpy(client->output + client->output_used, bytes, size);
+  client->output_used += size;
+  return size;
+}
+
+static kvds_client *kvds_client_create(kvds_server *server, int fd) {
+  kvds_client *client = malloc(sizeof(kvds_client));
+  *client = (kvds_client){
+    .fd = fd,
+    .state = kvds_create_command_state(server->state->algo, server->state->db),
+    .key = 0,
+    .generation = server->generation,
+    .input_capacity = KVDS_SERVER_READ_SIZE + 1,
+    .output_capacity = 4096,
+    .closing = false,
+    .events = EPOLLIN,
+    .prev = NULL,
+    .next = server->clients,
+  };
+  if (server->clients != NULL) {
+    server->clients->prev = client;
+  }
+  server->clients = client;
+  client->state->wal = server->state->wal;
+  client->input = malloc(client->input_capacity);
+  client->output = malloc(client->output_capacity);
+  client->output_file = fopencookie(client, "w", (cookie_io_functions_t){.write = kvds_client_append});
+  return client;
+}
+
+static void kvds_client_destroy(kvds_server *server, kvds_client *client) {
+  if (client->prev != NULL) {
+    client->prev->next = client->next;
+  } else {
+    server->clients = client->next;
+  }
+  if (client->next != NULL) {
+    client->next->prev = client->prev;
+  }
+  close(client->fd); // Also removes it from the epoll set
+  fclose(client->output_file);
+  client->state->wal = NULL; // Owned by the server
+  kvds_destroy_command_state(client->state);
+  free(client->input);
+  free(client->output);
+  free(client);
+}
+
+// Executes a single line from the client's input buffer; the line must end with a newline that isn't the last byte of the buffer's capacity
+static void kvds_client_execute(kvds_client *client, char *line, size_t length) {
+  char after = line[length]; // Temporarily terminate the line right after its newline
+  line[length] = '\0';
+  kvds_error err = kvds_execute_command(client->state, line, client->output_file);
+  line[length] = after;
+  if (err == KVDS_QUIT) {
+    client->closing = true;
+  } else if (err != KVDS_OK) {
+    fprintf(client->output_file, "Error: %s\n", kvds_describe_error(err));
+  }
+}
+
+// Reads whatever the client sent and executes all complete lines in it
+static void kvds_client_receive(kvds_server *server, kvds_client *client) {
+  if (client->input_capacity - client->input_used < KVDS_SERVER_READ_SIZE + 1) {
+    client->input_capacity = client->input_used + KVDS_SERVER_READ_SIZE + 1;
+    client->input = realloc(client->input, client->input_capacity);
+  }
+  ssize_t got = read(client->fd, client->input + client->input_used, KVDS_SERVER_READ_SIZE);
+  if (got == -1 && (errno == EAGAIN || errno == EINTR)) {
+    return;
+  }
+  if (got <= 0) {
+    client->closing = true;
+    if (client->input_used == 0) {
+      return;
+    }
+    client->input[client->input_used++] = '\n'; // Run the unterminated last line too, like on stdin
+  } else {
+    client->input_used += got;
+  }
+
+  // Re-seek the cursor if another client has changed the database since this one last ran
+  struct kvds_database_algo *algo = client->state->algo;
+  if (client->generation != server->generation) {
+    algo->destroy_cursor(client->state->db, client->state->cursor);
+    client->state->cursor = algo->create_cursor(client->state->db, client->key);
+  }
+  unsigned long long changes = client->state->changes;
+
+  size_t start = 0;
+  for (size_t i = 0; i < client->input_used && !client->closing; i++) {
+    if (client->input[i] == '\n') {
+      kvds_client_execute(client, client->input + start, i + 1 - start);
+      start = i + 1;
+    }
+  }
+  memmove(client->input, client->input + start, client->input_used - start);
+  client->input_used -= start;
+  fflush(client->output_file);
+
+  if (client->state->changes != changes) {
+    server->generation++;
+  }
+  client->generation = server->generation;
+  client->key = algo->key(client->state->db, client->state->cursor);
+}
+
+// Sends as much of the pending output as the socket takes; returns false if the client is done and should be closed
+static bool kvds_client_send(kvds_server *server, kvds_client *client) {
+  while (client->output_sent < client->output_used) {
+    ssize_t sent = send(client->fd, client->output + client->output_sent, client->output_used - client->output_sent, MSG_NOSIGNAL);
+    if (sent == -1 && errno == EINTR) {
+      continue;
+    }
+    if (sent == -1 && errno == EAGAIN) {
+      break;
+    }
+    if (sent == -1) {
+      return false;
+    }
+    client->output_sent += sent;
+  }
+  bool pending = client->output_sent < client->output_used;
+  if (!pending) {
+    client->output_used = 0;
+    client->output_sent = 0;
+  }
+  // Only wait for the socket to become writable while there is something to write, and stop reading once the client is done
+  uint32_t events = (client->closing ? 0 : EPOLLIN) | (pending ? EPOLLOUT : 0);
+  if (events != client->events) {
+    struct epoll_event event = {.events = events, .data.ptr = client};
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+    client->events = events;
+  }
+  return pending || !client->closing;
+}
+
+static void kvds_server_accept(kvds_server *server) {
+  while (true) {
+    int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) {
+      return; // EAGAIN once there are no more, or an error that the next round will retry
+    }
+    kvds_client *client = kvds_client_create(server, fd);
+    struct epoll_event event = {.events = client->events, .data.ptr = client};
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+  }
+}
+
+static int kvds_server_listen(const char *path) {
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    return -1;
+  }
+  strcpy(address.sun_path, path);
+
+  struct stat st;
+  if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path); // Left over from a previous run
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    return -1;
+  }
+  if (bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1 || listen(fd, SOMAXCONN) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+kvds_error kvds_serve_socket(struct kvds_command_state *state, const char *path) {
+  kvds_server server = {
+    .state = state,
+    .epoll_fd = epoll_create1(EPOLL_CLOEXEC),
+    .listen_fd = kvds_server_listen(path),
+    .generation = 0,
+    .clients = NULL,
+  };
+  if (server.epoll_fd == -1 || server.listen_fd == -1) {
+    if (server.epoll_fd != -1) close(server.epoll_fd);
+    if (server.listen_fd != -1) close(server.listen_fd);
+    return KVDS_IO_ERROR;
+  }
+  struct epoll_event listen_event = {.events = EPOLLIN, .data.ptr = NULL};
+  epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &listen_event);
+
+  // No SA_RESTART, so that epoll_wait returns when asked to stop
+  struct sigaction action = {.sa_handler = kvds_server_stop};
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  kvds_error result = KVDS_OK;
+  struct epoll_event events[KVDS_SERVER_EVENTS];
+  while (!kvds_server_stopping) {
+    int count = epoll_wait(server.epoll_fd, events, KVDS_SERVER_EVENTS, -1);
+    if (count == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      result = KVDS_IO_ERROR;
+      break;
+    }
+
+    for (int i = 0; i < count; i++) {
+      if (events[i].data.ptr == NULL) {
+        kvds_server_accept(&server);
+        continue;
+      }
+      kvds_client *client = events[i].data.ptr;
+      if (!client->closing && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+        kvds_client_receive(&server, client);
+      }
+    }
+
+    // Commit the whole round's changes as a single group before acknowledging any of them
+    result = kvds_flush_wal(state, true);
+    if (result != KVDS_OK) {
+      break;
+    }
+
+    for (int i = 0; i < count; i++) {
+      if (events[i].data.ptr == NULL) {
+        continue;
+      }
+      kvds_client *client = events[i].data.ptr;
+      if (!kvds_client_send(&server, client)) {
+        kvds_client_destroy(&server, client);
+      }
+    }
+  }
+
+  while (server.clients != NULL) {
+    kvds_client_destroy(&server, server.clients);
+  }
+  close(server.listen_fd);
+  close(server.epoll_fd);
+  unlink(path);
+  return result;
+}
@@ -0,0 +1,9 @@
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "commands.h"
+
+// Serves text commands to any number of clients connected to a Unix domain socket, from a single-threaded epoll loop.
+// Every client gets its own command state and cursor over the same database; commands run one client batch at a time, so writes are serialized without any locking.
+// A batch is whatever a client has sent so far, and its responses are sent back once the batch's changes have been committed to the write-ahead log, if any.
+
+kvds_error kvds_serve_socket(struct kvds_command_state *state, const char *path); // Serves until SIGINT or SIGTERM; state's write-ahead log is shared by all clients
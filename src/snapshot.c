@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: MIT
+#include "snapshot.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static kvds_snapshot *open_snapshots;
+
+kvds_snapshot *kvds_snapshot_open(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (uint64_t)st.st_size < sizeof(struct kvds_snapshot_header)) {
+    close(fd);
+    return NULL;
+  }
+  void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return NULL;
+  }
+
+  // Only the layout is checked here, in O(1); the entries themselves are checked as they are read, so that opening doesn't have to fault in the whole file
+  const struct kvds_snapshot_header *header = mapping;
+  uint64_t size = st.st_size;
+  bool valid = memcmp(header->magic, KVDS_SNAPSHOT_MAGIC, sizeof header->magic) == 0 && header->count < size / (sizeof(long long) + sizeof(uint64_t));
+  if (valid) {
+    uint64_t arrays_size = sizeof(*header) + header->count * sizeof(long long) + (header->count + 1) * sizeof(uint64_t);
+    valid = arrays_size <= size && header->heap_size == size - arrays_size;
+  }
+  if (!valid) {
+    munmap(mapping, size);
+    return NULL;
+  }
+
+  kvds_snapshot *snapshot = malloc(sizeof(kvds_snapshot));
+  snapshot->mapping = mapping;
+  snapshot->mapping_size = size;
+  snapshot->count = header->count;
+  snapshot->keys = (const long long *)((const char *)mapping + sizeof(*header));
+  snapshot->offsets = (const uint64_t *)&snapshot->keys[header->count];
+  snapshot->heap = (char *)&snapshot->offsets[header->count + 1];
+  snapshot->heap_size = header->heap_size;
+
+  snapshot->next = open_snapshots;
+  open_snapshots = snapshot;
+
+  return snapshot;
+}
+
+bool kvds_snapshot_entry(kvds_snapshot *snapshot, uint64_t i, long long *key, kvds_value *value) {
+  if (i >= snapshot->count) {
+    return false;
+  }
+  uint64_t start = snapshot->offsets[i];
+  uint64_t end = snapshot->offsets[i + 1];
+  if (start >= end || end > snapshot->heap_size || snapshot->heap[end - 1] != '\0') {
+    return false;
+  }
+  if (i > 0 && snapshot->keys[i - 1] >= snapshot->keys[i]) {
+    return false;
+  }
+  *key = snapshot->keys[i];
+  *value = kvds_value_borrow(&snapshot->heap[start], end - start - 1); // Databases never write through values, so handing out the read-only mapping is fine
+  return true;
+}
+
+void kvds_snapshot_close_all() {
+  while (open_snapshots != NULL) {
+    kvds_snapshot *next = open_snapshots->next;
+    munmap(open_snapshots->mapping, open_snapshots->mapping_size);
+    free(open_snapshots);
+    open_snapshots = next;
+  }
+}
+
+typedef struct kvds_snapshot_writer {
+  FILE *file;
+  uint64_t count;
+  uint64_t heap_size;
+  bool failed;
+} kvds_snapshot_writer;
+
+static bool kvds_snapshot_measure(void *_writer, long long key, const kvds_value *value) {
+  kvds_snapshot_writer *writer = _writer;
+  writer->count++;
+  writer->heap_size += value->length + 1;
+  return true;
+}
+
+static bool kvds_snapshot_write_key(void *_writer, long long key, const kvds_value *value) {
+  kvds_snapshot_writer *writer = _writer;
+  writer->failed |= fwrite(&key, sizeof key, 1, writer->file) != 1;
+  return !writer->failed;
+}
+
+static bool kvds_snapshot_write_offset(void *_writer, long long key, const kvds_value *value) {
+  kvds_snapshot_writer *writer = _writer;
+  writer->failed |= fwrite(&writer->heap_size, sizeof writer->heap_size, 1, writer->file) != 1;
+  writer->heap_size += value->length + 1;
+  return !writer->failed;
+}
+
+static bool kvds_snapshot_write_value(void *_writer, long long key, const kvds_value *value) {
+  kvds_snapshot_writer *writer = _writer;
+  writer->failed |= fwrite(kvds_value_data(value), 1, value->length, writer->file) != value->length;
+  writer->failed |= fputc('\0', writer->file) == EOF; // Not needed for reading the snapshot back, but handy for looking at it
+  return !writer->failed;
+}
+
+bool kvds_snapshot_save(const char *path, void (*iterate)(void *context, bool (*callback)(void *callback_context, long long key, const kvds_value *value), void *callback_context), void *context) {
+  // Write to a temporary file first, so that a crash halfway through never leaves a broken snapshot at path
+  char *temp_path = malloc(strlen(path) + 5);
+  strcpy(temp_path, path);
+  strcat(temp_path, ".tmp");
+
+  kvds_snapshot_writer writer = {
+    .file = fopen(temp_path, "wb"),
+    .count = 0,
+    .heap_size = 0,
+    .failed = false,
+  };
+  if (writer.file == NULL) {
+    free(temp_path);
+    return false;
+  }
+
+  iterate(context, kvds_snapshot_measure, &writer);
+
+  struct kvds_snapshot_header header = {
+    .count = writer.count,
+    .heap_size = writer.heap_size,
+    .reserved = 0,
+  };
+  memcpy(header.magic, KVDS_SNAPSHOT_MAGIC, sizeof header.magic);
+  writer.failed |= fwrite(&header, sizeof header, 1, writer.file) != 1;
+
+  iterate(context, kvds_snapshot_write_key, &writer);
+
+  writer.heap_size = 0;
+  iterate(context, kvds_snapshot_write_offset, &writer);
+  writer.failed |= fwrite(&writer.heap_size, sizeof writer.heap_size, 1, writer.file) != 1;
+
+  iterate(context, kvds_snapshot_write_value, &writer);
+
+  writer.failed |= fflush(writer.file) != 0;
+  writer.failed |= fsync(fileno(writer.file)) != 0;
+  writer.failed |= fclose(writer.file) != 0;
+
+  if (!writer.failed) {
+    writer.failed |= rename(temp_path, path) != 0;
+  }
+  if (writer.failed) {
+    unlink(temp_path);
+  }
+  free(temp_path);
+  return !writer.failed;
+}
@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "value.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Binary snapshots of a database, laid out so that they can be memory-mapped and used without parsing:
+//   header:  struct kvds_snapshot_header
+//   keys:    long long[count], strictly ascending
+//   offsets: uint64_t[count + 1], value i spans heap[offsets[i]] up to heap[offsets[i + 1]], including its terminating NUL
+//   heap:    the values, back to back
+// Values handed out from an open snapshot are borrowed from the mapping, which stays around until kvds_snapshot_close_all.
+
+#define KVDS_SNAPSHOT_MAGIC "KVDSSNP1"
+
+struct kvds_snapshot_header {
+  char magic[8];
+  uint64_t count;
+  uint64_t heap_size;
+  uint64_t reserved;
+};
+
+typedef struct kvds_snapshot {
+  void *mapping;
+  uint64_t mapping_size;
+
+  uint64_t count;
+  const long long *keys;
+  const uint64_t *offsets;
+  char *heap;
+  uint64_t heap_size;
+
+  struct kvds_snapshot *next;
+} kvds_snapshot;
+
+kvds_snapshot *kvds_snapshot_open(const char *path); // Returns NULL if the file can't be mapped or its layout is broken; the snapshot stays mapped until kvds_snapshot_close_all
+bool kvds_snapshot_entry(kvds_snapshot *snapshot, uint64_t i, long long *key, kvds_value *value); // Returns false if entry i is out of order or out of bounds
+void kvds_snapshot_close_all();
+
+// Calls iterate once per pass over the database; iterate must visit every entry in ascending order, calling the callback it's given
+bool kvds_snapshot_save(const char *path, void (*iterate)(void *context, bool (*callback)(void *callback_context, long long key, const kvds_value *value), void *callback_context), void *context);
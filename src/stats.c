@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: MIT
+#include "stats.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool kvds_stats_timing = false;
+
+#ifndef KVDS_NO_STATS
+
+static kvds_stats_record *kvds_stats_records = NULL;
+_Thread_local kvds_stats_record *kvds_stats_self = NULL;
+
+static pthread_once_t kvds_stats_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t kvds_stats_key;
+
+static void kvds_stats_disown(void *_record) {
+  kvds_stats_record *record = _record;
+  __atomic_store_n(&record->owned, false, __ATOMIC_RELEASE);
+}
+
+static void kvds_stats_create_key() {
+  pthread_key_create(&kvds_stats_key, kvds_stats_disown);
+}
+
+kvds_stats_record *kvds_stats_claim() {
+  kvds_stats_record *record;
+  // Adopt a record left behind by an exited thread if there is one, and keep adding to its counts
+  for (record = __atomic_load_n(&kvds_stats_records, __ATOMIC_ACQUIRE); record != NULL; record = record->next) {
+    bool owned = false;
+    if (!__atomic_load_n(&record->owned, __ATOMIC_RELAXED) && __atomic_compare_exchange_n(&record->owned, &owned, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+  if (record == NULL) {
+    record = calloc(1, sizeof(kvds_stats_record));
+    record->owned = true;
+    record->next = __atomic_load_n(&kvds_stats_records, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&kvds_stats_records, &record->next, record, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+      // record->next was updated to the new head; retry
+    }
+  }
+
+  pthread_once(&kvds_stats_key_once, kvds_stats_create_key);
+  pthread_setspecific(kvds_stats_key, record); // Just for the destructor
+  return record;
+}
+
+void kvds_stats_collect(kvds_stats *total) {
+  memset(total, 0, sizeof(kvds_stats));
+  // kvds_stats is nothing but counters, so it can be added up as a flat array of them
+  unsigned long long *sums = (unsigned long long *)total;
+  for (kvds_stats_record *record = __atomic_load_n(&kvds_stats_records, __ATOMIC_ACQUIRE); record != NULL; record = record->next) {
+    unsigned long long *counts = (unsigned long long *)&record->stats;
+    for (size_t i = 0; i < sizeof(kvds_stats) / sizeof(unsigned long long); i++) {
+      sums[i] += __atomic_load_n(&counts[i], __ATOMIC_RELAXED);
+    }
+  }
+}
+
+#else
+
+void kvds_stats_collect(kvds_stats *total) {
+  memset(total, 0, sizeof(kvds_stats));
+}
+
+#endif
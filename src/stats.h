@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: MIT
+#pragma once
+#include <stdbool.h>
+#include <time.h>
+
+// Runtime counters of what the commands and algorithms are doing, printed by the stats command.
+// Every thread counts into a record of its own, which only it ever writes to, so counting is a plain load and store (relaxed atomics only keep the compiler from tearing them for kvds_stats_collect); collecting adds up the records of every thread that has counted anything.
+// Records are never freed, only handed over to new threads once their owner has exited, the same as in ebr.c, so the counts of exited threads (e.g. shards' workers) are kept.
+// Define KVDS_NO_STATS when compiling to turn every counter into a no-op.
+// Timing commands takes two clock reads per command, so unlike the counters, it is off unless kvds_stats_timing is set at runtime.
+
+#define KVDS_STATS_BUCKETS 32 // Histograms have power-of-two buckets: bucket 0 counts zeroes, and bucket i counts values below 2^i (and at least 2^(i-1)), with the last one taking everything above as well
+#define KVDS_STATS_COMMANDS 32 // At least as many as there are kinds of commands
+
+enum kvds_stat {
+  KVDS_STAT_NODE_VISITS, // Nodes looked at while locating a key
+  KVDS_STAT_REBUILDS, // Subtrees rebuilt from scratch to balance them
+  KVDS_STAT_ROTATIONS,
+  KVDS_STAT_COUNT,
+};
+
+typedef struct kvds_stats {
+  unsigned long long counters[KVDS_STAT_COUNT];
+  unsigned long long rebuild_sizes[KVDS_STATS_BUCKETS]; // Nodes in each rebuilt subtree
+  unsigned long long commands[KVDS_STATS_COMMANDS]; // Commands run, by kind
+  unsigned long long command_latencies[KVDS_STATS_COMMANDS][KVDS_STATS_BUCKETS]; // Nanoseconds taken by each command, by kind; only kept with kvds_stats_timing
+} kvds_stats;
+
+extern bool kvds_stats_timing; // Whether kvds_stats_command times commands as well as counting them; set before any commands run
+
+void kvds_stats_collect(kvds_stats *total); // Adds up the counts of all threads into total; the counts of threads still counting may be slightly behind, and everything is 0 under KVDS_NO_STATS
+
+#ifndef KVDS_NO_STATS
+
+typedef struct kvds_stats_record {
+  kvds_stats stats;
+  bool owned;
+  struct kvds_stats_record *next;
+} kvds_stats_record;
+
+extern _Thread_local kvds_stats_record *kvds_stats_self;
+kvds_stats_record *kvds_stats_claim();
+
+static inline kvds_stats *kvds_stats_local() {
+  kvds_stats_record *self = kvds_stats_self;
+  if (__builtin_expect(self == NULL, 0)) {
+    self = kvds_stats_self = kvds_stats_claim();
+  }
+  return &self->stats;
+}
+
+static inline void kvds_stats_bump(unsigned long long *counter, unsigned long long amount) {
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + amount, __ATOMIC_RELAXED);
+}
+
+static inline int kvds_stats_bucket(unsigned long long value) {
+  int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+  return bucket < KVDS_STATS_BUCKETS ? bucket : KVDS_STATS_BUCKETS - 1;
+}
+
+static inline void kvds_stats_count(enum kvds_stat stat, unsigned long long amount) {
+  kvds_stats_bump(&kvds_stats_local()->counters[stat], amount);
+}
+
+static inline void kvds_stats_rebuild(unsigned long long size) {
+  kvds_stats *stats = kvds_stats_local();
+  kvds_stats_bump(&stats->counters[KVDS_STAT_REBUILDS], 1);
+  kvds_stats_bump(&stats->rebuild_sizes[kvds_stats_bucket(size)], 1);
+}
+
+// Start of a timed section, for kvds_stats_command
+static inline long long kvds_stats_clock() {
+  if (!kvds_stats_timing) {
+    return 0;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ll + now.tv_nsec;
+}
+
+static inline void kvds_stats_command(int kind, long long started) {
+  kvds_stats *stats = kvds_stats_local();
+  kvds_stats_bump(&stats->commands[kind], 1);
+  if (kvds_stats_timing) {
+    kvds_stats_bump(&stats->command_latencies[kind][kvds_stats_bucket(kvds_stats_clock() - started)], 1);
+  }
+}
+
+#else
+
+static inline void kvds_stats_count(enum kvds_stat stat, unsigned long long amount) {
+  // pass
+}
+static inline void kvds_stats_rebuild(unsigned long long size) {
+  // pass
+}
+static inline long long kvds_stats_clock() {
+  return 0;
+}
+static inline void kvds_stats_command(int kind, long long started) {
+  // pass
+}
+
+#endif
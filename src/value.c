@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: MIT
+#include "value.h"
+#include <stdlib.h>
+
+#define KVDS_VALUE_SMALLEST_CLASS 32
+
+typedef struct kvds_value_large {
+  struct kvds_value_large *prev;
+  struct kvds_value_large *next;
+  char data[];
+} kvds_value_large;
+
+static inline int kvds_value_class(size_t length) {
+  int class = 0;
+  while (class < KVDS_VALUE_CLASSES && ((size_t)KVDS_VALUE_SMALLEST_CLASS << class) < length) {
+    class++;
+  }
+  return class; // KVDS_VALUE_CLASSES if too long for any
+}
+
+void kvds_value_arena_init(kvds_value_arena *arena, enum kvds_allocator allocator) {
+  for (int class = 0; class < KVDS_VALUE_CLASSES; class++) {
+    kvds_arena_init(&arena->classes[class], (size_t)KVDS_VALUE_SMALLEST_CLASS << class, allocator); // Doesn't map anything until the first value of that size
+  }
+  arena->large = NULL;
+}
+
+void kvds_value_arena_release(kvds_value_arena *arena) {
+  for (int class = 0; class < KVDS_VALUE_CLASSES; class++) {
+    kvds_arena_release(&arena->classes[class]);
+  }
+  while (arena->large != NULL) {
+    kvds_value_large *next = arena->large->next;
+    free(arena->large);
+    arena->large = next;
+  }
+}
+
+void kvds_value_store(kvds_value_arena *arena, kvds_value *slot, const kvds_value *value) {
+  slot->length = value->length;
+  if (value->length <= KVDS_VALUE_INLINE) {
+    slot->kind = KVDS_VALUE_INLINE_BYTES;
+    memcpy(slot->bytes, kvds_value_data(value), value->length);
+    return;
+  }
+  if (value->kind == KVDS_VALUE_BORROWED) {
+    slot->kind = KVDS_VALUE_BORROWED;
+    slot->pointer = value->pointer;
+    return;
+  }
+
+  char *storage;
+  int class = kvds_value_class(value->length);
+  if (class < KVDS_VALUE_CLASSES) {
+    storage = kvds_arena_alloc(&arena->classes[class]);
+  } else {
+    kvds_value_large *large = malloc(sizeof(kvds_value_large) + value->length);
+    large->prev = NULL;
+    large->next = arena->large;
+    if (arena->large != NULL) {
+      arena->large->prev = large;
+    }
+    arena->large = large;
+    storage = large->data;
+  }
+  memcpy(storage, kvds_value_data(value), value->length);
+  slot->kind = KVDS_VALUE_ARENA;
+  slot->pointer = storage;
+}
+
+void kvds_value_replace(kvds_value_arena *arena, kvds_value *slot, const kvds_value *value) {
+  // Store first, in case value points into the slot's own storage
+  kvds_value stored;
+  kvds_value_store(arena, &stored, value);
+  kvds_value_clear(arena, slot);
+  *slot = stored;
+}
+
+void kvds_value_clear(kvds_value_arena *arena, kvds_value *slot) {
+  if (slot->kind == KVDS_VALUE_ARENA) {
+    int class = kvds_value_class(slot->length);
+    if (class < KVDS_VALUE_CLASSES) {
+      kvds_arena_free(&arena->classes[class], (char *)slot->pointer);
+    } else {
+      kvds_value_large *large = (kvds_value_large *)(slot->pointer - offsetof(kvds_value_large, data));
+      if (large->prev != NULL) {
+        large->prev->next = large->next;
+      } else {
+        arena->large = large->next;
+      }
+      if (large->next != NULL) {
+        large->next->prev = large->prev;
+      }
+      free(large);
+    }
+  }
+  slot->length = 0;
+  slot->kind = KVDS_VALUE_INLINE_BYTES;
+}
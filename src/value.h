@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "arena.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Values stored in the database. Values are sized by their length rather than NUL-terminated.
+// A stored value up to KVDS_VALUE_INLINE bytes long lives inside the kvds_value itself (and hence inside the node holding it), so reading it costs no extra cache miss; longer values go to the database's value arena.
+// Values passed into the database are either transient (copied when stored) or borrowed (referenced in place for as long as the database lives, e.g. values in a mapped snapshot).
+
+#define KVDS_VALUE_INLINE 24
+
+enum kvds_value_kind {
+  KVDS_VALUE_INLINE_BYTES, // In bytes
+  KVDS_VALUE_ARENA, // In pointer, owned by a kvds_value_arena
+  KVDS_VALUE_BORROWED, // In pointer, owned by someone who will keep it around
+  KVDS_VALUE_TRANSIENT, // In pointer, only valid for the duration of a call; never stored
+};
+
+typedef struct kvds_value {
+  uint32_t length;
+  uint8_t kind; // enum kvds_value_kind
+  union {
+    char bytes[KVDS_VALUE_INLINE];
+    const char *pointer;
+  };
+} kvds_value;
+
+#define KVDS_VALUE_CLASSES 8 // Power-of-two size classes, from 32 up to 4096 bytes; longer values are malloc-ed
+
+typedef struct kvds_value_arena {
+  kvds_arena classes[KVDS_VALUE_CLASSES];
+  struct kvds_value_large *large; // Values too long for any size class
+} kvds_value_arena;
+
+static inline const char *kvds_value_data(const kvds_value *value) {
+  return value->kind == KVDS_VALUE_INLINE_BYTES ? value->bytes : value->pointer;
+}
+
+static inline kvds_value kvds_value_wrap(const char *data, size_t length) {
+  kvds_value value = {.length = length, .kind = KVDS_VALUE_TRANSIENT};
+  value.pointer = data;
+  return value;
+}
+
+static inline kvds_value kvds_value_borrow(const char *data, size_t length) {
+  kvds_value value = {.length = length, .kind = KVDS_VALUE_BORROWED};
+  value.pointer = data;
+  return value;
+}
+
+static inline bool kvds_value_equal(const kvds_value *a, const kvds_value *b) {
+  return a->length == b->length && memcmp(kvds_value_data(a), kvds_value_data(b), a->length) == 0;
+}
+
+void kvds_value_arena_init(kvds_value_arena *arena, enum kvds_allocator allocator);
+void kvds_value_arena_release(kvds_value_arena *arena); // Frees all values stored through the arena at once
+
+void kvds_value_store(kvds_value_arena *arena, kvds_value *slot, const kvds_value *value); // Stores a copy of value into an empty slot (unless value is borrowed and too long to inline)
+void kvds_value_replace(kvds_value_arena *arena, kvds_value *slot, const kvds_value *value); // Same, but frees whatever was in the slot before
+void kvds_value_clear(kvds_value_arena *arena, kvds_value *slot); // Frees the value in the slot, leaving it empty
@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: MIT
+#include "wal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Record layout, in host byte order:
+//   uint32_t crc;      covers everything after it
+//   uint8_t type;      enum kvds_wal_record_type
+//   int64_t key;
+//   uint32_t data_len;
+//   char data[data_len];
+#define KVDS_WAL_HEADER_SIZE (4 + 1 + 8 + 4)
+
+static uint32_t kvds_wal_crc_table[256];
+
+static uint32_t kvds_wal_crc(const unsigned char *bytes, size_t size) {
+  // CRC-32 (IEEE), table built on first use
+  if (kvds_wal_crc_table[1] == 0) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = crc & 1 ? (crc >> 1) ^ 0xedb88320u : crc >> 1;
+      }
+      kvds_wal_crc_table[i] = crc;
+    }
+  }
+  uint32_t crc = 0xffffffffu;
+  for (size_t i = 0; i < size; i++) {
+    crc = kvds_wal_crc_table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc ^ 0xffffffffu;
+}
+
+static long long kvds_wal_now_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ll + now.tv_nsec;
+}
+
+// Returns the size of the intact prefix of the log
+static size_t kvds_wal_replay(const unsigned char *log, size_t size, void (*apply)(void *context, enum kvds_wal_record_type type, long long key, const char *data, size_t data_len), void *context) {
+  size_t offset = 0;
+  while (size - offset >= KVDS_WAL_HEADER_SIZE) {
+    const unsigned char *record = log + offset;
+    uint32_t crc;
+    uint8_t type;
+    int64_t key;
+    uint32_t data_len;
+    memcpy(&crc, record, 4);
+    memcpy(&type, record + 4, 1);
+    memcpy(&key, record + 5, 8);
+    memcpy(&data_len, record + 13, 4);
+
+    if (data_len > size - offset - KVDS_WAL_HEADER_SIZE) {
+      break; // Torn
+    }
+    if (kvds_wal_crc(record + 4, KVDS_WAL_HEADER_SIZE - 4 + data_len) != crc) {
+      break; // Torn or corrupt; nothing after it can be trusted either
+    }
+    if (type != KVDS_WAL_WRITE && type != KVDS_WAL_DELETE) {
+      break;
+    }
+    apply(context, type, key, (const char *)record + KVDS_WAL_HEADER_SIZE, data_len);
+    offset += KVDS_WAL_HEADER_SIZE + data_len;
+  }
+  return offset;
+}
+
+kvds_wal *kvds_wal_open(const char *path, enum kvds_wal_sync sync, long long budget_us, void (*apply)(void *context, enum kvds_wal_record_type type, long long key, const char *data, size_t data_len), void *context) {
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd == -1) {
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return NULL;
+  }
+
+  size_t intact = 0;
+  if (st.st_size > 0) {
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+      close(fd);
+      return NULL;
+    }
+    intact = kvds_wal_replay(mapping, st.st_size, apply, context);
+    munmap(mapping, st.st_size);
+  }
+  // Cut off the torn tail, so that new records don't end up behind it
+  if ((intact != (size_t)st.st_size && ftruncate(fd, intact) == -1) || lseek(fd, intact, SEEK_SET) == -1) {
+    close(fd);
+    return NULL;
+  }
+
+  kvds_wal *wal = malloc(sizeof(kvds_wal));
+  wal->fd = fd;
+  wal->size = intact;
+  wal->broken = false;
+  wal->sync = sync;
+  wal->budget_ns = budget_us * 1000;
+  wal->capacity = 64 * 1024;
+  wal->buffer = malloc(wal->capacity);
+  wal->used = 0;
+  wal->oldest_pending_ns = 0;
+  wal->commits = 0;
+  return wal;
+}
+
+void kvds_wal_close(kvds_wal *wal) {
+  kvds_wal_commit(wal);
+  close(wal->fd);
+  free(wal->buffer);
+  free(wal);
+}
+
+bool kvds_wal_commit(kvds_wal *wal) {
+  if (wal->used == 0) {
+    return true;
+  }
+  size_t written = 0;
+  while (written < wal->used) {
+    ssize_t result = write(wal->fd, wal->buffer + written, wal->used - written);
+    if (result == -1 && errno == EINTR) {
+      continue;
+    }
+    if (result == -1) {
+      // Keep what didn't make it for the next commit, so that it continues the partial record instead of writing it again behind it
+      memmove(wal->buffer, wal->buffer + written, wal->used - written);
+      wal->used -= written;
+      wal->size += written;
+      return false;
+    }
+    written += result;
+  }
+  wal->size += wal->used;
+  wal->used = 0;
+  wal->commits++;
+  if (wal->sync != KVDS_WAL_SYNC_NONE) {
+    return fdatasync(wal->fd) == 0;
+  }
+  return true;
+}
+
+bool kvds_wal_append(kvds_wal *wal, enum kvds_wal_record_type type, long long key, const char *data, size_t data_len) {
+  size_t size = KVDS_WAL_HEADER_SIZE + data_len;
+  if (wal->broken) {
+    return false;
+  }
+  if (wal->used + size > wal->capacity) {
+    if (!kvds_wal_commit(wal)) {
+      return false;
+    }
+    if (size > wal->capacity) {
+      wal->capacity = size;
+      wal->buffer = realloc(wal->buffer, wal->capacity);
+    }
+  }
+  if (wal->used == 0) {
+    wal->oldest_pending_ns = wal->budget_ns > 0 ? kvds_wal_now_ns() : 0;
+  }
+
+  unsigned char *record = (unsigned char *)wal->buffer + wal->used;
+  uint8_t type_byte = type;
+  int64_t key64 = key;
+  uint32_t data_len32 = data_len;
+  memcpy(record + 4, &type_byte, 1);
+  memcpy(record + 5, &key64, 8);
+  memcpy(record + 13, &data_len32, 4);
+  if (data_len > 0) {
+    memcpy(record + KVDS_WAL_HEADER_SIZE, data, data_len);
+  }
+  uint32_t crc = kvds_wal_crc(record + 4, size - 4);
+  memcpy(record, &crc, 4);
+  wal->used += size;
+
+  if (wal->sync == KVDS_WAL_SYNC_ALWAYS && !kvds_wal_commit(wal)) {
+    // The change is going to be refused, so take the record back, out of the buffer and from the file, where it may be partly or wholly written already
+    // Failed records never stay pending in this mode, so this one started where the file ended before it
+    size_t start = wal->size + wal->used - size;
+    wal->used = 0;
+    if (ftruncate(wal->fd, start) == 0 && lseek(wal->fd, start, SEEK_SET) != -1) {
+      wal->size = start;
+    } else {
+      wal->broken = true;
+    }
+    return false;
+  }
+  return true;
+}
+
+bool kvds_wal_flush_point(kvds_wal *wal, bool idle) {
+  if (wal->used == 0) {
+    return true;
+  }
+  // With a budget, keep the group open while more input is waiting and the oldest record can still afford to wait for it
+  if (wal->budget_ns > 0 && !idle && kvds_wal_now_ns() - wal->oldest_pending_ns < wal->budget_ns) {
+    return true;
+  }
+  return kvds_wal_commit(wal);
+}
+
+bool kvds_wal_parse_sync(const char *name, enum kvds_wal_sync *sync) {
+  if (strcmp(name, "always") == 0) {
+    *sync = KVDS_WAL_SYNC_ALWAYS;
+  } else if (strcmp(name, "group") == 0) {
+    *sync = KVDS_WAL_SYNC_GROUP;
+  } else if (strcmp(name, "none") == 0) {
+    *sync = KVDS_WAL_SYNC_NONE;
+  } else {
+    return false;
+  }
+  return true;
+}
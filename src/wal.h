@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: MIT
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+// Append-only write-ahead log of writes and deletes.
+// Records are buffered and written out in groups, with a single write() + fdatasync() per group; see enum kvds_wal_sync for when groups are committed.
+// Each record is checksummed, so a torn write at the end of the log (e.g. from a crash mid-commit) is detected and cut off when replaying.
+
+enum kvds_wal_sync {
+  KVDS_WAL_SYNC_ALWAYS, // Commit every record on its own
+  KVDS_WAL_SYNC_GROUP, // Commit at flush points: after every input line, or once the latency budget runs out
+  KVDS_WAL_SYNC_NONE, // Write at flush points, but leave syncing to the OS
+};
+
+enum kvds_wal_record_type {
+  KVDS_WAL_WRITE = 'w',
+  KVDS_WAL_DELETE = 'd',
+};
+
+typedef struct kvds_wal {
+  int fd;
+  size_t size; // Bytes of the log in the file, including any written since the last sync
+  bool broken; // Set if a refused record couldn't be taken back out of the file; nothing gets appended behind it from then on
+  enum kvds_wal_sync sync;
+  long long budget_ns; // 0 to commit at every flush point; otherwise, how long a record may wait for more to join its group
+
+  char *buffer;
+  size_t used;
+  size_t capacity;
+  long long oldest_pending_ns; // When the first record of the current group was appended
+
+  long long commits;
+} kvds_wal;
+
+// Opens (creating if needed) the log at path, calling apply for each intact record already in it, in order, and dropping anything past the last intact one
+// Returns NULL if the log can't be opened or written to
+kvds_wal *kvds_wal_open(const char *path, enum kvds_wal_sync sync, long long budget_us, void (*apply)(void *context, enum kvds_wal_record_type type, long long key, const char *data, size_t data_len), void *context);
+void kvds_wal_close(kvds_wal *wal); // Commits anything pending first
+
+bool kvds_wal_append(kvds_wal *wal, enum kvds_wal_record_type type, long long key, const char *data, size_t data_len); // Returns false if the record couldn't be logged, in which case it is never replayed either
+bool kvds_wal_flush_point(kvds_wal *wal, bool idle); // Commits the pending group if the sync policy says so; idle means no more input is immediately available
+bool kvds_wal_commit(kvds_wal *wal); // On failure, whatever wasn't written yet stays pending, and the next commit picks up from there
+
+bool kvds_wal_parse_sync(const char *name, enum kvds_wal_sync *sync);
@@ -17,4 +17,30 @@ for f in ./*.in; do
   git diff --no-index $o <(cat $f | $KVDS $ALGO)
 done
 
+tmp=`mktemp -d`
+trap 'kill $server 2>/dev/null; rm -rf "$tmp"' EXIT
+
+# s 3 (zigzag 6), w "Hi\n\0!", r, k, s 7, e, q
+echo "TEST: --binary"
+cmp <(printf 'v\x05Hi\n\x00!k\x06n') \
+  <(printf 's\x06w\x05Hi\n\x00!rks\x0eeq' | $KVDS $ALGO --binary)
+
+echo "TEST: --wal"
+printf 'select 3 write Hello\nselect 5 write World\nselect 3 delete\n' |
+  $KVDS $ALGO --wal "$tmp/wal" >/dev/null
+diff -u <(printf 'no\nWorld\n') \
+  <(echo "select 3 exists select 5 read" | $KVDS $ALGO --wal "$tmp/wal")
+
+if command -v socat >/dev/null; then
+  echo "TEST: --listen"
+  $KVDS $ALGO --listen "$tmp/sock" &
+  server=$!
+  while [ ! -S "$tmp/sock" ]; do sleep 0.1; done
+  echo "s 3 w Left" | socat - UNIX-CONNECT:"$tmp/sock"
+  diff -u <(printf 'Left\n') \
+    <(echo "s 3 r" | socat - UNIX-CONNECT:"$tmp/sock")
+else
+  echo "SKIP: --listen (no socat)"
+fi
+
 echo "DONE: all tests passed!"